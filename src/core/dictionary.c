@@ -30,6 +30,7 @@
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 
 #include "dictionary.h"
 
@@ -83,27 +84,58 @@ token_add (
 } // end token_add
 
 
-// a < b  --> -1
-// a == b -->  0
-// a > b  -->  1
-static int
-cmp_words (
-           const Dictionary *d,
-           const uint8_t    *a,
-           const uint8_t    *b
-           )
+static uint64_t
+word2key (
+          const Dictionary *d,
+          const uint8_t    *word
+          )
 {
 
+  uint64_t ret;
   uint8_t i;
 
 
-  for ( i= 0; i < d->_text_length; ++i )
-    if ( a[i] < b[i] ) return -1;
-    else if ( a[i] > b[i] ) return 1;
+  for ( ret= 0, i= 0; i < d->_text_length; ++i )
+    ret= (ret<<8) | ((uint64_t) word[i]);
 
-  return 0;
+  return ret;
   
-} // end cmp_words
+} // end word2key
+
+
+static uint32_t
+hash_pos (
+          const Dictionary *d,
+          const uint64_t    key
+          )
+{
+  return (uint32_t) ((key*0x9E3779B97F4A7C15ULL)>>(64-d->_hash.bits));
+} // end hash_pos
+
+
+// Si la paraula ja està es manté la primera.
+static void
+hash_insert (
+             Dictionary     *d,
+             const uint64_t  key,
+             const uint16_t  addr
+             )
+{
+
+  uint32_t pos,mask;
+  
+
+  mask= d->_hash.size-1;
+  for ( pos= hash_pos ( d, key );
+        d->_hash.keys[pos] != 0 && d->_hash.keys[pos] != key;
+        pos= (pos+1)&mask );
+  if ( d->_hash.keys[pos] == 0 )
+    {
+      d->_hash.keys[pos]= key;
+      d->_hash.addrs[pos]= addr;
+    }
+  
+} // end hash_insert
 
 
 // token té longitut _text_length. Torna l'adreça o 0 si no es troba.
@@ -114,29 +146,18 @@ search_word (
              )
 {
 
-  const DictionaryEntry *entry;
-  int l,m,r,cmp;
-
-
-  if ( d->_N == 0 ) return 0;
-
-  l= 0; r= ((int) d->_N) - 1;
-  while ( l <= r )
-    {
-
-      // Valor a comparar.
-      if ( l == r ) m= l;
-      else m= l + (r-l)/2;
-      entry= &(d->_entries[m]);
-
-      // Compara
-      cmp= cmp_words ( d, word, entry->bytes );
-      if ( cmp == 0 ) return entry->addr;
-      else if ( cmp == -1 ) r= m-1;
-      else l= m+1;
-      
-    }
+  uint64_t key;
+  uint32_t pos,mask;
+  
 
+  key= word2key ( d, word );
+  mask= d->_hash.size-1;
+  for ( pos= hash_pos ( d, key );
+        d->_hash.keys[pos] != 0;
+        pos= (pos+1)&mask )
+    if ( d->_hash.keys[pos] == key )
+      return d->_hash.addrs[pos];
+  
   return 0; // No trobat.
   
 } // end search_word
@@ -231,6 +252,7 @@ parse_token (
              Dictionary      *d,
              const int        pos,
              const uint16_t   parse_buf,
+             const bool       skip_unknown,
              uint8_t         *cwords,
              char           **err
              )
@@ -257,6 +279,11 @@ parse_token (
     }
   
   if ( !find_token ( d, &addr, err ) ) return false;
+  if ( addr == 0 && skip_unknown )
+    {
+      ++(*cwords);
+      return true;
+    }
   dst_addr= ((uint32_t) parse_buf) + 2 + 4*((uint32_t) *cwords);
   // --> ADDR DICT
   if ( !memory_map_WRITEB ( d->_mem, dst_addr,
@@ -484,6 +511,37 @@ init_zscii2alph (
 } // end init_zscii2alph
 
 
+// Comprova si s'ha escrit en alguna de les pàgines de memòria
+// dinàmica que ocupa el diccionari, i si 'clear' és cert oblida les
+// escriptures. Torna cert si alguna estava modificada.
+static bool
+check_dirty_pages (
+                   const Dictionary *d,
+                   const bool        clear
+                   )
+{
+
+  uint32_t p,end;
+  bool ret;
+  uint8_t *dirty;
+  
+
+  if ( d->_end <= d->_addr || d->_addr >= d->_mem->dyn_mem_size )
+    return false;
+  end= d->_end < d->_mem->dyn_mem_size ? d->_end : d->_mem->dyn_mem_size;
+  dirty= d->_mem->dirty;
+  ret= false;
+  for ( p= d->_addr>>STATE_PAGE_BITS; p <= (end-1)>>STATE_PAGE_BITS; ++p )
+    {
+      if ( dirty[p]&STATE_DIRTY_WATCH ) ret= true;
+      if ( clear ) dirty[p]&= ~STATE_DIRTY_WATCH;
+    }
+  
+  return ret;
+  
+} // end check_dirty_pages
+
+
 
 
 /**********************/
@@ -497,7 +555,8 @@ dictionary_free (
 {
 
   g_free ( d->_token.v );
-  g_free ( d->_entries );
+  g_free ( d->_hash.keys );
+  g_free ( d->_hash.addrs );
   g_free ( d );
   
 } // end dictionary_free
@@ -517,8 +576,12 @@ dictionary_new (
   // Prepara.
   ret= g_new ( Dictionary, 1 );
   ret->_mem= mem;
-  ret->_entries= g_new ( DictionaryEntry, 1 );
-  ret->_size= 1;
+  ret->_addr= 0;
+  ret->_end= 0;
+  ret->_hash.bits= 1;
+  ret->_hash.size= 2;
+  ret->_hash.keys= g_new0 ( uint64_t, 2 );
+  ret->_hash.addrs= g_new ( uint16_t, 2 );
   ret->_N= 0;
   ret->_N_wseps= 0;
   ret->_token.v= g_new ( uint8_t, 1 );
@@ -560,10 +623,10 @@ dictionary_load (
                  )
 {
 
-  int n,i;
-  uint8_t aux,entry_length;
+  int n,i,bits;
+  uint8_t aux,entry_length,bytes[6];
+  uint16_t N;
   uint32_t raddr;
-  DictionaryEntry *entry;
   
   
   // Prepara
@@ -578,6 +641,8 @@ dictionary_load (
       d->_real_text_length= 9;
     }
   raddr= addr;
+  d->_addr= addr;
+  d->_end= addr;
   
   // Word separators
   if ( !memory_map_READB ( d->_mem, raddr, &(d->_N_wseps), false, err ) )
@@ -602,20 +667,28 @@ dictionary_load (
       return false;
     }
   
-  // Number entries
-  if ( !memory_map_READW ( d->_mem, raddr, &(d->_N), false, err ) )
+  // Number entries. En els diccionaris d'usuari un valor negatiu
+  // indica que les entrades no estan ordenades, com s'utilitza una
+  // taula hash no afecta.
+  if ( !memory_map_READW ( d->_mem, raddr, &N, false, err ) )
     return false;
   raddr+= 2;
-  if ( d->_N > d->_size )
+  d->_N= (N&0x8000) ? (uint16_t) (-((int32_t) ((int16_t) N))) : N;
+
+  // Prepara taula hash (ocupació <= 50%).
+  for ( bits= 1; (1U<<bits) < 2*((uint32_t) d->_N); ++bits );
+  if ( bits != d->_hash.bits )
     {
-      d->_size= d->_N;
-      d->_entries= g_renew ( DictionaryEntry, d->_entries, d->_size );
+      d->_hash.bits= bits;
+      d->_hash.size= 1U<<bits;
+      d->_hash.keys= g_renew ( uint64_t, d->_hash.keys, d->_hash.size );
+      d->_hash.addrs= g_renew ( uint16_t, d->_hash.addrs, d->_hash.size );
     }
+  memset ( d->_hash.keys, 0, sizeof(uint64_t)*d->_hash.size );
   
   // Entries
   for ( n= 0; n < (int) (d->_N); ++n )
     {
-      entry= &(d->_entries[n]);
       if ( raddr > 0xFFFF )
         {
           msgerror ( err, "Failed to load dictionary from address %X:"
@@ -623,16 +696,16 @@ dictionary_load (
                      addr, n, raddr );
           return false;
         }
-      entry->addr= (uint16_t) raddr;
       for ( i= 0; i < (int) (d->_text_length); ++i )
         {
-          if ( !memory_map_READB ( d->_mem, raddr, &(entry->bytes[i]),
+          if ( !memory_map_READB ( d->_mem, raddr+i, &(bytes[i]),
                                    false, err ) )
             return false;
-          ++raddr;
         }
-      raddr+= (uint32_t) (entry_length-d->_text_length);
+      hash_insert ( d, word2key ( d, bytes ), (uint16_t) raddr );
+      raddr+= (uint32_t) entry_length;
     }
+  d->_end= raddr;
   
   return true;
   
@@ -644,6 +717,7 @@ dictionary_parse (
                   Dictionary  *d,
                   uint16_t     text_buf,
                   uint16_t     parse_buf,
+                  const bool   skip_unknown,
                   char       **err
                   )
 {
@@ -682,7 +756,7 @@ dictionary_parse (
       if ( nchars == -1 && zc == ZC_NULL ) stop= true;
       else if ( zc == ZC_SPACE )
         {
-          if ( !parse_token ( d, wpos, parse_buf, &cwords, err ) )
+          if ( !parse_token ( d, wpos, parse_buf, skip_unknown, &cwords, err ) )
             return false;
           d->_token.N= 0;
           wpos= i+1;
@@ -690,13 +764,13 @@ dictionary_parse (
       else if ( check_is_wsep ( d, zc ) )
         {
           // Token anterior si hi ha
-          if ( !parse_token ( d, wpos, parse_buf, &cwords, err ) )
+          if ( !parse_token ( d, wpos, parse_buf, skip_unknown, &cwords, err ) )
             return false;
           d->_token.N= 0;
           // Token que sols conté el separador
           wpos= i;
           if ( !token_add ( d, zc, err ) ) return false;
-          if ( !parse_token ( d, wpos, parse_buf, &cwords, err ) )
+          if ( !parse_token ( d, wpos, parse_buf, skip_unknown, &cwords, err ) )
             return false;
           // Prepara pròxim
           d->_token.N= 0;
@@ -708,7 +782,7 @@ dictionary_parse (
         }
     }
   if ( cwords < max_words )
-    if ( !parse_token ( d, wpos, parse_buf, &cwords, err ) ) return false;
+    if ( !parse_token ( d, wpos, parse_buf, skip_unknown, &cwords, err ) ) return false;
 
   // Desa paraules escrites.
   if ( !memory_map_WRITEB ( d->_mem, parse_buf+1, cwords, true, err ) )
@@ -717,3 +791,98 @@ dictionary_parse (
   return true;
   
 } // end dictionary_parse
+
+
+void
+dictionary_cache_free (
+                       DictionaryCache *c
+                       )
+{
+
+  int i;
+
+
+  for ( i= 0; i < c->_N; ++i )
+    dictionary_free ( c->_v[i] );
+  g_free ( c );
+  
+} // end dictionary_cache_free
+
+
+DictionaryCache *
+dictionary_cache_new (
+                      MemoryMap *mem
+                      )
+{
+
+  DictionaryCache *ret;
+
+
+  ret= g_new ( DictionaryCache, 1 );
+  ret->_mem= mem;
+  ret->_N= 0;
+  
+  return ret;
+  
+} // end dictionary_cache_new
+
+
+Dictionary *
+dictionary_cache_get (
+                      DictionaryCache  *c,
+                      const uint32_t    addr,
+                      char            **err
+                      )
+{
+
+  Dictionary *ret;
+  bool valid;
+  int i,pos;
+  
+
+  // Invalida els diccionaris en els que s'ha escrit. Primer es
+  // comproven tots i després s'esborren les marques, perquè poden
+  // compartir pàgines.
+  for ( i= 0; i < c->_N; ++i )
+    if ( c->_valid[i] && check_dirty_pages ( c->_v[i], false ) )
+      c->_valid[i]= false;
+  for ( i= 0; i < c->_N; ++i )
+    check_dirty_pages ( c->_v[i], true );
+  
+  // Cerca.
+  for ( pos= 0; pos < c->_N && c->_v[pos]->_addr != addr; ++pos );
+  if ( pos == c->_N )
+    {
+      // Reutilitza el menys recent o en crea un nou.
+      if ( c->_N == DICTIONARY_CACHE_SIZE ) pos= c->_N-1;
+      else
+        {
+          c->_v[pos]= dictionary_new ( c->_mem, err );
+          if ( c->_v[pos] == NULL ) return NULL;
+          ++(c->_N);
+        }
+      c->_valid[pos]= false;
+    }
+  ret= c->_v[pos];
+  valid= c->_valid[pos];
+
+  // Mou al principi.
+  for ( i= pos; i > 0; --i )
+    {
+      c->_v[i]= c->_v[i-1];
+      c->_valid[i]= c->_valid[i-1];
+    }
+  c->_v[0]= ret;
+  c->_valid[0]= false;
+  
+  // Carrega si cal.
+  if ( !valid )
+    {
+      if ( !dictionary_load ( ret, addr, err ) ) return NULL;
+      check_dirty_pages ( ret, true );
+    }
+  c->_valid[0]= true;
+  
+  return ret;
+  
+} // end dictionary_cache_get
@@ -30,12 +30,6 @@
 
 #include "memory_map.h"
 
-typedef struct
-{
-  uint16_t addr;
-  uint8_t  bytes[6];
-} DictionaryEntry;
-
 typedef struct
 {
   uint8_t val;
@@ -47,11 +41,11 @@ typedef struct
 
   // PRIVAT
   MemoryMap       *_mem;
+  uint32_t         _addr; // Adreça on comença (inclosa)
+  uint32_t         _end;  // Adreça on acaba (no inclosa)
   uint8_t          _N_wseps;
   uint8_t          _wseps[256];
   uint16_t         _N;
-  DictionaryEntry *_entries;
-  uint16_t         _size;
   uint8_t          _text_length;
   int              _real_text_length;
   uint8_t          _version;
@@ -64,11 +58,39 @@ typedef struct
     uint8_t *v;
   } _token;
 
+  // Taula hash (adreçament obert) de les entrades. La clau és la
+  // paraula codificada (4 o 6 bytes) empaquetada en un enter. Una
+  // paraula codificada mai és 0 perquè té el bit de final.
+  struct
+  {
+    uint64_t *keys;  // 0 indica lliure.
+    uint16_t *addrs;
+    uint32_t  size;  // Potència de 2.
+    int       bits;  // log2(size)
+  } _hash;
+
   // ZSCII -> Alphabet table
   DictionaryAlphabetEntry _zscii2alph[256];
   
 } Dictionary;
 
+// Nombre de diccionaris d'usuari que es mantenen carregats.
+#define DICTIONARY_CACHE_SIZE 4
+
+// Cache LRU de diccionaris d'usuari indexats per adreça. Un
+// diccionari es torna a carregar quan s'escriu en la memòria que
+// ocupa.
+typedef struct
+{
+
+  // PRIVAT
+  MemoryMap  *_mem;
+  Dictionary *_v[DICTIONARY_CACHE_SIZE]; // De més a menys recent.
+  bool        _valid[DICTIONARY_CACHE_SIZE];
+  int         _N;
+  
+} DictionaryCache;
+
 void
 dictionary_free (
                  Dictionary *d
@@ -87,12 +109,34 @@ dictionary_load (
                  char           **err
                  );
 
+// Si 'skip_unknown' és cert les paraules que no estan en el
+// diccionari no s'escriuen en 'parse_buf' (però sí es compten).
 bool
 dictionary_parse (
                   Dictionary  *d,
                   uint16_t     text_buf,
                   uint16_t     parse_buf,
+                  const bool   skip_unknown,
                   char       **err
                   );
 
+void
+dictionary_cache_free (
+                       DictionaryCache *c
+                       );
+
+DictionaryCache *
+dictionary_cache_new (
+                      MemoryMap *mem
+                      );
+
+// Torna el diccionari que comença en 'addr', carregant-lo si no està
+// en la cache o si ha canviat. Torna NULL en cas d'error.
+Dictionary *
+dictionary_cache_get (
+                      DictionaryCache  *c,
+                      const uint32_t    addr,
+                      char            **err
+                      );
+
 #endif // __CORE_DICTIONARY_H__
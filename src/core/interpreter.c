@@ -25,6 +25,7 @@
 
 #include <assert.h>
 #include <glib.h>
+#include <inttypes.h>
 #include <libintl.h>
 #include <stdbool.h>
 #include <stddef.h>
@@ -64,11 +65,60 @@
 #define ZSCII_NEWLINE 13
 #define ZSCII_DELETE  8
 
-// 10 milisegons, de moment
-#define TIME_SLEEP 10000
-
 #define CURSOR "\u2588"
 
+// Camps (pare, germà i fill) de les entrades de la taula d'objectes.
+#define OBJ_PARENT  0
+#define OBJ_SIBLING 1
+#define OBJ_CHILD   2
+
+// Memòria màxima per a les imatges descodificades.
+#define PICTURES_CACHE_SIZE (32*1024*1024)
+
+// Grandària inicial del vector d'instruccions predescodificades.
+#define ICACHE_INIT_SIZE 1024
+
+#define FUSED_IND(KIND) ((KIND)-INST_LOADW_JE)
+
+// Si el compilador suporta etiquetes com a valors (GCC, Clang) el
+// motor 'threaded' salta directament a la implementació de cada
+// instrucció. En cas contrari es fa un 'switch' dins d'un bucle.
+#if defined(__GNUC__) && !defined(RUN_ZCODE_NO_THREADED_DISPATCH)
+#define THREADED_DISPATCH
+#endif
+
+#define COUNT_OPCODE(OPCODE)                                            \
+  if ( intp->opcodes != NULL )                                          \
+    {                                                                   \
+      ++intp->opcodes[(OPCODE)];                                        \
+      if ( intp->prof != NULL ) profiler_inst ( intp->prof, (OPCODE) ); \
+    }
+
+#define FETCH_CACHED_INST                                               \
+  {                                                                     \
+    ++intp->icount;                                                     \
+    inst= icache_get ( intp, state->PC );                               \
+    if ( inst == NULL ) goto fallback;                                  \
+    COUNT_OPCODE ( inst->opcode );                                      \
+    state->PC= inst->next_PC;                                           \
+  }
+
+#ifdef THREADED_DISPATCH
+#define INST(KIND) lbl_INST_ ## KIND
+#define NEXT                                                            \
+  {                                                                     \
+    FETCH_CACHED_INST;                                                  \
+    goto *labels[inst->kind];                                           \
+  }
+#else
+#define INST(KIND) case INST_ ## KIND
+#define NEXT                                                            \
+  {                                                                     \
+    FETCH_CACHED_INST;                                                  \
+    goto dispatch;                                                      \
+  }
+#endif
+
 
 
 
@@ -100,6 +150,101 @@ typedef union
   }         u8;
 } operand_t;
 
+// Tipus d'instruccions predescodificades. Les instruccions que no
+// tenen tipus propi s'executen amb 'exec_next_inst'.
+typedef enum
+  {
+    INST_FALLBACK= 0,
+    INST_JE,
+    INST_JL,
+    INST_JG,
+    INST_DEC_CHK,
+    INST_INC_CHK,
+    INST_JIN,
+    INST_TEST,
+    INST_OR,
+    INST_AND,
+    INST_TEST_ATTR,
+    INST_SET_ATTR,
+    INST_CLEAR_ATTR,
+    INST_STORE,
+    INST_INSERT_OBJ,
+    INST_LOADW,
+    INST_LOADB,
+    INST_GET_PROP,
+    INST_GET_PROP_ADDR,
+    INST_GET_NEXT_PROP,
+    INST_ADD,
+    INST_SUB,
+    INST_MUL,
+    INST_DIV,
+    INST_MOD,
+    INST_CALL_S,
+    INST_CALL_N,
+    INST_JZ,
+    INST_GET_SIBLING,
+    INST_GET_CHILD,
+    INST_GET_PARENT,
+    INST_GET_PROP_LEN,
+    INST_INC,
+    INST_DEC,
+    INST_PRINT_ADDR,
+    INST_REMOVE_OBJ,
+    INST_PRINT_OBJ,
+    INST_RET,
+    INST_JUMP,
+    INST_PRINT_PADDR,
+    INST_LOAD,
+    INST_RTRUE,
+    INST_RFALSE,
+    INST_PRINT,
+    INST_PRINT_RET,
+    INST_NOP,
+    INST_RET_POPPED,
+    INST_NEW_LINE,
+    INST_STOREW,
+    INST_STOREB,
+    INST_PUT_PROP,
+    INST_PRINT_CHAR,
+    INST_PRINT_NUM,
+    INST_RANDOM,
+    INST_PUSH,
+    INST_PULL,
+    INST_NOT,
+    INST_CHECK_ARG_COUNT,
+    // Superinstruccions (parells d'instruccions fusionades)
+    INST_LOADW_JE,
+    INST_GET_PROP_STORE,
+    INST_INC_CHK_JUMP,
+    INST_PUSH_PULL,
+    INST_NUM
+  } inst_kind_t;
+
+// Tipus de bot d'una instrucció predescodificada.
+typedef enum
+  {
+    BRANCH_NONE= 0,
+    BRANCH_RFALSE,
+    BRANCH_RTRUE,
+    BRANCH_JUMP
+  } branch_type_t;
+
+struct _InterpreterInst
+{
+  uint8_t   kind;        // inst_kind_t
+  uint8_t   opcode;      // Opcode original
+  uint8_t   nops;
+  uint8_t   store_var;
+  uint8_t   branch_type; // branch_type_t
+  bool      branch_cond; // Valor de la condició que provoca el bot
+  operand_t ops[8];
+  uint32_t  branch_addr; // Destí si BRANCH_JUMP
+  uint32_t  text_addr;   // Text de print i print_ret
+  uint32_t  next_PC;
+  uint32_t  fused;       // Superinstruccions: índex en 'icache.v' de la
+                         // segona instrucció
+};
+
 
 
 
@@ -238,6 +383,15 @@ static const uint16_t ZSCII_TO_UNICODE[97]=
     0xfffd  // Desconegut
   };
 
+// Noms de les superinstruccions (en l'ordre de 'inst_kind_t').
+static const char *FUSED_NAMES[INTP_FUSED_NUM]=
+  {
+    "loadw+je",
+    "get_prop+store",
+    "inc_chk+jump",
+    "push+pull"
+  };
+
 
 
 
@@ -251,6 +405,11 @@ exec_next_inst (
                 char        **err
                 );
 
+static void
+check_zcache (
+              Interpreter *intp
+              );
+
 
 
 
@@ -612,6 +771,8 @@ call_routine (
   if ( !state_new_frame ( intp->state, addr, num_local_vars,
                           discard_result, result_var, args_mask, err ) )
     return false;
+  if ( intp->prof != NULL )
+    profiler_call ( intp->prof, paddr, intp->state->frame_ind );
   for ( n= 0; n < num_local_vars; ++n )
     if ( !state_writevar ( intp->state, n+1, local_vars[n], err ) )
       return false;
@@ -991,6 +1152,8 @@ ret_val (
   res_var= (uint8_t) FRAME_NUM_RES(intp->state);
   if ( !state_free_frame ( intp->state, err ) )
     return false;
+  if ( intp->prof != NULL )
+    profiler_return ( intp->prof, intp->state->frame_ind );
   if ( !discard )
     {
       if ( !write_var ( intp, res_var, val, err ) )
@@ -1060,36 +1223,386 @@ get_object_offset (
 {
 
   // Comprovacions i obté property pointer
-  if ( intp->version <= 3 )
+  if ( object < 1 || object > intp->objs.max )
     {
-      if ( object < 1 || object > 255 )
-        {
-          ww ( "invalid object index %u", object );
-          return false;
-        }
-      *offset=
-        intp->object_table_offset +
-        31*2 + // Default properties
-        ((uint32_t) (object-1))*9
-        ;
+      ww ( "invalid object index %u", object );
+      return false;
     }
-  else
+  *offset= intp->objs.entries + ((uint32_t) (object-1))*intp->objs.size;
+
+  return true;
+  
+} // end get_object_offset
+
+
+// Torna un punter a l'entrada de l'objecte en la memòria
+// dinàmica. Comprova el rang una sola vegada, després es pot accedir
+// a l'entrada amb 'intp->objs.read', 'intp->objs.write', etc. Si
+// l'índex no és vàlid *entry és NULL.
+static bool
+get_object_entry (
+                  Interpreter     *intp,
+                  const uint16_t   object,
+                  uint8_t        **entry,
+                  char           **err
+                  )
+{
+
+  uint32_t offset;
+
+  
+  if ( !get_object_offset ( intp, object, &offset ) )
     {
-      if ( object < 1 )
-        {
-          ww ( "invalid object index %u", object );
+      *entry= NULL;
+      return true;
+    }
+  if ( offset < 64 || offset+intp->objs.size > intp->mem->dyn_mem_size )
+    {
+      msgerror ( err, "Failed to access object %u: entry (%X) is"
+                 " outside dynamic memory", object, offset );
+      return false;
+    }
+  *entry= &(intp->mem->dyn_mem[offset]);
+  
+  return true;
+  
+} // end get_object_entry
+
+
+static inline void
+obj_trace (
+           Interpreter     *intp,
+           const uint8_t   *p,
+           const uint16_t   val,
+           const MemAccess  type
+           )
+{
+
+  MemoryMap *mem;
+
+
+  mem= intp->mem;
+  if ( mem->tracer != NULL && mem->tracer->mem_access != NULL )
+    mem->tracer->mem_access ( mem->tracer, (uint32_t) (p-mem->dyn_mem),
+                              val, type );
+  
+} // end obj_trace
+
+
+// Marca les pàgines dels 'n' bytes (1 o 2) a partir de 'p'.
+static inline void
+obj_set_dirty (
+               Interpreter   *intp,
+               const uint8_t *p,
+               const uint32_t n
+               )
+{
+
+  uint32_t beg,end;
+  
+
+  beg= ((uint32_t) (p-intp->mem->dyn_mem))>>STATE_PAGE_BITS;
+  end= ((uint32_t) (p+n-1-intp->mem->dyn_mem))>>STATE_PAGE_BITS;
+  intp->mem->dirty[beg]|= STATE_DIRTY_OBJ;
+  if ( end != beg ) intp->mem->dirty[end]|= STATE_DIRTY_OBJ;
+  
+} // end obj_set_dirty
+
+
+// Accés als camps parent, sibling i child d'una entrada. Hi ha una
+// versió per a V1-3 (camps d'un byte) i una altra per a V4+ (camps
+// de dos bytes), que es trien en carregar (intp->objs).
+static uint16_t
+obj_read_v3 (
+             Interpreter   *intp,
+             const uint8_t *entry,
+             const int      field
+             )
+{
+
+  const uint8_t *p;
+  uint16_t ret;
+  
+
+  p= entry + 4 + field;
+  ret= (uint16_t) p[0];
+  if ( intp->mem->trace ) obj_trace ( intp, p, ret, MEM_ACCESS_READB );
+  
+  return ret;
+  
+} // end obj_read_v3
+
+
+static uint16_t
+obj_read_v4 (
+             Interpreter   *intp,
+             const uint8_t *entry,
+             const int      field
+             )
+{
+
+  const uint8_t *p;
+  uint16_t ret;
+  
+
+  p= entry + 6 + field*2;
+  ret= (((uint16_t) p[0])<<8) | ((uint16_t) p[1]);
+  if ( intp->mem->trace ) obj_trace ( intp, p, ret, MEM_ACCESS_READW );
+  
+  return ret;
+  
+} // end obj_read_v4
+
+
+static void
+obj_write_v3 (
+              Interpreter    *intp,
+              uint8_t        *entry,
+              const int       field,
+              const uint16_t  val
+              )
+{
+
+  uint8_t *p;
+  
+
+  p= entry + 4 + field;
+  p[0]= (uint8_t) val;
+  obj_set_dirty ( intp, p, 1 );
+  if ( intp->mem->trace )
+    obj_trace ( intp, p, (uint16_t) p[0], MEM_ACCESS_WRITEB );
+  
+} // end obj_write_v3
+
+
+static void
+obj_write_v4 (
+              Interpreter    *intp,
+              uint8_t        *entry,
+              const int       field,
+              const uint16_t  val
+              )
+{
+
+  uint8_t *p;
+  
+
+  p= entry + 6 + field*2;
+  p[0]= (uint8_t) (val>>8);
+  p[1]= (uint8_t) val;
+  obj_set_dirty ( intp, p, 2 );
+  if ( intp->mem->trace ) obj_trace ( intp, p, val, MEM_ACCESS_WRITEW );
+  
+} // end obj_write_v4
+
+
+// Torna el byte dels atributs on està 'attr' (no comprova el rang).
+static inline uint8_t *
+obj_attr_byte (
+               Interpreter    *intp,
+               uint8_t        *entry,
+               const uint16_t  attr,
+               uint8_t        *mask
+               )
+{
+
+  uint8_t *p;
+
+
+  p= entry + attr/8;
+  *mask= 1<<(7-(attr%8));
+  if ( intp->mem->trace )
+    obj_trace ( intp, p, (uint16_t) p[0], MEM_ACCESS_READB );
+  
+  return p;
+  
+} // end obj_attr_byte
+
+
+static inline void
+obj_attr_write (
+                Interpreter   *intp,
+                uint8_t       *p,
+                const uint8_t  val
+                )
+{
+
+  p[0]= val;
+  obj_set_dirty ( intp, p, 1 );
+  if ( intp->mem->trace )
+    obj_trace ( intp, p, (uint16_t) val, MEM_ACCESS_WRITEB );
+  
+} // end obj_attr_write
+
+
+// Consulta el bit STATE_DIRTY_PROPS de la pàgina. Si està actiu
+// l'esborra i anota el canvi en 'page_stamps'.
+static uint64_t
+props_page_stamp (
+                  Interpreter    *intp,
+                  const uint32_t  p
+                  )
+{
+
+  uint8_t *dirty;
+  
+
+  dirty= intp->mem->dirty;
+  if ( dirty[p]&STATE_DIRTY_PROPS )
+    {
+      dirty[p]&= ~STATE_DIRTY_PROPS;
+      intp->props.page_stamps[p]= ++intp->props.clock;
+    }
+  
+  return intp->props.page_stamps[p];
+  
+} // end props_page_stamp
+
+
+// Recorre la llista de propietats a partir de 'property_pointer'.
+static bool
+build_props (
+             Interpreter       *intp,
+             const uint16_t     property_pointer,
+             InterpreterProps  *props,
+             char             **err
+             )
+{
+
+  uint16_t offset;
+  uint8_t text_length,b0,b1,prop_num,prop_len;
+  uint32_t p,last;
+  int prev;
+  
+  
+  // Descarta capçalera.
+  if ( !memory_map_READB ( intp->mem, property_pointer,
+                           &text_length, false, err ) )
+    return false;
+  offset= property_pointer + 1 + ((uint16_t) text_length)*2;
+
+  // Recorre propietats.
+  memset ( props->addr, 0, sizeof(props->addr) );
+  memset ( props->len, 0, sizeof(props->len) );
+  memset ( props->next, 0, sizeof(props->next) );
+  props->pointer= property_pointer;
+  props->first= 0;
+  prev= 0;
+  do {
+    if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
+      return false;
+    if ( intp->version <= 3 )
+      {
+        prop_num= b0&0x1f;
+        prop_len= (b0>>5)+1;
+        ++offset;
+      }
+    else if ( b0&0x80 )
+      {
+        if ( !memory_map_READB ( intp->mem, offset+1, &b1, false, err ) )
           return false;
-        }
-      *offset=
-        intp->object_table_offset +
-        63*2 + // Default properties
-        ((uint32_t) (object-1))*14
-        ;
+        prop_num= b0&0x3f;
+        prop_len= b1&0x3f;
+        if ( prop_len == 0 ) prop_len= 64;
+        offset+= 2;
+      }
+    else
+      {
+        prop_num= b0&0x3f;
+        prop_len= (b0&0x40)!=0 ? 2 : 1;
+        ++offset;
+      }
+    if ( prev == 0 ) props->first= prop_num;
+    else if ( prev > 0 ) props->next[prev]= prop_num;
+    if ( prop_num != 0 && props->addr[prop_num] == 0 )
+      {
+        props->addr[prop_num]= offset;
+        props->len[prop_num]= prop_len;
+        prev= (int) prop_num;
+      }
+    else prev= -1; // Repetida, sols compta la primera aparició
+    if ( prop_num != 0 ) offset+= (uint16_t) prop_len;
+  } while ( prop_num != 0 );
+
+  // Pàgines dinàmiques ocupades. S'esborren els canvis pendents
+  // abans de fixar 'stamp'.
+  last= (uint32_t) offset - 1;
+  if ( last >= intp->mem->dyn_mem_size ) last= intp->mem->dyn_mem_size - 1;
+  props->page_beg= ((uint32_t) property_pointer)>>STATE_PAGE_BITS;
+  props->page_end= last>>STATE_PAGE_BITS;
+  if ( property_pointer >= intp->mem->dyn_mem_size )
+    props->page_end= props->page_beg - 1;
+  for ( p= props->page_beg; p <= props->page_end; ++p )
+    props_page_stamp ( intp, p );
+  props->stamp= ++intp->props.clock;
+  
+  return true;
+  
+} // end build_props
+
+
+// Torna l'índex de propietats de l'objecte, construint-lo si cal. Si
+// l'objecte no és vàlid *ret és NULL.
+static bool
+get_props (
+           Interpreter       *intp,
+           const uint16_t     object,
+           InterpreterProps **ret,
+           char             **err
+           )
+{
+
+  uint32_t property_pointer_offset,p,nsize;
+  uint16_t property_pointer;
+  InterpreterProps *props;
+  bool valid;
+  
+  
+  // Obté property pointer
+  if ( !get_object_offset ( intp, object, &property_pointer_offset ) )
+    {
+      *ret= NULL;
+      return true;
     }
+  property_pointer_offset+= (intp->version <= 3) ? 7 : 12;
+  if ( !memory_map_READW ( intp->mem, property_pointer_offset,
+                           &property_pointer, false, err ) )
+    return false;
 
+  // Comprova l'índex.
+  if ( (uint32_t) object >= intp->props.N )
+    {
+      nsize= intp->props.N == 0 ? 256 : intp->props.N;
+      while ( nsize <= (uint32_t) object ) nsize*= 2;
+      intp->props.v= g_renew ( InterpreterProps *, intp->props.v, nsize );
+      for ( p= intp->props.N; p < nsize; ++p )
+        intp->props.v[p]= NULL;
+      intp->props.N= nsize;
+    }
+  props= intp->props.v[object];
+  if ( props == NULL )
+    {
+      props= intp->props.v[object]= g_new ( InterpreterProps, 1 );
+      valid= false;
+    }
+  else
+    {
+      valid= (props->pointer == property_pointer);
+      for ( p= props->page_beg; valid && p <= props->page_end; ++p )
+        if ( props_page_stamp ( intp, p ) >= props->stamp )
+          valid= false;
+    }
+  if ( !valid && !build_props ( intp, property_pointer, props, err ) )
+    {
+      g_free ( props );
+      intp->props.v[object]= NULL;
+      return false;
+    }
+  *ret= props;
+  
   return true;
   
-} // end get_object_offset
+} // end get_props
 
 
 // addr==0 indica que no s'ha trobat.
@@ -1104,70 +1617,23 @@ get_prop_addr_len (
                    )
 {
 
-  uint32_t property_pointer_offset;
-  uint16_t property_pointer,offset;
-  uint8_t text_length,b0,b1,prop_num,prop_len;
+  InterpreterProps *props;
   
   
-  // Obté property pointer
-  if ( !get_object_offset ( intp, object, &property_pointer_offset ) )
+  if ( !get_props ( intp, object, &props, err ) ) return false;
+  if ( props == NULL )
     {
       *addr= 0; *len= 0;
-      return true;
     }
-  property_pointer_offset+= (intp->version <= 3) ? 7 : 12;
-  if ( !memory_map_READW ( intp->mem, property_pointer_offset,
-                           &property_pointer, false, err ) )
-    return false;
-  
-  // Descarta capçalera.
-  if ( !memory_map_READB ( intp->mem, property_pointer,
-                           &text_length, false, err ) )
-    return false;
-  offset= property_pointer + 1 + ((uint16_t) text_length)*2;
-  
-  // Busca propietat
-  if ( intp->version <= 3 )
+  else if ( property < 64 && props->addr[property] != 0 )
     {
-      prop_len= 0;
-      do {
-        offset+= (uint16_t) prop_len;
-        if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-          return false;
-        prop_num= b0&0x1f;
-        prop_len= (b0>>5)+1;
-        ++offset;
-      } while ( prop_num != 0 && ((uint16_t) prop_num) != property );
-      if ( prop_num == 0 ) *addr= 0;
-      else                 *addr= offset;
+      *addr= props->addr[property];
+      *len= props->len[property];
     }
-  else
+  else // Longitut de la marca de final de llista
     {
-      prop_len= 0;
-      do {
-        offset+= (uint16_t) prop_len;
-        if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-          return false;
-        if ( b0&0x80 )
-          {
-            if ( !memory_map_READB ( intp->mem, offset+1, &b1, false, err ) )
-              return false;
-            prop_num= b0&0x3f;
-            prop_len= b1&0x3f;
-            if ( prop_len == 0 ) prop_len= 64;
-            offset+= 2;
-          }
-        else
-          {
-            prop_num= b0&0x3f;
-            prop_len= (b0&0x40)!=0 ? 2 : 1;
-            ++offset;
-          }
-      } while ( prop_num != 0 && ((uint16_t) prop_num) != property );
-      if ( prop_num == 0 ) *addr= 0;
-      else                 *addr= offset;
+      *addr= 0; *len= 1;
     }
-  *len= prop_len;
   
   return true;
   
@@ -1307,87 +1773,15 @@ get_next_prop (
                )
 {
 
-  uint32_t property_pointer_offset;
-  uint16_t property_pointer,offset;
-  uint8_t text_length,b0,b1,prop_num,prop_len;
+  InterpreterProps *props;
   
 
-  // Obté property pointer
-  if ( !get_object_offset ( intp, object, &property_pointer_offset ) )
-    {
-      *result= 0;
-      return true;
-    }
-  property_pointer_offset+= (intp->version <= 3) ? 7 : 12;
-  if ( !memory_map_READW ( intp->mem, property_pointer_offset,
-                           &property_pointer, false, err ) )
-    return false;
-  
-  // Descarta capçalera.
-  if ( !memory_map_READB ( intp->mem, property_pointer,
-                           &text_length, false, err ) )
-    return false;
-  offset= property_pointer + 1 + ((uint16_t) text_length)*2;
-  
-  // Busca propietat
-  if ( intp->version <= 3 )
-    {
-      // Busca primera propietat
-      prop_len= 0;
-      prop_num= 0;
-      if ( property != 0 )
-        do {
-          offset+= (uint16_t) prop_len;
-          if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-            return false;
-          prop_num= b0&0x1f;
-          prop_len= (b0>>5)+1;
-          ++offset;
-        } while ( prop_num != 0 && ((uint16_t) prop_num) != property );
-      if ( prop_num != property ) *result= 0;
-      else // Cerca següent
-        {
-          offset+= (uint16_t) prop_len;
-          if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-            return false;
-          *result= (uint16_t) (b0&0x1f); // Si no en té més serà 0
-        }
-    }
-  else
-    {
-      // Busca primera propietat
-      prop_len= 0;
-      prop_num= 0;
-      if ( property != 0 )
-        do {
-          offset+= (uint16_t) prop_len;
-          if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-            return false;
-          if ( b0&0x80 )
-            {
-              if ( !memory_map_READB ( intp->mem, offset+1, &b1, false, err ) )
-                return false;
-              prop_num= b0&0x3f;
-              prop_len= b1&0x3f;
-              if ( prop_len == 0 ) prop_len= 64;
-              offset+= 2;
-            }
-          else
-            {
-              prop_num= b0&0x3f;
-              prop_len= (b0&0x40)!=0 ? 2 : 1;
-              ++offset;
-            }
-        } while ( prop_num != 0 && ((uint16_t) prop_num) != property );
-      if ( prop_num != property ) *result= 0;
-      else
-        {
-          offset+= (uint16_t) prop_len;
-          if ( !memory_map_READB ( intp->mem, offset, &b0, false, err ) )
-            return false;
-          *result= (uint16_t) (b0&0x3f);
-        }
-    }
+  if ( !get_props ( intp, object, &props, err ) ) return false;
+  if ( props == NULL ) *result= 0;
+  else if ( property == 0 ) *result= (uint16_t) props->first;
+  else if ( property < 64 && props->addr[property] != 0 )
+    *result= (uint16_t) props->next[property];
+  else *result= 0;
   
   return true;
   
@@ -1447,34 +1841,11 @@ get_child (
            )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t tmp8;
-  
-  
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    {
-      *res= 0;
-      *cond= false;
-      return true;
-    }
+  uint8_t *entry;
   
-  // Offset fill.
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4 + 2;
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      *res= (uint16_t) tmp8;
-    }
-  else
-    {
-      offset= object_offset + 6 + 4;
-      if ( !memory_map_READW ( intp->mem, offset, res, false, err ) )
-        return false;
-    }
   
-  // Condició
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  *res= entry == NULL ? 0 : intp->objs.read ( intp, entry, OBJ_CHILD );
   *cond= (*res!=0);
   
   return true;
@@ -1491,31 +1862,11 @@ get_parent (
             )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t tmp8;
+  uint8_t *entry;
   
   
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    {
-      *res= 0;
-      return true;
-    }
-  
-  // Offset pare.
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4;
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      *res= (uint16_t) tmp8;
-    }
-  else
-    {
-      offset= object_offset + 6;
-      if ( !memory_map_READW ( intp->mem, offset, res, false, err ) )
-        return false;
-    }
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  *res= entry == NULL ? 0 : intp->objs.read ( intp, entry, OBJ_PARENT );
 
   return true;
   
@@ -1532,33 +1883,11 @@ get_sibling (
              )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t tmp8;
-  
-  
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    {
-      *res= 0; *cond= false;
-      return true;
-    }
+  uint8_t *entry;
   
-  // Offset 'next'.
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4 + 1;
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      *res= (uint16_t) tmp8;
-    }
-  else
-    {
-      offset= object_offset + 6 + 2;
-      if ( !memory_map_READW ( intp->mem, offset, res, false, err ) )
-        return false;
-    }
   
-  // Condició
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  *res= entry == NULL ? 0 : intp->objs.read ( intp, entry, OBJ_SIBLING );
   *cond= (*res!=0);
   
   return true;
@@ -1577,13 +1906,25 @@ put_prop (
 {
   
   uint16_t addr;
-  uint8_t len;
+  uint8_t len,dirty0,dirty1;
+  uint32_t p0,p1;
   
   
   // Obté adreça i longitut
   if ( !get_prop_addr_len ( intp, object, property, &addr, &len, err ) )
     return false;
 
+  // Escriure el valor no canvia l'estructura de la llista de
+  // propietats, per tant l'índex continua sent vàlid.
+  p0= ((uint32_t) addr)>>STATE_PAGE_BITS;
+  p1= ((uint32_t) addr+len-1)>>STATE_PAGE_BITS;
+  if ( addr != 0 && ((uint32_t) addr+len) <= intp->mem->dyn_mem_size )
+    {
+      dirty0= intp->mem->dirty[p0]&STATE_DIRTY_PROPS;
+      dirty1= intp->mem->dirty[p1]&STATE_DIRTY_PROPS;
+    }
+  else dirty0= dirty1= STATE_DIRTY_PROPS;
+  
   // Obté contingut
   if ( len == 1 )
     {
@@ -1602,6 +1943,8 @@ put_prop (
                  " write property of length %u", len );
       return false;
     }
+  if ( dirty0 == 0 ) intp->mem->dirty[p0]&= ~STATE_DIRTY_PROPS;
+  if ( dirty1 == 0 ) intp->mem->dirty[p1]&= ~STATE_DIRTY_PROPS;
   
   return true;
   
@@ -1618,8 +1961,7 @@ test_attr (
            )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t mask,val;
+  uint8_t *entry,*p,mask;
   
 
   // Comprova rang
@@ -1630,19 +1972,14 @@ test_attr (
       return false;
     }
   
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
+  // Comprova atribut.
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  if ( entry == NULL ) *ret= false;
+  else
     {
-      *ret= false;
-      return true;
+      p= obj_attr_byte ( intp, entry, attr, &mask );
+      *ret= (p[0]&mask)!=0;
     }
-
-  // Comprova atribut.
-  offset= object_offset + attr/8;
-  mask= 1<<(7-(attr%8));
-  if ( !memory_map_READB ( intp->mem, offset, &val, false, err ) )
-    return false;
-  *ret= (val&mask)!=0;
   
   return true;
   
@@ -1658,8 +1995,7 @@ clear_attr (
             )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t mask,val;
+  uint8_t *entry,*p,mask;
   
 
   // Comprova rang
@@ -1670,18 +2006,13 @@ clear_attr (
       return false;
     }
   
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    return true;
-  
-  // Comprova atribut.
-  offset= object_offset + attr/8;
-  mask= 1<<(7-(attr%8));
-  if ( !memory_map_READB ( intp->mem, offset, &val, false, err ) )
-    return false;
-  val&= ~mask;
-  if ( !memory_map_WRITEB ( intp->mem, offset, val, false, err ) )
-    return false;
+  // Modifica atribut.
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  if ( entry != NULL )
+    {
+      p= obj_attr_byte ( intp, entry, attr, &mask );
+      obj_attr_write ( intp, p, p[0]&~mask );
+    }
   
   return true;
   
@@ -1697,8 +2028,7 @@ set_attr (
           )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t mask,val;
+  uint8_t *entry,*p,mask;
   
 
   // Comprova rang
@@ -1709,18 +2039,13 @@ set_attr (
       return false;
     }
   
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    return true;
-  
-  // Comprova atribut.
-  offset= object_offset + attr/8;
-  mask= 1<<(7-(attr%8));
-  if ( !memory_map_READB ( intp->mem, offset, &val, false, err ) )
-    return false;
-  val|= mask;
-  if ( !memory_map_WRITEB ( intp->mem, offset, val, false, err ) )
-    return false;
+  // Modifica atribut.
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  if ( entry != NULL )
+    {
+      p= obj_attr_byte ( intp, entry, attr, &mask );
+      obj_attr_write ( intp, p, p[0]|mask );
+    }
   
   return true;
   
@@ -1732,44 +2057,21 @@ jin (
      Interpreter     *intp,
      const uint16_t   a,
      const uint16_t   b,
+     bool            *ret,
      char           **err
      )
 {
 
-  uint32_t parent_offset;
-  uint16_t parent_u16;
-  uint8_t parent_u8;
-  bool is_parent;
+  uint8_t *entry;
   
   
   if ( a == 0 && b == 0 )
-    is_parent= true;
-  else if ( !get_object_offset ( intp, a, &parent_offset ) )
-    is_parent= false;
+    *ret= true;
   else
     {
-  
-      // Llig parent
-      if ( intp->version <= 3 )
-        {
-          parent_offset+= 4;
-          if ( !memory_map_READB ( intp->mem, parent_offset,
-                                   &parent_u8, false, err ) )
-            return false;
-          is_parent= (((uint16_t) parent_u8) == b);
-        }
-      else
-        {
-          parent_offset+= 6;
-          if ( !memory_map_READW ( intp->mem, parent_offset,
-                                   &parent_u16, false, err ) )
-            return false;
-          is_parent= (parent_u16 == b);
-        }
+      if ( !get_object_entry ( intp, a, &entry, err ) ) return false;
+      *ret= entry != NULL && intp->objs.read ( intp, entry, OBJ_PARENT ) == b;
     }
-
-  // Bota.
-  if ( !branch ( intp, is_parent, err ) ) return false;
   
   return true;
   
@@ -1784,121 +2086,44 @@ remove_obj (
             )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t tmp8;
+  uint8_t *entry;
   uint16_t parent,next,p,p_next;
-  bool stop;
   
   
-  // Obté object offset
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    return true;
-  
   // Obté pare, sibling i fica a null pare
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4;
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      parent= (uint16_t) tmp8;
-      // Si no té pare no fa res.
-      if ( parent == 0 ) return true;
-      if ( !memory_map_READB ( intp->mem, offset+1, &tmp8, false, err ) )
-        return false;
-      next= (uint16_t) tmp8;
-      if ( !memory_map_WRITEB ( intp->mem, offset, 0, false, err ) )
-        return false;
-      if ( !memory_map_WRITEB ( intp->mem, offset+1, 0, false, err ) )
-        return false;
-    }
-  else
-    {
-      offset= object_offset + 6;
-      if ( !memory_map_READW ( intp->mem, offset, &parent, false, err ) )
-        return false;
-      // Si no té pare no fa res.
-      if ( parent == 0 ) return true;
-      if ( !memory_map_READW ( intp->mem, offset+2, &next, false, err ) )
-        return false;
-      if ( !memory_map_WRITEW ( intp->mem, offset, 0, false, err ) )
-        return false;
-      if ( !memory_map_WRITEW ( intp->mem, offset+2, 0, false, err ) )
-        return false;
-    }
-
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  if ( entry == NULL ) return true;
+  parent= intp->objs.read ( intp, entry, OBJ_PARENT );
+  // Si no té pare no fa res.
+  if ( parent == 0 ) return true;
+  next= intp->objs.read ( intp, entry, OBJ_SIBLING );
+  intp->objs.write ( intp, entry, OBJ_PARENT, 0 );
+  intp->objs.write ( intp, entry, OBJ_SIBLING, 0 );
   
   // Elimina node de la llista de fills del pare
-  if ( !get_object_offset ( intp, parent, &object_offset ) )
-    return true;
-  if ( intp->version <= 3 )
-    {
-
-      // Primer fill.
-      offset= object_offset + 4 + 2;
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      p= (uint16_t) tmp8;
-      if ( p == object )
-        {
-          if ( !memory_map_WRITEB ( intp->mem, offset,
-                                    (uint8_t) next, false, err ) )
-            return false;
-          stop= true;
-        }
-      else stop= false;
+  if ( !get_object_entry ( intp, parent, &entry, err ) ) return false;
+  if ( entry == NULL ) return true;
 
-      // Cerca i fica a 0
-      while ( !stop && p != 0 )
-        {
-          if ( !get_object_offset ( intp, p, &object_offset ) )
-            return true;
-          offset= object_offset + 4 + 1;
-          if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-            return false;
-          p_next= (uint16_t) tmp8;
-          if ( p_next == object )
-            {
-              if ( !memory_map_WRITEB ( intp->mem, offset,
-                                        (uint8_t) next, false, err ) )
-                return false;
-              stop= true;
-            }
-          else p= p_next;
-        }
-      
+  // Primer fill.
+  p= intp->objs.read ( intp, entry, OBJ_CHILD );
+  if ( p == object )
+    {
+      intp->objs.write ( intp, entry, OBJ_CHILD, next );
+      return true;
     }
-  else
+  
+  // Cerca i fica a 0
+  while ( p != 0 )
     {
-
-      // Primer fill.
-      offset= object_offset + 6 + 4;
-      if ( !memory_map_READW ( intp->mem, offset, &p, false, err ) )
-        return false;
-      if ( p == object )
-        {
-          if ( !memory_map_WRITEW ( intp->mem, offset, next, false, err ) )
-            return false;
-          stop= true;
-        }
-      else stop= false;
-      
-      // Cerca i fica a 0
-      while ( !stop && p != 0 )
+      if ( !get_object_entry ( intp, p, &entry, err ) ) return false;
+      if ( entry == NULL ) return true;
+      p_next= intp->objs.read ( intp, entry, OBJ_SIBLING );
+      if ( p_next == object )
         {
-          if ( !get_object_offset ( intp, p, &object_offset ) )
-            return true;
-          offset= object_offset + 6 + 2;
-          if ( !memory_map_READW ( intp->mem, offset, &p_next, false, err ) )
-            return false;
-          if ( p_next == object )
-            {
-              if ( !memory_map_WRITEW ( intp->mem, offset, next, false, err ) )
-                return false;
-              stop= true;
-            }
-          else p= p_next;
+          intp->objs.write ( intp, entry, OBJ_SIBLING, next );
+          return true;
         }
-      
+      p= p_next;
     }
   
   return true;
@@ -1915,8 +2140,7 @@ insert_obj (
             )
 {
 
-  uint32_t object_offset,offset;
-  uint8_t tmp8;
+  uint8_t *entry;
   uint16_t next;
   
   
@@ -1924,52 +2148,16 @@ insert_obj (
   if ( !remove_obj ( intp, object, err ) ) return false;
 
   // Modifica destination i obté next
-  if ( !get_object_offset ( intp, destination, &object_offset ) )
-    return true;
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4 + 2; // child
-      if ( !memory_map_READB ( intp->mem, offset, &tmp8, false, err ) )
-        return false;
-      next= (uint16_t) tmp8;
-      if ( !memory_map_WRITEB ( intp->mem, offset,
-                                (uint8_t) object, false, err ) )
-        return false;
-    }
-  else
-    {
-      offset= object_offset + 6 + 4; // child
-      if ( !memory_map_READW ( intp->mem, offset, &next, false, err ) )
-        return false;
-      if ( !memory_map_WRITEW ( intp->mem, offset, object, false, err ) )
-        return false;
-    }
+  if ( !get_object_entry ( intp, destination, &entry, err ) ) return false;
+  if ( entry == NULL ) return true;
+  next= intp->objs.read ( intp, entry, OBJ_CHILD );
+  intp->objs.write ( intp, entry, OBJ_CHILD, object );
 
   // Modifica object
-  if ( !get_object_offset ( intp, object, &object_offset ) )
-    return true;
-  if ( intp->version <= 3 )
-    {
-      offset= object_offset + 4;
-      // Escriu pare
-      if ( !memory_map_WRITEB ( intp->mem, offset,
-                                (uint8_t) destination, false, err ) )
-        return false;
-      // Escriu sibling
-      if ( !memory_map_WRITEB ( intp->mem, offset+1,
-                                (uint8_t) next, false, err ) )
-        return false;
-    }
-  else
-    {
-      offset= object_offset + 6;
-      // Escriu pare
-      if ( !memory_map_WRITEW ( intp->mem, offset, destination, false, err ) )
-        return false;
-      // Escriu sibling
-      if ( !memory_map_WRITEW ( intp->mem, offset+2, next, false, err ) )
-        return false;
-    }
+  if ( !get_object_entry ( intp, object, &entry, err ) ) return false;
+  if ( entry == NULL ) return true;
+  intp->objs.write ( intp, entry, OBJ_PARENT, destination );
+  intp->objs.write ( intp, entry, OBJ_SIBLING, next );
   
   return true;
   
@@ -2006,6 +2194,41 @@ text_add (
 } // end text_add
 
 
+static bool
+text_add_bytes (
+                Interpreter  *intp,
+                const char   *v,
+                const size_t  N,
+                char        **err
+                )
+{
+
+  size_t nsize;
+
+  
+  if ( intp->text.size - intp->text.N < N )
+    {
+      nsize= intp->text.size;
+      do {
+        nsize*= 2;
+        if ( nsize <= intp->text.size )
+          {
+            msgerror ( err, "Failed to allocate memory while decoding"
+                       " ZSCII string" );
+            return false;
+          }
+      } while ( nsize - intp->text.N < N );
+      intp->text.v= g_renew ( char, intp->text.v, nsize );
+      intp->text.size= nsize;
+    }
+  memcpy ( intp->text.v + intp->text.N, v, N );
+  intp->text.N+= N;
+
+  return true;
+  
+} // end text_add_bytes
+
+
 static bool
 text_add_unicode (
                   Interpreter     *intp,
@@ -2130,7 +2353,8 @@ zscii2utf8 (
   uint32_t caddr,tmp_addr;
   int alph,i,abbr_ind,prev_alph;
   uint8_t zc;
-  bool end,lock_alph;
+  bool end,lock_alph,cache;
+  InterpreterString *str;
   enum {
     WAIT_ZC,
     WAIT_ZSCII_TOP,
@@ -2139,6 +2363,25 @@ zscii2utf8 (
   
 
   assert ( length == -1 || length > 0 );
+
+  // Cadenes en memòria estàtica o alta ja descodificades.
+  if ( !is_abbr ) check_zcache ( intp );
+  cache= false;
+  if ( !is_abbr && length == -1 && hmem_allowed &&
+       addr >= intp->mem->dyn_mem_size )
+    {
+      str= g_hash_table_lookup ( intp->zcache.strings,
+                                 GUINT_TO_POINTER ( addr ) );
+      if ( str != NULL )
+        {
+          intp->text.N= 0;
+          if ( !text_add_bytes ( intp, str->text, str->N, err ) )
+            return false;
+          if ( ret_addr != NULL ) *ret_addr= str->end;
+          return true;
+        }
+      cache= true;
+    }
   
   prev_alph= alph= 0;
   if ( !is_abbr ) intp->text.N= 0;
@@ -2188,9 +2431,21 @@ zscii2utf8 (
             if ( !memory_map_READW ( intp->mem, tmp_addr, &abbr_addr,
                                      false, err ) )
               return false;
-            if ( !zscii2utf8 ( intp, ((uint32_t) abbr_addr)<<1, NULL,
-                               false, true, -1, err ) )
-              return false;
+            str= &(intp->zcache.abbrs[32*(abbr_ind-1) + zc]);
+            if ( str->text != NULL &&
+                 str->addr == ((uint32_t) abbr_addr)<<1 )
+              {
+                if ( !text_add_bytes ( intp, str->text, str->N, err ) )
+                  return false;
+              }
+            else
+              {
+                // No està vigilada, el resultat no es pot desar.
+                if ( !zscii2utf8 ( intp, ((uint32_t) abbr_addr)<<1, NULL,
+                                   false, true, -1, err ) )
+                  return false;
+                cache= false;
+              }
             abbr_ind= 0;
           }
         
@@ -2272,45 +2527,174 @@ zscii2utf8 (
   } while ( !end && length != 0 );
   if ( !is_abbr ) if ( !text_add ( intp, '\0', err ) ) return false;
   if ( ret_addr != NULL ) *ret_addr= caddr;
+
+  // Desa en la cache.
+  if ( cache )
+    {
+      str= g_new ( InterpreterString, 1 );
+      str->text= g_new ( char, intp->text.N );
+      memcpy ( str->text, intp->text.v, intp->text.N );
+      str->N= intp->text.N;
+      str->addr= addr;
+      str->end= caddr;
+      g_hash_table_insert ( intp->zcache.strings,
+                            GUINT_TO_POINTER ( addr ), str );
+    }
   
   return true;
   
 } // end zscii2utf8
 
 
-static uint8_t
-unicode2zscii (
-               Interpreter    *intp,
-               const uint32_t  val
-               )
+static void
+free_string (
+             gpointer data
+             )
 {
 
-  uint8_t ret;
-  int n;
+  InterpreterString *str;
 
+
+  str= (InterpreterString *) data;
+  g_free ( str->text );
+  g_free ( str );
   
-  // No es suporten caràcters de més de 16bit
-  if ( val >= 0xFFFF ) ret= '?';
+} // end free_string
 
-  // Taula concreta.
-  else if ( intp->echars.enabled )
+
+// Afegeix a les pàgines vigilades per la cache de cadenes les de
+// memòria dinàmica que contenen [beg,end).
+static void
+watch_zcache_pages (
+                    Interpreter    *intp,
+                    const uint32_t  beg,
+                    const uint32_t  end
+                    )
+{
+
+  uint32_t p,last,i;
+  
+
+  if ( beg >= end || beg >= intp->mem->dyn_mem_size ) return;
+  last= end > intp->mem->dyn_mem_size ? intp->mem->dyn_mem_size : end;
+  last= (last-1)>>STATE_PAGE_BITS;
+  for ( p= beg>>STATE_PAGE_BITS; p <= last; ++p )
     {
-      ret= '?';
-      for ( n= 0; n < (int) ((uint16_t) intp->echars.N); ++n )
-        if ( intp->echars.v[n] == ((uint16_t) val) )
-          {
-            ret= n + 155;
-            break;
-          }
+      for ( i= 0; i < intp->zcache.npages && intp->zcache.pages[i] != p; ++i );
+      if ( i == intp->zcache.npages )
+        intp->zcache.pages[intp->zcache.npages++]= p;
     }
   
-  // Valors per defecte.
-  else
+} // end watch_zcache_pages
+
+
+// Descodifica totes les abreviatures. Les que no es poden
+// descodificar es descodificaran cada vegada que s'impriguen. Vigila
+// les pàgines de memòria dinàmica de la taula i de les abreviatures.
+static void
+load_abbrs (
+            Interpreter *intp
+            )
+{
+
+  InterpreterString *str;
+  uint32_t addr,end,i;
+  uint16_t abbr_addr;
+  char *err;
+  int n,num;
+  
+
+  intp->zcache.npages= 0;
+  if ( intp->abbr_table_addr == 0 ) return;
+  num= intp->version == 2 ? 32 : INTP_ABBRS_NUM;
+  watch_zcache_pages ( intp, intp->abbr_table_addr,
+                       intp->abbr_table_addr + num*2 );
+  for ( n= 0; n < num; ++n )
     {
-      switch ( (uint16_t) val )
-        {
-        case 0x00e4: ret= 155; break;
-        case 0x00f6: ret= 156; break;
+      err= NULL;
+      if ( !memory_map_READW ( intp->mem, intp->abbr_table_addr + n*2,
+                               &abbr_addr, false, &err ) )
+        { g_free ( err ); break; }
+      addr= ((uint32_t) abbr_addr)<<1;
+      intp->text.N= 0;
+      if ( !zscii2utf8 ( intp, addr, &end, false, true, -1, &err ) )
+        { g_free ( err ); continue; }
+      str= &(intp->zcache.abbrs[n]);
+      str->text= g_new ( char, intp->text.N + 1 );
+      memcpy ( str->text, intp->text.v, intp->text.N );
+      str->N= intp->text.N;
+      str->addr= addr;
+      str->end= end;
+      watch_zcache_pages ( intp, addr, end );
+    }
+  intp->text.N= 0;
+  for ( i= 0; i < intp->zcache.npages; ++i )
+    intp->mem->dirty[intp->zcache.pages[i]]&= ~STATE_DIRTY_STRS;
+  
+} // end load_abbrs
+
+
+// Si alguna pàgina vigilada ha canviat descarta les cadenes desades
+// i torna a descodificar les abreviatures.
+static void
+check_zcache (
+              Interpreter *intp
+              )
+{
+
+  uint32_t i;
+  int n;
+  
+
+  for ( i= 0; i < intp->zcache.npages; ++i )
+    if ( intp->mem->dirty[intp->zcache.pages[i]]&STATE_DIRTY_STRS )
+      break;
+  if ( i == intp->zcache.npages ) return;
+  
+  g_hash_table_remove_all ( intp->zcache.strings );
+  for ( n= 0; n < INTP_ABBRS_NUM; ++n )
+    {
+      g_free ( intp->zcache.abbrs[n].text );
+      intp->zcache.abbrs[n].text= NULL;
+    }
+  load_abbrs ( intp );
+  
+} // end check_zcache
+
+
+static uint8_t
+unicode2zscii (
+               Interpreter    *intp,
+               const uint32_t  val
+               )
+{
+
+  uint8_t ret;
+  int n;
+
+  
+  // No es suporten caràcters de més de 16bit
+  if ( val >= 0xFFFF ) ret= '?';
+
+  // Taula concreta.
+  else if ( intp->echars.enabled )
+    {
+      ret= '?';
+      for ( n= 0; n < (int) ((uint16_t) intp->echars.N); ++n )
+        if ( intp->echars.v[n] == ((uint16_t) val) )
+          {
+            ret= n + 155;
+            break;
+          }
+    }
+  
+  // Valors per defecte.
+  else
+    {
+      switch ( (uint16_t) val )
+        {
+        case 0x00e4: ret= 155; break;
+        case 0x00f6: ret= 156; break;
         case 0x00fc: ret= 157; break;
         case 0x00c4: ret= 158; break;
         case 0x00d6: ret= 159; break;
@@ -2483,14 +2867,17 @@ print_output (
 {
 
   FILE *f;
+  bool ok;
 
   
   // Screen
   if ( (intp->ostreams.active&INTP_OSTREAM_SCREEN)!=0 &&
        (intp->ostreams.active&INTP_OSTREAM_TABLE)==0 )
     {
-      if ( !screen_print ( intp->screen, text, err ) )
-        return false;
+      if ( intp->prof != NULL ) profiler_screen_begin ( intp->prof );
+      ok= screen_print ( intp->screen, text, err );
+      if ( intp->prof != NULL ) profiler_screen_end ( intp->prof );
+      if ( !ok ) return false;
     }
 
   // Transcript
@@ -2806,7 +3193,7 @@ show_status_line (
   uint16_t property_pointer,offset,tmp;
   uint8_t text_length,flags;
   int length;
-  bool score_game;
+  bool score_game,ok;
   int score_hours,turns_minutes;
   
   
@@ -2881,9 +3268,11 @@ show_status_line (
     }
   
   // Mostra per pantalla
-  if ( !screen_show_status_line ( intp->screen, intp->text.v, score_game,
-                                  score_hours, turns_minutes, err ) )
-    return false;
+  if ( intp->prof != NULL ) profiler_screen_begin ( intp->prof );
+  ok= screen_show_status_line ( intp->screen, intp->text.v, score_game,
+                                score_hours, turns_minutes, err );
+  if ( intp->prof != NULL ) profiler_screen_end ( intp->prof );
+  if ( !ok ) return false;
   
   return true;
   
@@ -3039,6 +3428,7 @@ sread (
     do {
       if ( !screen_read_char ( intp->screen, buf, &nread, err ) )
         return false;
+      if ( screen_INPUT_FINISHED ( intp->screen ) ) return true;
       if ( nread > 0 ) changed= true;
       for ( n= 0; n < nread && !stop; n++ )
         {
@@ -3096,8 +3486,11 @@ sread (
           }
       }
     
-    // Espera
-    g_usleep ( TIME_SLEEP );
+    // Espera fins al següent event o la següent crida a la rutina.
+    if ( !stop )
+      screen_wait_input ( intp->screen,
+                          call_routine ?
+                          MAX ( 0, time_microsecs-accum_t ) : -1 );
     
   } while ( !stop );
   // --> Pinta retorn carro.
@@ -3147,7 +3540,8 @@ sread (
   */
   
   // Parseja.
-  if ( !dictionary_parse ( intp->std_dict, text_buf, parse_buf, err ) )
+  if ( !dictionary_parse ( intp->std_dict, text_buf, parse_buf,
+                           false, err ) )
     return false;
 
   // Desa valor retorn
@@ -3214,7 +3608,12 @@ read_char (
       call_routine= true;
       time_microsecs= ((gint64) ((uint64_t) time))*100000;
     }
-  else call_routine= false;
+  else
+    {
+      call_routine= false;
+      t0= 0; // CALLA!!!
+      time_microsecs= 0; // CALLA!!
+    }
   
   // Llig caràcter.
   do {
@@ -3222,6 +3621,7 @@ read_char (
     // Caràcter.
     if ( !screen_read_char ( intp->screen, buf, &nread, err ) )
       return false;
+    if ( screen_INPUT_FINISHED ( intp->screen ) ) return true;
 
     // Crida rutina
     if ( call_routine )
@@ -3229,7 +3629,7 @@ read_char (
         t1= g_get_monotonic_time ();
         accum_t+= t1-t0;
         t0= t1;
-        if ( accum_t >= time_microsecs )
+        while ( accum_t >= time_microsecs && nread == 0 )
           {
             accum_t-= time_microsecs;
             if ( !sread_call_routine ( intp, routine, &result_routine, err ) )
@@ -3242,8 +3642,11 @@ read_char (
           }
       }
     
-    // Força una espera
-    g_usleep ( TIME_SLEEP );
+    // Espera fins al següent event o la següent crida a la rutina.
+    if ( nread == 0 )
+      screen_wait_input ( intp->screen,
+                          call_routine ?
+                          MAX ( 0, time_microsecs-accum_t ) : -1 );
     
   } while ( nread == 0 );
   result= (uint16_t) buf[0];
@@ -3263,24 +3666,14 @@ save_undo (
            )
 {
 
-  const gchar *undo_fn;
-  char *err;
-
-  
-  err= NULL;
-  undo_fn= saves_get_new_undo_file_name ( intp->saves, &err );
-  if ( undo_fn == NULL ) goto error;
-  if ( intp->verbose )
-    ii ( "Writing undo save file: '%s'", undo_fn );
-  if ( !state_save ( intp->state, undo_fn, &err ) ) goto error;
+  if ( !state_save_undo ( intp->state ) )
+    {
+      ww ( "Failed to save undo: undo is disabled" );
+      return 0;
+    }
   
   return 1;
   
- error:
-  ww ( "Failed to save undo: %s", err );
-  g_free ( err );
-  return 0;
-  
 } // end save_undo
 
 
@@ -3303,7 +3696,7 @@ save (
   
   err= NULL;
   save_fn= saves_get_save_file_name ( intp->saves, intp->screen,
-                                      story_file_GETID ( intp->sf ),
+                                      story_file_get_id ( intp->sf ),
                                       &err );
   if ( save_fn == NULL ) goto error;
   if ( intp->verbose )
@@ -3328,26 +3721,16 @@ restore_undo (
               )
 {
 
-  const gchar *undo_fn;
   char *err;
-
   
+
   err= NULL;
-  undo_fn= saves_get_undo_file_name ( intp->saves );
-  if ( undo_fn == NULL )
-    {
-      ww ( "Failed to restore undo: no save file available" );
-      return 0;
-    }
-  if ( intp->verbose )
-    ii ( "Reading undo save file: '%s'", undo_fn );
-  if ( !state_load ( intp->state, undo_fn, &err ) )
+  if ( !state_restore_undo ( intp->state, &err ) )
     {
       ww ( "Failed to restore undo: %s", err );
       g_free ( err );
       return 0;
     }
-  saves_remove_last_undo_file_name ( intp->saves );
   
   return 2;
   
@@ -3373,7 +3756,7 @@ restore (
   
   err= NULL;
   save_fn= saves_get_save_file_name ( intp->saves, intp->screen,
-                                      story_file_GETID ( intp->sf ),
+                                      story_file_get_id ( intp->sf ),
                                       &err );
   if ( save_fn == NULL ) goto error;
   if ( intp->verbose )
@@ -3652,6 +4035,7 @@ tokenise (
 
   uint16_t text,parse,dictionary,flag;
   bool use_dictionary;
+  Dictionary *dict;
 
   
   // Obté paràmetres
@@ -3673,11 +4057,17 @@ tokenise (
           if ( !op_to_u16 ( intp, &(ops[3]), &flag, err ) ) return false;
         }
     }
-  if ( use_dictionary ) ee ( "tokenise - CAL_IMPLEMENTAR DICTIONARY" );
-  if ( flag!=0 ) ee ( "tokenise - CAL_IMPLEMENTAR FLAG" );
 
+  // Diccionari (0 és l'estàndard).
+  if ( use_dictionary && dictionary != 0 )
+    {
+      dict= dictionary_cache_get ( intp->usr_dicts, dictionary, err );
+      if ( dict == NULL ) return false;
+    }
+  else dict= intp->std_dict;
+  
   // Parseja
-  if ( !dictionary_parse ( intp->std_dict, text, parse, err ) )
+  if ( !dictionary_parse ( dict, text, parse, flag!=0, err ) )
     return false;
 
   return true;
@@ -3741,10 +4131,10 @@ quit (
     if ( !screen_read_char ( intp->screen, buf, &nread, err ) )
       return false;
     
-    // Força una espera
-    g_usleep ( TIME_SLEEP );
+    // Espera el següent event.
+    if ( nread == 0 ) screen_wait_input ( intp->screen, -1 );
     
-  } while ( nread == 0 );
+  } while ( nread == 0 && !screen_INPUT_FINISHED ( intp->screen ) );
   
   return true;
   
@@ -3770,6 +4160,7 @@ inst_be (
   state= intp->state;
   if ( !memory_map_READB ( intp->mem, state->PC++, &opcode, true, err ) )
     return false;
+  COUNT_OPCODE ( 256+opcode );
   switch ( opcode )
     {
     case 0x00: // save
@@ -3915,6 +4306,7 @@ exec_next_inst (
   state= intp->state;
   if ( !memory_map_READB ( intp->mem, state->PC++, &opcode, true, err ) )
     return RET_ERROR;
+  if ( opcode != 0xbe ) COUNT_OPCODE ( opcode );
   switch ( opcode )
     {
 
@@ -3960,7 +4352,8 @@ exec_next_inst (
       if ( !read_small_small ( intp, &op1_u8, &op2_u8, err ) ) return RET_ERROR;
       SET_U8TOU16(op1_u8,op1);
       SET_U8TOU16(op2_u8,op2);
-      if ( !jin ( intp, op1, op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !branch ( intp, cond, err ) ) return RET_ERROR;
       break;
     case 0x07: // test
       if ( !read_small_small ( intp, &op1_u8, &op2_u8, err ) ) return RET_ERROR;
@@ -4179,7 +4572,8 @@ exec_next_inst (
     case 0x26: // jin
       if ( !read_small_var ( intp, &op1_u8, &op2, err ) ) return RET_ERROR;
       SET_U8TOU16(op1_u8,op1);
-      if ( !jin ( intp, op1, op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !branch ( intp, cond, err ) ) return RET_ERROR;
       break;
     case 0x27: // test
       if ( !read_small_var ( intp, &op1_u8, &op2, err ) ) return RET_ERROR;
@@ -4382,7 +4776,8 @@ exec_next_inst (
     case 0x46: // jin
       if ( !read_var_small ( intp, &op1, &op2_u8, err ) ) return RET_ERROR;
       SET_U8TOU16(op2_u8,op2);
-      if ( !jin ( intp, op1, op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !branch ( intp, cond, err ) ) return RET_ERROR;
       break;
     case 0x47: // test
       if ( !read_var_small ( intp, &op1, &op2_u8, err ) ) return RET_ERROR;
@@ -4573,7 +4968,8 @@ exec_next_inst (
       break;
     case 0x66: // jin
       if ( !read_var_var ( intp, &op1, &op2, err ) ) return RET_ERROR;
-      if ( !jin ( intp, op1, op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !branch ( intp, cond, err ) ) return RET_ERROR;
       break;
     case 0x67: // test
       if ( !read_var_var ( intp, &op1, &op2, err ) ) return RET_ERROR;
@@ -5203,7 +5599,8 @@ exec_next_inst (
       if ( !read_var_ops ( intp, ops, &nops, 2, false, err ) ) return RET_ERROR;
       if ( !op_to_u16 ( intp, &(ops[0]), &op1, err ) ) return RET_ERROR;
       if ( !op_to_u16 ( intp, &(ops[1]), &op2, err ) ) return RET_ERROR;
-      if ( !jin ( intp, op1, op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !branch ( intp, cond, err ) ) return RET_ERROR;
       break;
     case 0xc7: // test
       if ( !read_var_ops ( intp, ops, &nops, 2, false, err ) ) return RET_ERROR;
@@ -5434,6 +5831,7 @@ exec_next_inst (
       if ( !put_prop ( intp, op1, op2, op3, err ) ) return RET_ERROR;
       break;
     case 0xe4: // read
+      if ( intp->stop_on_input ) return RET_STOP;
       if ( intp->version >= 5 )
         {
           if ( !read_var_ops_store ( intp, ops, &nops, -1,
@@ -5448,6 +5846,7 @@ exec_next_inst (
           // S'ignora el result_var
           if ( !sread ( intp, ops, nops, 0, err ) ) return RET_ERROR;
         }
+      if ( screen_INPUT_FINISHED ( intp->screen ) ) return RET_STOP;
       break;
     case 0xe5: // print_char
       if ( !read_var_ops ( intp, ops, &nops, 1, false, err ) ) return RET_ERROR;
@@ -5579,10 +5978,12 @@ exec_next_inst (
       
     case 0xf6: // read_char
       if ( intp->version < 4 ) goto wrong_version;
+      if ( intp->stop_on_input ) return RET_STOP;
       if ( !read_var_ops_store ( intp, ops, &nops, -1,
                                  false, &result_var, err ) )
         return RET_ERROR;
       if ( !read_char ( intp, ops, nops, result_var, err ) ) return RET_ERROR;
+      if ( screen_INPUT_FINISHED ( intp->screen ) ) return RET_STOP;
       break;
     case 0xf7: // scan_table
       if ( intp->version < 4 ) goto wrong_version;
@@ -5662,210 +6063,1285 @@ exec_next_inst (
 } // end exec_next_inst
 
 
+// Llig els tipus d'operands d'una instrucció de forma variable (com
+// 'read_var_ops'). Torna fals si no es pot descodificar.
 static bool
-load_unicode_translation_table (
-                                Interpreter     *intp,
-                                const uint32_t   addr,
-                                char           **err
-                                )
+decode_var_ops_types (
+                      const MemoryMap *mem,
+                      uint32_t        *pc,
+                      InterpreterInst *inst,
+                      const bool       extra_byte
+                      )
 {
 
-  int n;
-  
-  
-  // Inicialitza taula a desconegut.
-  intp->echars.enabled= true;
-  for ( n= 0; n < 256; ++n )
-    intp->echars.v[n]= 0xFFFD;
-
-  // Llig nombre entrades.
-  if ( !memory_map_READB ( intp->mem, addr, &intp->echars.N, true, err ) )
-    return false;
+  uint8_t ops_type;
+  int N;
 
-  // Llig entrades.
-  for ( n= 0; n < (int) ((uint16_t) intp->echars.N); ++n )
+  
+  if ( *pc >= mem->sf_mem_size ) return false;
+  ops_type= mem->sf_mem[(*pc)++];
+  N= 0;
+  while ( N < 4 && (inst->ops[N].type= (ops_type>>6)) != OP_NONE )
     {
-      if ( !memory_map_READW ( intp->mem, addr + 1 + n*2,
-                               &(intp->echars.v[n]), true, err ) )
-        return false;
+      ++N;
+      ops_type<<= 2;
     }
-
-  return true;
-  
-} // end load_unicode_translation_table
-
-
-static bool
-load_header_extension_table (
-                             Interpreter  *intp,
-                             char        **err
-                             )
-{
-
-  uint32_t ext_addr;
-  uint16_t N,tmp;
-  
-  
-  // Inicialització de valors depenent.
-  intp->echars.enabled= false;
-
-  // Intenta llegir.
-  if ( intp->version < 5 ) return true;
-  ext_addr=
-    (((uint32_t) intp->mem->sf_mem[0x36])<<8) |
-    ((uint32_t) intp->mem->sf_mem[0x37])
-    ;
-  if ( ext_addr == 0 ) return true;
-
-  // Llig taula
-  // --> Nombre d'entrades
-  if ( !memory_map_READW ( intp->mem, ext_addr, &N, true, err ) )
-    return false;
-  // --> Unicode translation table address
-  if ( N >= 3 )
+  if ( extra_byte )
     {
-      if ( !memory_map_READW ( intp->mem, ext_addr+3*2, &tmp, true, err ) )
-        return false;
-      if ( tmp != 0 )
+      if ( *pc >= mem->sf_mem_size ) return false;
+      ops_type= mem->sf_mem[(*pc)++];
+      if ( N == 4 ) // Llig si no hi han NONE
         {
-          if ( !load_unicode_translation_table ( intp, (uint32_t) tmp, err ) )
-            return false;
+          while ( N < 8 && (inst->ops[N].type= (ops_type>>6)) != OP_NONE )
+            {
+              ++N;
+              ops_type<<= 2;
+            }
         }
     }
+  inst->nops= (uint8_t) N;
   
   return true;
   
-} // end load_header_extension_table
+} // end decode_var_ops_types
 
 
+// Llig els valors dels operands, els tipus ja estan fixats.
 static bool
-load_alphabet_table (
-                     Interpreter  *intp,
-                     uint32_t      addr,
-                     char        **err
-                     )
+decode_ops_values (
+                   const MemoryMap *mem,
+                   uint32_t        *pc,
+                   InterpreterInst *inst
+                   )
 {
 
-  int i,j;
+  int n;
 
   
-  assert ( addr != 0 );
-  intp->alph_table.enabled= true;
-  for ( i= 0; i < 3; ++i )
-    for ( j= 0; j < 26; ++j, ++addr )
-      if ( !memory_map_READB ( intp->mem, addr,
-                               &(intp->alph_table.v[i][j]),
-                               true, err ) )
-        return false;
-  intp->alph_table.v[2][1]= ZSCII_NEWLINE;
+  for ( n= 0; n < inst->nops; ++n )
+    if ( inst->ops[n].type == OP_LARGE )
+      {
+        if ( *pc >= mem->sf_mem_size-1 ) return false;
+        inst->ops[n].u16.val=
+          (((uint16_t) mem->sf_mem[*pc])<<8) |
+          ((uint16_t) mem->sf_mem[*pc+1]);
+        *pc+= 2;
+      }
+    else
+      {
+        if ( *pc >= mem->sf_mem_size ) return false;
+        inst->ops[n].u8.val= mem->sf_mem[(*pc)++];
+      }
   
   return true;
   
-} // end load_alphabet_table
+} // end decode_ops_values
 
 
+// Descodifica el bot (com 'branch'). S'assumeix que és l'última part
+// de la instrucció.
 static bool
-register_extra_chars (
-                      Interpreter  *intp,
-                      char        **err
-                      )
+decode_branch (
+               const MemoryMap *mem,
+               uint32_t        *pc,
+               InterpreterInst *inst
+               )
 {
 
-  int i;
+  uint8_t b1,b2;
+  uint32_t offset;
 
   
-  // Taula
-  if ( intp->echars.enabled )
+  if ( *pc >= mem->sf_mem_size ) return false;
+  b1= mem->sf_mem[(*pc)++];
+  if ( (b1&0x40) == 0 )
     {
-      for ( i= 0; i < intp->echars.N; ++i )
-        if ( !screen_ADD_EXTRA_CHAR ( intp->screen, intp->echars.v[i],
-                                      (uint8_t) (i+155), err  ) )
-          return false;
+      if ( *pc >= mem->sf_mem_size ) return false;
+      b2= mem->sf_mem[(*pc)++];
+      // 14bits amb signe
+      offset= (((uint32_t) (b1&0x3F))<<8) | ((uint32_t) b2);
+      if ( offset&0x2000 )
+        offset= (uint32_t) -((int32_t) (16384 - offset));
     }
-  // Taula per defecte
+  else offset= (uint32_t) (b1&0x3F);
+  inst->branch_cond= ((b1&0x80)!=0);
+  if ( offset == 0 )      inst->branch_type= BRANCH_RFALSE;
+  else if ( offset == 1 ) inst->branch_type= BRANCH_RTRUE;
   else
     {
-      for ( i= 0; i < ZSCII_TO_UNICODE_SIZE; ++i )
-        if ( !screen_ADD_EXTRA_CHAR ( intp->screen, ZSCII_TO_UNICODE[i],
-                                      (uint8_t) (i+155), err  ) )
-          return false;
+      inst->branch_type= BRANCH_JUMP;
+      inst->branch_addr= *pc + offset - 2;
     }
   
   return true;
   
-} // end register_extra_chars
-
+} // end decode_branch
 
 
-
-/**********************/
-/* FUNCIONS PÚBLIQUES */
-/**********************/
-
-void
-interpreter_free (
-                  Interpreter *intp
+// Salta un text codificat. Torna fals si no es troba el final.
+static bool
+decode_skip_text (
+                  const MemoryMap *mem,
+                  uint32_t        *pc
                   )
 {
+
+  bool end;
+
   
-  if ( intp->transcript_fd != NULL ) fclose ( intp->transcript_fd );
-  if ( intp->saves != NULL ) saves_free ( intp->saves );
-  if ( intp->std_dict != NULL ) dictionary_free ( intp->std_dict );
-  if ( intp->usr_dict != NULL ) dictionary_free ( intp->usr_dict );
-  g_free ( intp->input_text.v );
-  g_free ( intp->text.v );
-  if ( intp->screen != NULL ) screen_free ( intp->screen );
-  if ( intp->ins != NULL ) instruction_free ( intp->ins );
-  if ( intp->mem != NULL ) memory_map_free ( intp->mem );
-  if ( intp->sf != NULL ) story_file_free ( intp->sf );
-  if ( intp->state != NULL ) state_free ( intp->state );
-  g_free ( intp );
+  do {
+    if ( *pc >= mem->sf_mem_size-1 ) return false;
+    end= (mem->sf_mem[*pc]&0x80)!=0;
+    *pc+= 2;
+  } while ( !end );
   
-} // end interpreter_free
+  return true;
+  
+} // end decode_skip_text
 
 
-Interpreter *
-interpreter_new_from_file_name (
-                                const char      *file_name,
-                                Conf            *conf,
-                                const char      *transcript_fn,
-                                const gboolean   verbose,
-                                Tracer          *tracer,
-                                char           **err
-                                )
+// Descodifica la instrucció que comença en 'addr'. Si la instrucció
+// no es pot descodificar, o pot provocar un error, el tipus serà
+// INST_FALLBACK i s'executarà amb 'exec_next_inst'.
+static void
+decode_inst (
+             Interpreter     *intp,
+             const uint32_t   addr,
+             InterpreterInst *inst
+             )
 {
 
-  Interpreter *ret;
-  uint32_t std_dict_addr,alphabet_table_addr;
-  uint8_t *icon;
-  size_t icon_size;
+  const MemoryMap *mem;
+  uint32_t pc;
+  uint8_t opcode;
+  int kind,wanted_ops,min_version,n;
+  bool store,has_branch,has_text,extra_byte;
   
   
   // Prepara.
-  icon= NULL;
-  ret= g_new ( Interpreter, 1 );
-  ret->sf= NULL;
-  ret->state= NULL;
-  ret->mem= NULL;
+  mem= intp->mem;
+  pc= addr;
+  inst->kind= INST_FALLBACK;
+  inst->nops= 0;
+  inst->store_var= 0;
+  inst->branch_type= BRANCH_NONE;
+  inst->branch_cond= false;
+  inst->branch_addr= 0;
+  inst->text_addr= 0;
+  inst->next_PC= addr;
+  inst->fused= 0;
+  if ( pc >= mem->sf_mem_size ) return;
+  opcode= mem->sf_mem[pc++];
+  inst->opcode= opcode;
+  kind= INST_FALLBACK;
+  store= has_branch= has_text= extra_byte= false;
+  wanted_ops= -1;
+  min_version= 1;
+  
+  // 2OP
+  if ( opcode < 0x80 || (opcode >= 0xc0 && opcode < 0xe0) )
+    {
+      switch ( opcode&0x1f )
+        {
+        case 0x01: kind= INST_JE; has_branch= true; break;
+        case 0x02: kind= INST_JL; has_branch= true; break;
+        case 0x03: kind= INST_JG; has_branch= true; break;
+        case 0x04: kind= INST_DEC_CHK; has_branch= true; break;
+        case 0x05: kind= INST_INC_CHK; has_branch= true; break;
+        case 0x06: kind= INST_JIN; has_branch= true; break;
+        case 0x07: kind= INST_TEST; has_branch= true; break;
+        case 0x08: kind= INST_OR; store= true; break;
+        case 0x09: kind= INST_AND; store= true; break;
+        case 0x0a: kind= INST_TEST_ATTR; has_branch= true; break;
+        case 0x0b: kind= INST_SET_ATTR; break;
+        case 0x0c: kind= INST_CLEAR_ATTR; break;
+        case 0x0d: kind= INST_STORE; break;
+        case 0x0e: kind= INST_INSERT_OBJ; break;
+        case 0x0f: kind= INST_LOADW; store= true; break;
+        case 0x10: kind= INST_LOADB; store= true; break;
+        case 0x11: kind= INST_GET_PROP; store= true; break;
+        case 0x12: kind= INST_GET_PROP_ADDR; store= true; break;
+        case 0x13: kind= INST_GET_NEXT_PROP; store= true; break;
+        case 0x14: kind= INST_ADD; store= true; break;
+        case 0x15: kind= INST_SUB; store= true; break;
+        case 0x16: kind= INST_MUL; store= true; break;
+        case 0x17: kind= INST_DIV; store= true; break;
+        case 0x18: kind= INST_MOD; store= true; break;
+        case 0x19: kind= INST_CALL_S; store= true; min_version= 4; break;
+        case 0x1a: kind= INST_CALL_N; min_version= 5; break;
+        default: return;
+        }
+      if ( opcode < 0x80 ) // Forma llarga
+        {
+          // dec_chk i inc_chk amb dos variables són un error.
+          if ( opcode == 0x64 || opcode == 0x65 ) return;
+          inst->ops[0].type= (opcode&0x40)!=0 ? OP_VARIABLE : OP_SMALL;
+          inst->ops[1].type= (opcode&0x20)!=0 ? OP_VARIABLE : OP_SMALL;
+          inst->nops= 2;
+        }
+      else
+        {
+          if ( !decode_var_ops_types ( mem, &pc, inst, false ) ) return;
+          if ( kind == INST_JE )
+            {
+              if ( inst->nops == 0 ) return;
+            }
+          else wanted_ops= 2;
+        }
+    }
+
+  // 1OP
+  else if ( opcode < 0xb0 )
+    {
+      switch ( opcode&0x0f )
+        {
+        case 0x00: kind= INST_JZ; has_branch= true; break;
+        case 0x01: kind= INST_GET_SIBLING; store= has_branch= true; break;
+        case 0x02: kind= INST_GET_CHILD; store= has_branch= true; break;
+        case 0x03: kind= INST_GET_PARENT; store= true; break;
+        case 0x04: kind= INST_GET_PROP_LEN; store= true; break;
+        case 0x05: kind= INST_INC; break;
+        case 0x06: kind= INST_DEC; break;
+        case 0x07: kind= INST_PRINT_ADDR; break;
+        case 0x08: kind= INST_CALL_S; store= true; min_version= 4; break;
+        case 0x09: kind= INST_REMOVE_OBJ; break;
+        case 0x0a: kind= INST_PRINT_OBJ; break;
+        case 0x0b: kind= INST_RET; break;
+        case 0x0c: kind= INST_JUMP; break;
+        case 0x0d: kind= INST_PRINT_PADDR; break;
+        case 0x0e: kind= INST_LOAD; store= true; break;
+        case 0x0f: kind= INST_CALL_N; min_version= 5; break;
+        }
+      inst->ops[0].type= (opcode>>4)&0x3;
+      inst->nops= 1;
+      // Referències a variables amb constants llargues són un error.
+      if ( inst->ops[0].type == OP_LARGE &&
+           (kind == INST_INC || kind == INST_DEC || kind == INST_LOAD) )
+        return;
+    }
+
+  // 0OP
+  else if ( opcode < 0xc0 )
+    {
+      switch ( opcode )
+        {
+        case 0xb0: kind= INST_RTRUE; break;
+        case 0xb1: kind= INST_RFALSE; break;
+        case 0xb2: kind= INST_PRINT; has_text= true; break;
+        case 0xb3: kind= INST_PRINT_RET; has_text= true; break;
+        case 0xb4: kind= INST_NOP; break;
+        case 0xb8: kind= INST_RET_POPPED; break;
+        case 0xbb: kind= INST_NEW_LINE; break;
+        default: return;
+        }
+    }
+
+  // VAR
+  else
+    {
+      switch ( opcode )
+        {
+        case 0xe0: kind= INST_CALL_S; store= true; break;
+        case 0xe1: kind= INST_STOREW; wanted_ops= 3; break;
+        case 0xe2: kind= INST_STOREB; wanted_ops= 3; break;
+        case 0xe3: kind= INST_PUT_PROP; wanted_ops= 3; break;
+        case 0xe5: kind= INST_PRINT_CHAR; wanted_ops= 1; break;
+        case 0xe6: kind= INST_PRINT_NUM; wanted_ops= 1; break;
+        case 0xe7: kind= INST_RANDOM; store= true; wanted_ops= 1; break;
+        case 0xe8: kind= INST_PUSH; wanted_ops= 1; break;
+        case 0xe9:
+          if ( intp->version == 6 ) return;
+          kind= INST_PULL; wanted_ops= 1;
+          break;
+        case 0xec:
+          kind= INST_CALL_S; store= true; extra_byte= true; min_version= 4;
+          break;
+        case 0xf8:
+          kind= INST_NOT; store= true; wanted_ops= 1; min_version= 5;
+          break;
+        case 0xf9: kind= INST_CALL_N; min_version= 5; break;
+        case 0xfa:
+          kind= INST_CALL_N; extra_byte= true; min_version= 5;
+          break;
+        case 0xff:
+          kind= INST_CHECK_ARG_COUNT; has_branch= true;
+          wanted_ops= 1; min_version= 5;
+          break;
+        default: return;
+        }
+      if ( !decode_var_ops_types ( mem, &pc, inst, extra_byte ) ) return;
+    }
+
+  // Comprovacions.
+  if ( intp->version < min_version ) return;
+  if ( wanted_ops != -1 && wanted_ops != inst->nops ) return;
+  if ( kind == INST_STORE && opcode >= 0xc0 && inst->ops[0].type != OP_SMALL )
+    return;
+  for ( n= inst->nops; n < 8; ++n )
+    inst->ops[n].type= OP_NONE;
+  
+  // Resta de la instrucció.
+  if ( !decode_ops_values ( mem, &pc, inst ) ) return;
+  if ( store )
+    {
+      if ( pc >= mem->sf_mem_size ) return;
+      inst->store_var= mem->sf_mem[pc++];
+    }
+  if ( has_text )
+    {
+      inst->text_addr= pc;
+      if ( !decode_skip_text ( mem, &pc ) ) return;
+    }
+  if ( has_branch )
+    {
+      if ( !decode_branch ( mem, &pc, inst ) ) return;
+    }
+  inst->next_PC= pc;
+  inst->kind= (uint8_t) kind;
+  
+} // end decode_inst
+
+
+// Reserva una nova entrada en la cache i torna el seu índex.
+static uint32_t
+icache_new_entry (
+                  Interpreter *intp
+                  )
+{
+
+  if ( intp->icache.N == intp->icache.size )
+    {
+      intp->icache.size*= 2;
+      intp->icache.v= g_renew ( InterpreterInst, intp->icache.v,
+                                intp->icache.size );
+    }
+  
+  return (uint32_t) (intp->icache.N++);
+  
+} // end icache_new_entry
+
+
+// Intenta fusionar la instrucció 'ind' amb la següent. La segona
+// instrucció es descodifica en una entrada pròpia, no indexada, que
+// sols s'utilitza des de la superinstrucció. Com les dos instruccions
+// formen part del mateix bloc bàsic, un bot a la segona instrucció
+// continua executant la versió no fusionada d'aquesta.
+static void
+fuse_inst (
+           Interpreter    *intp,
+           const uint32_t  ind
+           )
+{
+
+  InterpreterInst next,*inst;
+  int kind;
+  uint16_t off;
+  uint32_t next_ind;
+
+  
+  // Descodifica següent.
+  inst= &(intp->icache.v[ind]);
+  if ( inst->kind != INST_LOADW && inst->kind != INST_GET_PROP &&
+       inst->kind != INST_INC_CHK && inst->kind != INST_PUSH )
+    return;
+  if ( inst->next_PC < intp->icache.begin ||
+       inst->next_PC >= intp->icache.end )
+    return;
+  decode_inst ( intp, inst->next_PC, &next );
+  
+  // Cerca patrons.
+  kind= INST_FALLBACK;
+  switch ( inst->kind )
+    {
+      
+      // loadw a b -> V; je V ... ?bot
+    case INST_LOADW:
+      if ( next.kind == INST_JE &&
+           next.ops[0].type == OP_VARIABLE &&
+           next.ops[0].u8.val == inst->store_var )
+        kind= INST_LOADW_JE;
+      break;
+
+      // get_prop o p -> sp; store ref sp
+    case INST_GET_PROP:
+      if ( next.kind == INST_STORE &&
+           inst->store_var == 0x00 &&
+           next.ops[0].type == OP_SMALL &&
+           next.ops[1].type == OP_VARIABLE &&
+           next.ops[1].u8.val == 0x00 )
+        kind= INST_GET_PROP_STORE;
+      break;
+
+      // inc_chk V n ?bot; jump etiqueta (final de bucle)
+    case INST_INC_CHK:
+      if ( next.kind == INST_JUMP && next.ops[0].type != OP_VARIABLE )
+        {
+          off= next.ops[0].type == OP_LARGE ?
+            next.ops[0].u16.val : (uint16_t) next.ops[0].u8.val;
+          next.branch_addr= next.next_PC + ((uint32_t) U16_S32(off)) - 2;
+          kind= INST_INC_CHK_JUMP;
+        }
+      break;
+
+      // push x; pull ref
+    case INST_PUSH:
+      if ( next.kind == INST_PULL &&
+           next.ops[0].type == OP_SMALL &&
+           next.ops[0].u8.val != 0x00 )
+        kind= INST_PUSH_PULL;
+      break;
+      
+    default: break;
+    }
+  if ( kind == INST_FALLBACK ) return;
+
+  // Fusiona.
+  next_ind= icache_new_entry ( intp );
+  intp->icache.v[next_ind]= next;
+  inst= &(intp->icache.v[ind]);
+  inst->kind= (uint8_t) kind;
+  inst->fused= next_ind;
+  
+} // end fuse_inst
+
+
+// Torna la instrucció predescodificada de l'adreça indicada, o NULL
+// si s'ha d'executar amb 'exec_next_inst'.
+static InterpreterInst *
+icache_get (
+            Interpreter    *intp,
+            const uint32_t  addr
+            )
+{
+
+  uint32_t ind;
+  InterpreterInst *ret;
+  
+  
+  if ( addr < intp->icache.begin || addr >= intp->icache.end )
+    return NULL;
+  ind= intp->icache.ind[addr-intp->icache.begin];
+  if ( ind == 0 )
+    {
+      ind= icache_new_entry ( intp );
+      decode_inst ( intp, addr, &(intp->icache.v[ind]) );
+      if ( intp->fusion.enabled ) fuse_inst ( intp, ind );
+      intp->icache.ind[addr-intp->icache.begin]= ++ind;
+    }
+  ret= &(intp->icache.v[ind-1]);
+  
+  return ret->kind==INST_FALLBACK ? NULL : ret;
+  
+} // end icache_get
+
+
+static bool
+cached_branch (
+               Interpreter            *intp,
+               const InterpreterInst  *inst,
+               const bool              cond,
+               char                  **err
+               )
+{
+
+  if ( cond != inst->branch_cond ) return true;
+  switch ( inst->branch_type )
+    {
+    case BRANCH_RFALSE:
+      if ( !ret_val ( intp, 0, err ) ) return false;
+      break;
+    case BRANCH_RTRUE:
+      if ( !ret_val ( intp, 1, err ) ) return false;
+      break;
+    default:
+      intp->state->PC= inst->branch_addr;
+    }
+  
+  return true;
+  
+} // end cached_branch
+
+
+static bool
+cached_ops2 (
+             Interpreter            *intp,
+             const InterpreterInst  *inst,
+             uint16_t               *op1,
+             uint16_t               *op2,
+             char                  **err
+             )
+{
+
+  if ( !op_to_u16 ( intp, &(inst->ops[0]), op1, err ) ) return false;
+  if ( !op_to_u16 ( intp, &(inst->ops[1]), op2, err ) ) return false;
+
+  return true;
+  
+} // end cached_ops2
+
+
+// Executa instruccions fent ús de la cache d'instruccions
+// predescodificades fins que l'execució s'atura o es produeix un
+// error. Les instruccions que no estan en la cache s'executen amb
+// 'exec_next_inst'. La semàntica és la mateixa que 'exec_next_inst'.
+//
+// Aquest motor no s'utilitza mai amb la traça activada (vegeu
+// 'interpreter_trace'), per això accedeix a la memòria directament
+// amb les versions ràpides sense callbacks.
+static int
+run_threaded (
+              Interpreter  *intp,
+              char        **err
+              )
+{
+
+#ifdef THREADED_DISPATCH
+  static const void *labels[INST_NUM]=
+    {
+      [INST_FALLBACK]= &&fallback,
+      [INST_JE]= &&lbl_INST_JE,
+      [INST_JL]= &&lbl_INST_JL,
+      [INST_JG]= &&lbl_INST_JG,
+      [INST_DEC_CHK]= &&lbl_INST_DEC_CHK,
+      [INST_INC_CHK]= &&lbl_INST_INC_CHK,
+      [INST_JIN]= &&lbl_INST_JIN,
+      [INST_TEST]= &&lbl_INST_TEST,
+      [INST_OR]= &&lbl_INST_OR,
+      [INST_AND]= &&lbl_INST_AND,
+      [INST_TEST_ATTR]= &&lbl_INST_TEST_ATTR,
+      [INST_SET_ATTR]= &&lbl_INST_SET_ATTR,
+      [INST_CLEAR_ATTR]= &&lbl_INST_CLEAR_ATTR,
+      [INST_STORE]= &&lbl_INST_STORE,
+      [INST_INSERT_OBJ]= &&lbl_INST_INSERT_OBJ,
+      [INST_LOADW]= &&lbl_INST_LOADW,
+      [INST_LOADB]= &&lbl_INST_LOADB,
+      [INST_GET_PROP]= &&lbl_INST_GET_PROP,
+      [INST_GET_PROP_ADDR]= &&lbl_INST_GET_PROP_ADDR,
+      [INST_GET_NEXT_PROP]= &&lbl_INST_GET_NEXT_PROP,
+      [INST_ADD]= &&lbl_INST_ADD,
+      [INST_SUB]= &&lbl_INST_SUB,
+      [INST_MUL]= &&lbl_INST_MUL,
+      [INST_DIV]= &&lbl_INST_DIV,
+      [INST_MOD]= &&lbl_INST_MOD,
+      [INST_CALL_S]= &&lbl_INST_CALL_S,
+      [INST_CALL_N]= &&lbl_INST_CALL_N,
+      [INST_JZ]= &&lbl_INST_JZ,
+      [INST_GET_SIBLING]= &&lbl_INST_GET_SIBLING,
+      [INST_GET_CHILD]= &&lbl_INST_GET_CHILD,
+      [INST_GET_PARENT]= &&lbl_INST_GET_PARENT,
+      [INST_GET_PROP_LEN]= &&lbl_INST_GET_PROP_LEN,
+      [INST_INC]= &&lbl_INST_INC,
+      [INST_DEC]= &&lbl_INST_DEC,
+      [INST_PRINT_ADDR]= &&lbl_INST_PRINT_ADDR,
+      [INST_REMOVE_OBJ]= &&lbl_INST_REMOVE_OBJ,
+      [INST_PRINT_OBJ]= &&lbl_INST_PRINT_OBJ,
+      [INST_RET]= &&lbl_INST_RET,
+      [INST_JUMP]= &&lbl_INST_JUMP,
+      [INST_PRINT_PADDR]= &&lbl_INST_PRINT_PADDR,
+      [INST_LOAD]= &&lbl_INST_LOAD,
+      [INST_RTRUE]= &&lbl_INST_RTRUE,
+      [INST_RFALSE]= &&lbl_INST_RFALSE,
+      [INST_PRINT]= &&lbl_INST_PRINT,
+      [INST_PRINT_RET]= &&lbl_INST_PRINT_RET,
+      [INST_NOP]= &&lbl_INST_NOP,
+      [INST_RET_POPPED]= &&lbl_INST_RET_POPPED,
+      [INST_NEW_LINE]= &&lbl_INST_NEW_LINE,
+      [INST_STOREW]= &&lbl_INST_STOREW,
+      [INST_STOREB]= &&lbl_INST_STOREB,
+      [INST_PUT_PROP]= &&lbl_INST_PUT_PROP,
+      [INST_PRINT_CHAR]= &&lbl_INST_PRINT_CHAR,
+      [INST_PRINT_NUM]= &&lbl_INST_PRINT_NUM,
+      [INST_RANDOM]= &&lbl_INST_RANDOM,
+      [INST_PUSH]= &&lbl_INST_PUSH,
+      [INST_PULL]= &&lbl_INST_PULL,
+      [INST_NOT]= &&lbl_INST_NOT,
+      [INST_CHECK_ARG_COUNT]= &&lbl_INST_CHECK_ARG_COUNT,
+      [INST_LOADW_JE]= &&lbl_INST_LOADW_JE,
+      [INST_GET_PROP_STORE]= &&lbl_INST_GET_PROP_STORE,
+      [INST_INC_CHK_JUMP]= &&lbl_INST_INC_CHK_JUMP,
+      [INST_PUSH_PULL]= &&lbl_INST_PUSH_PULL,
+    };
+#endif
+  
+  InterpreterInst *inst,*inst2;
+  State *state;
+  uint16_t op1,op2,op3,res,tmp16;
+  uint8_t ref,res_u8;
+  uint32_t addr;
+  bool cond;
+  int n,ret;
+  
+  
+  state= intp->state;
+  NEXT;
+#ifndef THREADED_DISPATCH
+ dispatch:
+  switch ( (inst_kind_t) inst->kind )
+    {
+#endif
+      
+      
+    INST ( JE ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      cond= false;
+      for ( n= 1; n < inst->nops && !cond; ++n )
+        {
+          if ( !op_to_u16 ( intp, &(inst->ops[n]), &op2, err ) )
+            return RET_ERROR;
+          if ( op1 == op2 ) cond= true;
+        }
+      if ( !cached_branch ( intp, inst, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( JL ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, ((int16_t) op1) < ((int16_t) op2),
+                            err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( JG ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, ((int16_t) op1) > ((int16_t) op2),
+                            err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( DEC_CHK ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[1]), &op2, err ) ) return RET_ERROR;
+      if ( !read_var ( intp, ref, &op1, err ) ) return RET_ERROR;
+      --op1;
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, (int16_t) op1 < (int16_t) op2, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( INC_CHK ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[1]), &op2, err ) ) return RET_ERROR;
+      if ( !read_var ( intp, ref, &op1, err ) ) return RET_ERROR;
+      ++op1;
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, (int16_t) op1 > (int16_t) op2, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( JIN ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !jin ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( TEST ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, (op1&op2) == op2, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( OR ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      res= op1 | op2;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( AND ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      res= op1 & op2;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( TEST_ATTR ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !test_attr ( intp, op1, op2, &cond, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( SET_ATTR ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !set_attr ( intp, op1, op2, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( CLEAR_ATTR ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !clear_attr ( intp, op1, op2, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( STORE ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[1]), &op2, err ) ) return RET_ERROR;
+      if ( ref == 0x00 ) // Si es desa en la pila descarte anterior
+        { if ( !read_var ( intp, 0, &tmp16, err ) ) return RET_ERROR; }
+      if ( !write_var ( intp, ref, op2, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( INSERT_OBJ ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !insert_obj ( intp, op1, op2, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( LOADW ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      addr= (uint16_t) (op1 + (uint16_t) (2*((int16_t) op2)));
+      if ( !memory_map_fast_readw ( intp->mem, addr, &res, false, err ) )
+        return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( LOADB ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      addr= (uint16_t) (op1 + op2);
+      if ( !memory_map_fast_readb ( intp->mem, addr, &res_u8, false, err ) )
+        return RET_ERROR;
+      SET_U8TOU16(res_u8,res);
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_PROP ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !get_prop ( intp, op1, op2, &res, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_PROP_ADDR ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !get_prop_addr ( intp, op1, op2, &res, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_NEXT_PROP ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !get_next_prop ( intp, op1, op2, &res, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( ADD ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      res= (uint16_t) (((int16_t) op1) + ((int16_t) op2));
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( SUB ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      res= (uint16_t) (((int16_t) op1) - ((int16_t) op2));
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( MUL ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      res= S32_U16(U16_S32(op1) * U16_S32(op2));
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( DIV ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( op2 == 0 ) goto division0;
+      res= (uint16_t) (((int16_t) op1) / ((int16_t) op2));
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( MOD ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( op2 == 0 ) goto division0;
+      res= (uint16_t) (((int16_t) op1) % ((int16_t) op2));
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( CALL_S ):
+      if ( !call_routine ( intp, inst->ops, inst->nops,
+                           inst->store_var, false, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( CALL_N ):
+      if ( !call_routine ( intp, inst->ops, inst->nops, 0, true, err ) )
+        return RET_ERROR;
+      NEXT;
+
+    INST ( JZ ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, op1 == 0, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_SIBLING ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !get_sibling ( intp, op1, &res, &cond, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_CHILD ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !get_child ( intp, op1, &res, &cond, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_PARENT ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !get_parent ( intp, op1, &res, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_PROP_LEN ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !get_prop_len ( intp, op1, &res_u8, err ) ) return RET_ERROR;
+      SET_U8TOU16(res_u8,res);
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( INC ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !read_var ( intp, ref, &op1, err ) ) return RET_ERROR;
+      ++op1;
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( DEC ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !read_var ( intp, ref, &op1, err ) ) return RET_ERROR;
+      --op1;
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PRINT_ADDR ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !print_addr ( intp, op1, NULL, false, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( REMOVE_OBJ ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !remove_obj ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PRINT_OBJ ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !print_obj ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( RET ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !ret_val ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( JUMP ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      state->PC+= ((uint32_t) U16_S32(op1))-2;
+      NEXT;
+    INST ( PRINT_PADDR ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !print_paddr ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( LOAD ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !read_var_nopop ( intp, ref, &res, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+
+    INST ( RTRUE ):
+      if ( !ret_val ( intp, 1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( RFALSE ):
+      if ( !ret_val ( intp, 0, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PRINT ):
+      if ( !print_addr ( intp, inst->text_addr, NULL, true, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( PRINT_RET ):
+      if ( !print_addr ( intp, inst->text_addr, NULL, true, err ) )
+        return RET_ERROR;
+      if ( !print_output ( intp, "\n", false, err ) ) return RET_ERROR;
+      if ( !ret_val ( intp, 1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( NOP ):
+      NEXT;
+    INST ( RET_POPPED ):
+      if ( !state_readvar ( state, 0, &op1, true, err ) ) return RET_ERROR;
+      if ( !ret_val ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( NEW_LINE ):
+      if ( !print_output ( intp, "\n", false, err ) ) return RET_ERROR;
+      NEXT;
+
+    INST ( STOREW ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[2]), &op3, err ) ) return RET_ERROR;
+      addr= (uint16_t) (op1 + (uint16_t) (2*((int16_t) op2)));
+      if ( !memory_map_fast_writew ( intp->mem, addr, op3, false, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( STOREB ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[2]), &op3, err ) ) return RET_ERROR;
+      addr= (uint16_t) (op1 + op2);
+      if ( !memory_map_fast_writeb ( intp->mem, addr, (uint8_t) op3,
+                                     false, err ) )
+        return RET_ERROR;
+      NEXT;
+    INST ( PUT_PROP ):
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[2]), &op3, err ) ) return RET_ERROR;
+      if ( !put_prop ( intp, op1, op2, op3, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PRINT_CHAR ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !print_char ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PRINT_NUM ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !print_num ( intp, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( RANDOM ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( ((int16_t) op1) > 0  )
+        res= ((random_next ( intp ) - 1)%op1) + 1;
+      else // seed
+        {
+          res= 0;
+          random_set_seed ( intp, -((int16_t) op1) );
+        }
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PUSH ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !write_var ( intp, 0, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( PULL ):
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !read_var ( intp, 0, &op1, err ) ) return RET_ERROR;
+      if ( ref == 0x00 ) // Si es desa en la pila descarte anterior
+        {
+          ww ( "pull - Using stack as variable" );
+          if ( !read_var ( intp, 0, &op2, err ) ) return RET_ERROR;
+        }
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( NOT ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      res= ~op1;
+      if ( !write_var ( intp, inst->store_var, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( CHECK_ARG_COUNT ):
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( !cached_branch ( intp, inst,
+                            (FRAME_ARGS(state)&(1<<(op1-1)))!=0, err ) )
+        return RET_ERROR;
+      NEXT;
+      
+
+      // Superinstruccions. Quan la primera instrucció desa el
+      // resultat en la pila i la segona el trau, el valor es passa
+      // directament, però es comprova el desbordament de la pila
+      // igual que en 'write_var'.
+    INST ( LOADW_JE ):
+      ++intp->fusion.counters[FUSED_IND(INST_LOADW_JE)];
+      ++intp->icount;
+      inst2= &(intp->icache.v[inst->fused]);
+      COUNT_OPCODE ( inst2->opcode );
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      addr= (uint16_t) (op1 + (uint16_t) (2*((int16_t) op2)));
+      if ( !memory_map_fast_readw ( intp->mem, addr, &res, false, err ) )
+        return RET_ERROR;
+      if ( inst->store_var == 0x00 )
+        {
+          if ( state->SP == 0xFFFF ) goto stack_overflow;
+        }
+      else if ( !write_var ( intp, inst->store_var, res, err ) )
+        return RET_ERROR;
+      state->PC= inst2->next_PC;
+      cond= false;
+      for ( n= 1; n < inst2->nops && !cond; ++n )
+        {
+          if ( !op_to_u16 ( intp, &(inst2->ops[n]), &op2, err ) )
+            return RET_ERROR;
+          if ( res == op2 ) cond= true;
+        }
+      if ( !cached_branch ( intp, inst2, cond, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( GET_PROP_STORE ):
+      ++intp->fusion.counters[FUSED_IND(INST_GET_PROP_STORE)];
+      ++intp->icount;
+      inst2= &(intp->icache.v[inst->fused]);
+      COUNT_OPCODE ( inst2->opcode );
+      if ( !cached_ops2 ( intp, inst, &op1, &op2, err ) ) return RET_ERROR;
+      if ( !get_prop ( intp, op1, op2, &res, err ) ) return RET_ERROR;
+      if ( state->SP == 0xFFFF ) goto stack_overflow;
+      state->PC= inst2->next_PC;
+      ref= inst2->ops[0].u8.val;
+      if ( ref == 0x00 ) // Si es desa en la pila descarte anterior
+        { if ( !read_var ( intp, 0, &tmp16, err ) ) return RET_ERROR; }
+      if ( !write_var ( intp, ref, res, err ) ) return RET_ERROR;
+      NEXT;
+    INST ( INC_CHK_JUMP ):
+      ++intp->fusion.counters[FUSED_IND(INST_INC_CHK_JUMP)];
+      inst2= &(intp->icache.v[inst->fused]);
+      if ( !op_to_refvar ( intp, &(inst->ops[0]), &ref, err ) )
+        return RET_ERROR;
+      if ( !op_to_u16 ( intp, &(inst->ops[1]), &op2, err ) ) return RET_ERROR;
+      if ( !read_var ( intp, ref, &op1, err ) ) return RET_ERROR;
+      ++op1;
+      if ( !write_var ( intp, ref, op1, err ) ) return RET_ERROR;
+      if ( ((int16_t) op1 > (int16_t) op2) == inst->branch_cond )
+        {
+          if ( !cached_branch ( intp, inst, inst->branch_cond, err ) )
+            return RET_ERROR;
+        }
+      else
+        {
+          ++intp->icount;
+          COUNT_OPCODE ( inst2->opcode );
+          state->PC= inst2->branch_addr;
+        }
+      NEXT;
+    INST ( PUSH_PULL ):
+      ++intp->fusion.counters[FUSED_IND(INST_PUSH_PULL)];
+      ++intp->icount;
+      inst2= &(intp->icache.v[inst->fused]);
+      COUNT_OPCODE ( inst2->opcode );
+      if ( !op_to_u16 ( intp, &(inst->ops[0]), &op1, err ) ) return RET_ERROR;
+      if ( state->SP == 0xFFFF ) goto stack_overflow;
+      state->PC= inst2->next_PC;
+      if ( !write_var ( intp, inst2->ops[0].u8.val, op1, err ) )
+        return RET_ERROR;
+      NEXT;
+      
+#ifndef THREADED_DISPATCH
+    default:
+      ee ( "interpreter.c - run_threaded - WTF!!" );
+    }
+#endif
+
+ fallback:
+  ret= exec_next_inst ( intp, err );
+  if ( ret != RET_CONTINUE ) return ret;
+  NEXT;
+  
+ division0:
+  msgerror ( err, "Division by 0" );
+  return RET_ERROR;
+
+ stack_overflow:
+  msgerror ( err, "Stack overflow" );
+  return RET_ERROR;
+  
+} // end run_threaded
+
+
+static bool
+load_unicode_translation_table (
+                                Interpreter     *intp,
+                                const uint32_t   addr,
+                                char           **err
+                                )
+{
+
+  int n;
+  
+  
+  // Inicialitza taula a desconegut.
+  intp->echars.enabled= true;
+  for ( n= 0; n < 256; ++n )
+    intp->echars.v[n]= 0xFFFD;
+
+  // Llig nombre entrades.
+  if ( !memory_map_READB ( intp->mem, addr, &intp->echars.N, true, err ) )
+    return false;
+
+  // Llig entrades.
+  for ( n= 0; n < (int) ((uint16_t) intp->echars.N); ++n )
+    {
+      if ( !memory_map_READW ( intp->mem, addr + 1 + n*2,
+                               &(intp->echars.v[n]), true, err ) )
+        return false;
+    }
+
+  return true;
+  
+} // end load_unicode_translation_table
+
+
+static bool
+load_header_extension_table (
+                             Interpreter  *intp,
+                             char        **err
+                             )
+{
+
+  uint32_t ext_addr;
+  uint16_t N,tmp;
+  
+  
+  // Inicialització de valors depenent.
+  intp->echars.enabled= false;
+
+  // Intenta llegir.
+  if ( intp->version < 5 ) return true;
+  ext_addr=
+    (((uint32_t) intp->mem->sf_mem[0x36])<<8) |
+    ((uint32_t) intp->mem->sf_mem[0x37])
+    ;
+  if ( ext_addr == 0 ) return true;
+
+  // Llig taula
+  // --> Nombre d'entrades
+  if ( !memory_map_READW ( intp->mem, ext_addr, &N, true, err ) )
+    return false;
+  // --> Unicode translation table address
+  if ( N >= 3 )
+    {
+      if ( !memory_map_READW ( intp->mem, ext_addr+3*2, &tmp, true, err ) )
+        return false;
+      if ( tmp != 0 )
+        {
+          if ( !load_unicode_translation_table ( intp, (uint32_t) tmp, err ) )
+            return false;
+        }
+    }
+  
+  return true;
+  
+} // end load_header_extension_table
+
+
+static bool
+load_alphabet_table (
+                     Interpreter  *intp,
+                     uint32_t      addr,
+                     char        **err
+                     )
+{
+
+  int i,j;
+
+  
+  assert ( addr != 0 );
+  intp->alph_table.enabled= true;
+  for ( i= 0; i < 3; ++i )
+    for ( j= 0; j < 26; ++j, ++addr )
+      if ( !memory_map_READB ( intp->mem, addr,
+                               &(intp->alph_table.v[i][j]),
+                               true, err ) )
+        return false;
+  intp->alph_table.v[2][1]= ZSCII_NEWLINE;
+  
+  return true;
+  
+} // end load_alphabet_table
+
+
+static bool
+register_extra_chars (
+                      Interpreter  *intp,
+                      char        **err
+                      )
+{
+
+  int i;
+
+  
+  // Taula
+  if ( intp->echars.enabled )
+    {
+      for ( i= 0; i < intp->echars.N; ++i )
+        if ( !screen_ADD_EXTRA_CHAR ( intp->screen, intp->echars.v[i],
+                                      (uint8_t) (i+155), err  ) )
+          return false;
+    }
+  // Taula per defecte
+  else
+    {
+      for ( i= 0; i < ZSCII_TO_UNICODE_SIZE; ++i )
+        if ( !screen_ADD_EXTRA_CHAR ( intp->screen, ZSCII_TO_UNICODE[i],
+                                      (uint8_t) (i+155), err  ) )
+          return false;
+    }
+  
+  return true;
+  
+} // end register_extra_chars
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+interpreter_free (
+                  Interpreter *intp
+                  )
+{
+
+  int i;
+
+  
+  if ( intp->transcript_fd != NULL ) fclose ( intp->transcript_fd );
+  if ( intp->saves != NULL ) saves_free ( intp->saves );
+  if ( intp->std_dict != NULL ) dictionary_free ( intp->std_dict );
+  if ( intp->usr_dicts != NULL ) dictionary_cache_free ( intp->usr_dicts );
+  g_free ( intp->input_text.v );
+  g_free ( intp->text.v );
+  if ( intp->screen != NULL ) screen_free ( intp->screen );
+  if ( intp->pictures != NULL ) pictures_free ( intp->pictures );
+  if ( intp->ins != NULL ) instruction_free ( intp->ins );
+  if ( intp->mem != NULL ) memory_map_free ( intp->mem );
+  if ( intp->sf != NULL ) story_file_free ( intp->sf );
+  if ( intp->state != NULL ) state_free ( intp->state );
+  if ( intp->prof != NULL ) profiler_free ( intp->prof );
+  g_free ( intp->opcodes );
+  g_free ( intp->icache.v );
+  g_free ( intp->icache.ind );
+  for ( i= 0; i < (int) intp->props.N; ++i )
+    g_free ( intp->props.v[i] );
+  g_free ( intp->props.v );
+  g_free ( intp->props.page_stamps );
+  if ( intp->zcache.strings != NULL )
+    g_hash_table_destroy ( intp->zcache.strings );
+  for ( i= 0; i < INTP_ABBRS_NUM; ++i )
+    g_free ( intp->zcache.abbrs[i].text );
+  g_free ( intp->zcache.pages );
+  g_free ( intp );
+  
+} // end interpreter_free
+
+
+Interpreter *
+interpreter_new_from_file_name (
+                                const char      *file_name,
+                                Conf            *conf,
+                                const char      *transcript_fn,
+                                const ScreenMode screen_mode,
+                                const char      *input_fn,
+                                const gboolean   verbose,
+                                Tracer          *tracer,
+                                char           **err
+                                )
+{
+
+  Interpreter *ret;
+  uint32_t std_dict_addr,alphabet_table_addr;
+  SDL_Surface *icon;
+  int n;
+  
+  
+  // Prepara.
+  ret= g_new ( Interpreter, 1 );
+  ret->sf= NULL;
+  ret->state= NULL;
+  ret->mem= NULL;
   ret->ins= NULL;
   ret->tracer= tracer;
   ret->screen= NULL;
   ret->text.v= NULL;
   ret->input_text.v= NULL;
   ret->std_dict= NULL;
-  ret->usr_dict= NULL;
+  ret->usr_dicts= NULL;
   ret->saves= NULL;
+  ret->pictures= NULL;
   ret->verbose= verbose;
   ret->alph_table.enabled= false;
   ret->transcript_fd= NULL;
+  ret->icache.ind= NULL;
+  ret->icache.v= NULL;
+  ret->opcodes= NULL;
+  ret->prof= NULL;
+  ret->props.v= NULL;
+  ret->props.N= 0;
+  ret->props.page_stamps= NULL;
+  ret->props.clock= 0;
+  ret->zcache.strings= g_hash_table_new_full ( g_direct_hash, g_direct_equal,
+                                               NULL, free_string );
+  for ( n= 0; n < INTP_ABBRS_NUM; ++n )
+    ret->zcache.abbrs[n].text= NULL;
+  ret->zcache.pages= NULL;
+  ret->zcache.npages= 0;
   
   // Obri story file
   ret->sf= story_file_new_from_file_name ( file_name, err );
   if ( ret->sf == NULL ) goto error;
 
+  // Imatges (sols amb finestra). La portada es descodifica en el
+  // fil auxiliar mentre es crea la pantalla i la resta de l'estat.
+  if ( screen_mode == SCREEN_SDL && ret->sf->Nres > 0 )
+    {
+      ret->pictures= pictures_new ( ret->sf, PICTURES_CACHE_SIZE, verbose );
+      pictures_prefetch ( ret->pictures, ret->sf->frontispiece );
+    }
+  
   // Inicialitza pantalla
-  if ( !story_file_get_frontispiece ( ret->sf, &icon, &icon_size, err ) )
-    goto error;
   if ( ret->sf->data[0] == 6 )
     {
       msgerror ( err, "Screen model V6 not supported" );
@@ -5875,18 +7351,35 @@ interpreter_new_from_file_name (
     {
       ret->screen= screen_new ( conf, ret->sf->data[0],
                                 story_file_get_title ( ret->sf ),
-                                icon, icon_size, verbose, err );
+                                screen_mode, input_fn, verbose, err );
       if ( ret->screen == NULL ) goto error;
     }
-  g_free ( icon ); icon= NULL;
   
   // Crea estat.
-  ret->state= state_new ( ret->sf, ret->screen, tracer, err );
+  ret->state= state_new ( ret->sf, ret->screen, tracer,
+                          conf->undo_levels, err );
   if ( ret->state == NULL ) goto error;
   
   // Inicialitza mapa de memòria.
   ret->mem= memory_map_new ( ret->sf, ret->state, tracer, err );
   if ( ret->mem == NULL ) goto error;
+  ret->props.page_stamps=
+    g_new0 ( uint64_t, (ret->mem->dyn_mem_size+STATE_PAGE_SIZE-1)>>
+             STATE_PAGE_BITS );
+
+  // Cache d'instruccions.
+  ret->icache.begin= ret->mem->dyn_mem_size;
+  ret->icache.end= ret->mem->sf_mem_size;
+  ret->icache.ind= g_new0 ( uint32_t, ret->icache.end-ret->icache.begin );
+  ret->icache.size= ICACHE_INIT_SIZE;
+  ret->icache.N= 0;
+  ret->icache.v= g_new ( InterpreterInst, ret->icache.size );
+  ret->engine= INTP_ENGINE_THREADED;
+  ret->icount= 0;
+  ret->stop_on_input= false;
+  ret->fusion.enabled= true;
+  for ( n= 0; n < INTP_FUSED_NUM; ++n )
+    ret->fusion.counters[n]= 0;
 
   // Altres
   random_reset ( ret );
@@ -5906,6 +7399,22 @@ interpreter_new_from_file_name (
     (((uint32_t) ret->mem->sf_mem[0xa])<<8) |
     ((uint32_t) ret->mem->sf_mem[0xb])
     ;
+  if ( ret->version <= 3 )
+    {
+      ret->objs.entries= ret->object_table_offset + 31*2;
+      ret->objs.size= 9;
+      ret->objs.max= 255;
+      ret->objs.read= obj_read_v3;
+      ret->objs.write= obj_write_v3;
+    }
+  else
+    {
+      ret->objs.entries= ret->object_table_offset + 63*2;
+      ret->objs.size= 14;
+      ret->objs.max= 0xFFFF;
+      ret->objs.read= obj_read_v4;
+      ret->objs.write= obj_write_v4;
+    }
   if ( ret->version >= 5 )
     {
       alphabet_table_addr=
@@ -5936,8 +7445,7 @@ interpreter_new_from_file_name (
     ((uint32_t) ret->mem->sf_mem[0x9])
     ;
   if ( !dictionary_load ( ret->std_dict, std_dict_addr, err ) ) goto error;
-  ret->usr_dict= dictionary_new ( ret->mem, err );
-  if ( ret->usr_dict == NULL ) goto error;
+  ret->usr_dicts= dictionary_cache_new ( ret->mem );
 
   // Saves
   ret->saves= saves_new ( verbose );
@@ -5959,6 +7467,20 @@ interpreter_new_from_file_name (
   // Register extra chars in screen.
   if ( !register_extra_chars ( ret, err ) ) goto error;
 
+  // Abreviatures.
+  ret->zcache.pages=
+    g_new ( uint32_t, (ret->mem->dyn_mem_size>>STATE_PAGE_BITS) + 1 );
+  load_abbrs ( ret );
+
+  // Icona de la finestra (la portada).
+  if ( ret->pictures != NULL && ret->sf->frontispiece < ret->sf->Nres )
+    {
+      icon= pictures_get ( ret->pictures, ret->sf->frontispiece, err );
+      if ( icon == NULL ) goto error;
+      screen_set_icon ( ret->screen, icon );
+      pictures_release ( ret->pictures, icon );
+    }
+
   // Fitxer transcript
   if ( transcript_fn != NULL )
     {
@@ -5976,13 +7498,135 @@ interpreter_new_from_file_name (
   return ret;
   
  error:
-  g_free ( icon );
   interpreter_free ( ret );
   return NULL;
   
 } // end interpreter_new_from_file_name
 
 
+void
+interpreter_set_fusion (
+                        Interpreter *intp,
+                        const bool   enabled
+                        )
+{
+  intp->fusion.enabled= enabled;
+} // end interpreter_set_fusion
+
+
+void
+interpreter_print_fusion_stats (
+                                const Interpreter *intp,
+                                FILE              *f
+                                )
+{
+
+  int n;
+
+  
+  for ( n= 0; n < INTP_FUSED_NUM; ++n )
+    fprintf ( f, "%-16s %12" PRIu64 "\n",
+              FUSED_NAMES[n], intp->fusion.counters[n] );
+  
+} // end interpreter_print_fusion_stats
+
+
+void
+interpreter_enable_opcode_stats (
+                                 Interpreter *intp
+                                 )
+{
+
+  if ( intp->opcodes == NULL )
+    intp->opcodes= g_new0 ( uint64_t, INTP_OPCODES_NUM );
+  
+} // end interpreter_enable_opcode_stats
+
+
+void
+interpreter_print_opcode_stats (
+                                const Interpreter *intp,
+                                FILE              *f
+                                )
+{
+
+  uint64_t total;
+  bool printed[INTP_OPCODES_NUM];
+  int n,best;
+  
+  
+  if ( intp->opcodes == NULL ) return;
+  
+  // Total.
+  total= 0;
+  for ( n= 0; n < INTP_OPCODES_NUM; ++n )
+    {
+      total+= intp->opcodes[n];
+      printed[n]= intp->opcodes[n] == 0;
+    }
+  if ( total == 0 ) return;
+
+  // Mostra de major a menor.
+  for (;;)
+    {
+      best= -1;
+      for ( n= 0; n < INTP_OPCODES_NUM; ++n )
+        if ( !printed[n] &&
+             (best == -1 || intp->opcodes[n] > intp->opcodes[best]) )
+          best= n;
+      if ( best == -1 ) break;
+      printed[best]= true;
+      if ( best < 256 ) fprintf ( f, "   %02X", best );
+      else              fprintf ( f, "BE %02X", best-256 );
+      fprintf ( f, " %14" PRIu64 " %6.2f%%\n",
+                intp->opcodes[best], 100.0*intp->opcodes[best]/total );
+    }
+  
+} // end interpreter_print_opcode_stats
+
+
+void
+interpreter_enable_profiler (
+                             Interpreter *intp
+                             )
+{
+
+  interpreter_enable_opcode_stats ( intp );
+  if ( intp->prof == NULL )
+    intp->prof= profiler_new ();
+  
+} // end interpreter_enable_profiler
+
+
+bool
+interpreter_write_profile (
+                           Interpreter  *intp,
+                           const char   *file_name,
+                           char        **err
+                           )
+{
+
+  if ( intp->prof == NULL )
+    {
+      msgerror ( err, "Failed to write profile: profiler is not enabled" );
+      return false;
+    }
+  
+  return profiler_write_report ( intp->prof, file_name, err );
+  
+} // end interpreter_write_profile
+
+
+void
+interpreter_set_engine (
+                        Interpreter             *intp,
+                        const InterpreterEngine  engine
+                        )
+{
+  intp->engine= engine;
+} // end interpreter_set_engine
+
+
 bool
 interpreter_run (
                  Interpreter  *intp,
@@ -5993,15 +7637,46 @@ interpreter_run (
   int ret;
 
 
-  do {
-    ret= exec_next_inst ( intp, err );
-  } while ( ret == RET_CONTINUE );
+  switch ( intp->engine )
+    {
+    case INTP_ENGINE_SWITCH:
+      do {
+        ++intp->icount;
+        ret= exec_next_inst ( intp, err );
+      } while ( ret == RET_CONTINUE );
+      break;
+    case INTP_ENGINE_THREADED:
+    default:
+      ret= run_threaded ( intp, err );
+    }
   
   return ret==RET_ERROR ? false : true;
   
 } // end interpreter_run
 
 
+bool
+interpreter_bench (
+                   Interpreter  *intp,
+                   uint64_t     *icount,
+                   char        **err
+                   )
+{
+
+  bool ret;
+
+
+  intp->stop_on_input= true;
+  intp->icount= 0;
+  ret= interpreter_run ( intp, err );
+  intp->stop_on_input= false;
+  *icount= intp->icount;
+  
+  return ret;
+  
+} // end interpreter_bench
+
+
 bool
 interpreter_trace (
                    Interpreter          *intp,
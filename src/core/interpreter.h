@@ -34,11 +34,13 @@
 #include "dictionary.h"
 #include "disassembler.h"
 #include "memory_map.h"
+#include "profiler.h"
 #include "state.h"
 #include "story_file.h"
 #include "tracer.h"
 
 #include "frontend/conf.h"
+#include "frontend/pictures.h"
 #include "frontend/saves.h"
 #include "frontend/screen.h"
 
@@ -49,7 +51,48 @@
 #define INTP_OSTREAM_TABLE      0x04
 #define INTP_OSTREAM_SCRIPT     0x08
 
+#define INTP_FUSED_NUM 4
+
+// Opcodes (256) més opcodes estesos (256).
+#define INTP_OPCODES_NUM 512
+
+// Nombre d'abreviatures.
+#define INTP_ABBRS_NUM 96
+
+// Instrucció predescodificada. Definida en 'interpreter.c'.
+typedef struct _InterpreterInst InterpreterInst;
+
+// Motors d'execució.
+typedef enum
+  {
+    INTP_ENGINE_SWITCH,  // Descodifica cada instrucció ('switch')
+    INTP_ENGINE_THREADED // Cache predescodificada i salts directes
+  } InterpreterEngine;
+
+// Cadena ZSCII ja descodificada a UTF-8.
 typedef struct
+{
+  char     *text;
+  size_t    N;    // Bytes en 'text'
+  uint32_t  addr; // Adreça de la cadena
+  uint32_t  end;  // Adreça següent a la cadena
+} InterpreterString;
+
+// Índex de les propietats d'un objecte. Els vectors s'indexen pel
+// número de propietat.
+typedef struct
+{
+  uint64_t stamp;    // Valor de 'props.clock' quan es va construir
+  uint16_t pointer;  // Property pointer
+  uint32_t page_beg; // Pàgines dinàmiques que ocupa la llista
+  uint32_t page_end; // (page_beg > page_end si no n'ocupa cap)
+  uint8_t  first;    // Primera propietat (0 si no en té)
+  uint16_t addr[64]; // Adreça de les dades (0 si no existeix)
+  uint8_t  len[64];  // Longitut de les dades
+  uint8_t  next[64]; // Següent propietat (0 si és l'última)
+} InterpreterProps;
+
+typedef struct _Interpreter
 {
 
   // TOT ÉS PRIVAT ///
@@ -60,8 +103,9 @@ typedef struct
   Tracer       *tracer; // Pot ser NULL.
   Screen       *screen;
   Dictionary   *std_dict;
-  Dictionary   *usr_dict;
+  DictionaryCache *usr_dicts;
   Saves        *saves;
+  Pictures     *pictures; // Pot ser NULL.
   gboolean      verbose;
   
   // Altres
@@ -69,6 +113,16 @@ typedef struct
   uint32_t routine_offset;
   uint32_t static_strings_offset;
   uint32_t object_table_offset;
+  // Entrades de la taula d'objectes, segons la versió.
+  struct
+  {
+    uint32_t   entries; // Offset de la primera entrada
+    uint32_t   size;    // Grandària d'una entrada
+    uint16_t   max;     // Índex màxim d'objecte
+    uint16_t (*read) (struct _Interpreter *,const uint8_t *,const int);
+    void     (*write) (struct _Interpreter *,uint8_t *,const int,
+                       const uint16_t);
+  }        objs;
   uint32_t abbr_table_addr;
   struct
   {
@@ -122,6 +176,64 @@ typedef struct
     uint16_t seed;
     uint16_t current;
   } random;
+
+  // Cache d'instruccions predescodificades. Sols es descodifiquen
+  // instruccions fora de la memòria dinàmica, on el codi no pot
+  // canviar. Es construeix mentre s'executa.
+  struct
+  {
+    uint32_t        *ind;   // Per adreça, índex+1 en 'v' (0 buit)
+    uint32_t         begin; // Primera adreça indexada
+    uint32_t         end;   // Última adreça indexada + 1
+    InterpreterInst *v;
+    size_t           N;
+    size_t           size;
+  } icache;
+
+  // Cache de cadenes descodificades. Sols es desen cadenes fora de
+  // la memòria dinàmica. Les abreviatures es descodifiquen en
+  // carregar (text NULL si no s'ha pogut). Com la taula i les
+  // abreviatures poden estar en memòria dinàmica, es vigilen les
+  // seues pàgines (bit STATE_DIRTY_STRS) i si alguna canvia es
+  // descarta tota la cache.
+  struct
+  {
+    GHashTable        *strings; // Adreça -> InterpreterString
+    InterpreterString  abbrs[INTP_ABBRS_NUM];
+    uint32_t          *pages;   // Pàgines vigilades
+    uint32_t           npages;
+  } zcache;
+
+  // Índex de propietats per objecte. Es construeix quan es consulta
+  // un objecte i es descarta si canvia el property pointer o alguna
+  // pàgina de la llista (bit STATE_DIRTY_PROPS).
+  struct
+  {
+    InterpreterProps **v;           // Per objecte (NULL no construït)
+    uint32_t           N;           // Entrades en 'v'
+    uint64_t          *page_stamps; // Últim canvi vist de cada pàgina
+    uint64_t           clock;
+  } props;
+
+  // Motor d'execució.
+  InterpreterEngine engine;
+  uint64_t          icount;        // Instruccions executades
+  bool              stop_on_input; // Para quan es demana una entrada
+
+  // Fusió d'instruccions (superinstruccions) en la cache.
+  struct
+  {
+    bool     enabled;
+    uint64_t counters[INTP_FUSED_NUM]; // Execucions de cada forma
+  } fusion;
+
+  // Execucions de cada opcode. NULL si no s'han activat. Els opcodes
+  // estesos (BE XX) es desen a partir de 256.
+  uint64_t *opcodes;
+
+  // Perfilador. NULL si no s'ha activat. Sols es consulta quan
+  // 'opcodes' no és NULL.
+  Profiler *prof;
   
 } Interpreter;
 
@@ -135,11 +247,69 @@ interpreter_new_from_file_name (
                                 const char      *file_name,
                                 Conf            *conf,
                                 const char      *transcript_fn, // Pot ser NULL
+                                const ScreenMode screen_mode,
+                                const char      *input_fn, // Pot ser NULL
                                 const gboolean   verbose,
                                 Tracer          *tracer, // Pot ser NULL
                                 char           **err
                                 );
 
+// Per defecte s'utilitza INTP_ENGINE_THREADED.
+void
+interpreter_set_engine (
+                        Interpreter             *intp,
+                        const InterpreterEngine  engine
+                        );
+
+// Activa/desactiva la fusió de seqüències d'instruccions habituals
+// en superinstruccions. Per defecte està activada. Sols afecta al
+// motor INTP_ENGINE_THREADED i s'ha de cridar abans d'executar.
+void
+interpreter_set_fusion (
+                        Interpreter *intp,
+                        const bool   enabled
+                        );
+
+// Mostra quantes vegades s'ha executat cada superinstrucció.
+void
+interpreter_print_fusion_stats (
+                                const Interpreter *intp,
+                                FILE              *f
+                                );
+
+// Instruccions executades.
+#define interpreter_GET_ICOUNT(INTP) ((INTP)->icount)
+
+// Activa el comptador d'execucions per opcode. S'ha de cridar
+// abans d'executar.
+void
+interpreter_enable_opcode_stats (
+                                 Interpreter *intp
+                                 );
+
+// Mostra quantes vegades s'ha executat cada opcode, de major a
+// menor. No fa res si no s'han activat.
+void
+interpreter_print_opcode_stats (
+                                const Interpreter *intp,
+                                FILE              *f
+                                );
+
+// Activa el perfilador (i el comptador d'execucions per opcode). S'ha
+// de cridar abans d'executar.
+void
+interpreter_enable_profiler (
+                             Interpreter *intp
+                             );
+
+// Escriu l'informe del perfilador (vegeu 'profiler_write_report').
+bool
+interpreter_write_profile (
+                           Interpreter  *intp,
+                           const char   *file_name,
+                           char        **err
+                           );
+
 // Torna cert si tot ha anat bé.
 bool
 interpreter_run (
@@ -147,6 +317,16 @@ interpreter_run (
                  char        **err
                  );
 
+// Executa la història fins que acaba o demana una entrada a
+// l'usuari. Torna cert si tot ha anat bé i en 'icount' el nombre
+// d'instruccions executades. Després no es pot continuar l'execució.
+bool
+interpreter_bench (
+                   Interpreter  *intp,
+                   uint64_t     *icount,
+                   char        **err
+                   );
+
 bool
 interpreter_trace (
                    Interpreter          *intp,
@@ -203,6 +203,7 @@ write_byte (
           else if ( mem->version == 6 ) mask= 0x7;
           else mask= 0x3;
           mem->dyn_mem[0x10]= (mem->dyn_mem[0x10]&(~mask)) | (val&mask);
+          STATE_SET_DIRTY ( mem, 0x10 );
         }
       else
         {
@@ -214,7 +215,10 @@ write_byte (
         }
     }
   else if ( addr < mem->dyn_mem_size ) // Memòria dinàmica.
-    mem->dyn_mem[addr]= val;
+    {
+      mem->dyn_mem[addr]= val;
+      STATE_SET_DIRTY ( mem, addr );
+    }
   else // Error
     {
       if ( addr < mem->sf_mem_size )
@@ -277,6 +281,7 @@ write_word (
           else mask= 0x3;
           data= addr==0x09 ? ((uint8_t) val) : ((uint8_t) (val>>8));
           mem->dyn_mem[0x10]= (mem->dyn_mem[0x10]&(~mask)) | (data&mask);
+          STATE_SET_DIRTY ( mem, 0x10 );
         }
       else
         {
@@ -291,6 +296,8 @@ write_word (
     {
       mem->dyn_mem[addr]= (uint8_t) (val>>8);
       mem->dyn_mem[addr+1]= (uint8_t) val;
+      STATE_SET_DIRTY ( mem, addr );
+      STATE_SET_DIRTY ( mem, addr+1 );
     }
   else // Error
     {
@@ -388,6 +395,8 @@ writevar (
   offset= mem->global_var_offset + ind*2;
   mem->dyn_mem[offset]= (uint8_t) (val>>8);
   mem->dyn_mem[offset+1]= (uint8_t) val;
+  STATE_SET_DIRTY ( mem, offset );
+  STATE_SET_DIRTY ( mem, offset+1 );
   
 } // end writevar
 
@@ -439,9 +448,11 @@ memory_map_new (
   ret= g_new ( MemoryMap, 1 );
   ret->dyn_mem= state->mem;
   ret->dyn_mem_size= state->mem_size;
+  ret->dirty= state->dirty;
   ret->sf_mem= sf->data;
   ret->sf_mem_size= (uint32_t) (sf->size);
   ret->tracer= tracer;
+  ret->trace= false;
 
   // High memory mark.
   ret->high_mem_mark=
@@ -492,6 +503,58 @@ memory_map_new (
 } // end memory_map_new
 
 
+bool
+memory_map_read_byte (
+                      const MemoryMap  *mem,
+                      const uint32_t    addr,
+                      uint8_t          *val,
+                      const bool        high_mem_allowed,
+                      char            **err
+                      )
+{
+  return read_byte ( mem, addr, val, high_mem_allowed, err );
+} // end memory_map_read_byte
+
+
+bool
+memory_map_read_word (
+                      const MemoryMap  *mem,
+                      const uint32_t    addr,
+                      uint16_t         *val,
+                      const bool        high_mem_allowed,
+                      char            **err
+                      )
+{
+  return read_word ( mem, addr, val, high_mem_allowed, err );
+} // end memory_map_read_word
+
+
+bool
+memory_map_write_byte (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       const uint8_t     val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       )
+{
+  return write_byte ( mem, addr, val, high_mem_allowed, err );
+} // end memory_map_write_byte
+
+
+bool
+memory_map_write_word (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       const uint16_t    val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       )
+{
+  return write_word ( mem, addr, val, high_mem_allowed, err );
+} // end memory_map_write_word
+
+
 void
 memory_map_enable_trace (
                          MemoryMap  *mem,
@@ -499,6 +562,7 @@ memory_map_enable_trace (
                          )
 {
 
+  mem->trace= enable;
   if ( enable )
     {
       mem->readb= read_byte_trace;
@@ -41,11 +41,13 @@ struct _MemoryMap
   // d'alliberar.
   uint8_t       *dyn_mem; // Punter a la memòria dinàmica
   uint32_t       dyn_mem_size;
+  uint8_t       *dirty;   // Pàgines modificades (vegeu 'State')
   const uint8_t *sf_mem;   // Punter a la memòria del fitxer.
   uint32_t       sf_mem_size;
   uint32_t       high_mem_mark;
 
   Tracer        *tracer; // Pot ser NULL
+  bool           trace;  // Cert si els callbacks són les versions amb traça
   
   uint8_t        version;
   uint32_t       global_var_offset;
@@ -76,20 +78,207 @@ memory_map_new (
                 char            **err
                 );
 
-#define memory_map_READB(MEM,ADDR,DST,HMEM,ERR)                 \
-  ((MEM)->readb ( (MEM), (ADDR), (DST), (HMEM), (ERR) ))
-#define memory_map_READW(MEM,ADDR,DST,HMEM,ERR)                 \
-  ((MEM)->readw ( (MEM), (ADDR), (DST), (HMEM), (ERR) ))
-#define memory_map_WRITEB(MEM,ADDR,VAL,HMEM,ERR)                \
-  ((MEM)->writeb ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ))
-#define memory_map_WRITEW(MEM,ADDR,VAL,HMEM,ERR)                \
-  ((MEM)->writew ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ))
+// Accessos amb totes les comprovacions i sense traça. Normalment no
+// cal cridar-les directament.
+bool
+memory_map_read_byte (
+                      const MemoryMap  *mem,
+                      const uint32_t    addr,
+                      uint8_t          *val,
+                      const bool        high_mem_allowed,
+                      char            **err
+                      );
+
+bool
+memory_map_read_word (
+                      const MemoryMap  *mem,
+                      const uint32_t    addr,
+                      uint16_t         *val,
+                      const bool        high_mem_allowed,
+                      char            **err
+                      );
+
+bool
+memory_map_write_byte (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       const uint8_t     val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       );
+
+bool
+memory_map_write_word (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       const uint16_t    val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       );
+
+// Accessos ràpids sense traça. El cas habitual es resol inline i la
+// resta (capçalera, memòria alta, errors) es delega en les funcions
+// anteriors.
+static inline bool
+memory_map_fast_readb (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       uint8_t          *val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       )
+{
+  
+  if ( addr < mem->dyn_mem_size )
+    *val= mem->dyn_mem[addr];
+  else if ( addr < mem->sf_mem_size && addr < mem->high_mem_mark )
+    *val= mem->sf_mem[addr];
+  else
+    return memory_map_read_byte ( mem, addr, val, high_mem_allowed, err );
+  
+  return true;
+  
+} // end memory_map_fast_readb
+
+
+static inline bool
+memory_map_fast_readw (
+                       const MemoryMap  *mem,
+                       const uint32_t    addr,
+                       uint16_t         *val,
+                       const bool        high_mem_allowed,
+                       char            **err
+                       )
+{
+  
+  if ( addr < mem->dyn_mem_size-1 )
+    *val= (((uint16_t) mem->dyn_mem[addr])<<8) |
+      ((uint16_t) mem->dyn_mem[addr+1]);
+  else if ( addr >= mem->dyn_mem_size &&
+            addr < mem->sf_mem_size-1 &&
+            addr < mem->high_mem_mark-1 )
+    *val= (((uint16_t) mem->sf_mem[addr])<<8) |
+      ((uint16_t) mem->sf_mem[addr+1]);
+  else
+    return memory_map_read_word ( mem, addr, val, high_mem_allowed, err );
+  
+  return true;
+  
+} // end memory_map_fast_readw
+
+
+static inline bool
+memory_map_fast_writeb (
+                        const MemoryMap  *mem,
+                        const uint32_t    addr,
+                        const uint8_t     val,
+                        const bool        high_mem_allowed,
+                        char            **err
+                        )
+{
+
+  if ( addr >= 64 && addr < mem->dyn_mem_size )
+    {
+      mem->dyn_mem[addr]= val;
+      STATE_SET_DIRTY ( mem, addr );
+      return true;
+    }
+  else
+    return memory_map_write_byte ( mem, addr, val, high_mem_allowed, err );
+  
+} // end memory_map_fast_writeb
+
+
+static inline bool
+memory_map_fast_writew (
+                        const MemoryMap  *mem,
+                        const uint32_t    addr,
+                        const uint16_t    val,
+                        const bool        high_mem_allowed,
+                        char            **err
+                        )
+{
+
+  if ( addr >= 64 && addr < mem->dyn_mem_size-1 )
+    {
+      mem->dyn_mem[addr]= (uint8_t) (val>>8);
+      mem->dyn_mem[addr+1]= (uint8_t) val;
+      STATE_SET_DIRTY ( mem, addr );
+      STATE_SET_DIRTY ( mem, addr+1 );
+      return true;
+    }
+  else
+    return memory_map_write_word ( mem, addr, val, high_mem_allowed, err );
+  
+} // end memory_map_fast_writew
+
+
+// NOTA!! No comprova res
+static inline uint16_t
+memory_map_fast_readvar (
+                         const MemoryMap *mem,
+                         const int        ind
+                         )
+{
+
+  uint32_t offset;
+
+
+  offset= mem->global_var_offset + ind*2;
+  
+  return (((uint16_t) mem->dyn_mem[offset])<<8) |
+    ((uint16_t) mem->dyn_mem[offset+1]);
+  
+} // end memory_map_fast_readvar
+
+
+// NOTA!! No comprova res
+static inline void
+memory_map_fast_writevar (
+                          MemoryMap      *mem,
+                          const int       ind,
+                          const uint16_t  val
+                          )
+{
+
+  uint32_t offset;
+
+
+  offset= mem->global_var_offset + ind*2;
+  mem->dyn_mem[offset]= (uint8_t) (val>>8);
+  mem->dyn_mem[offset+1]= (uint8_t) val;
+  STATE_SET_DIRTY ( mem, offset );
+  STATE_SET_DIRTY ( mem, offset+1 );
+  
+} // end memory_map_fast_writevar
+
+// Sols es passa pels callbacks quan la traça està activada.
+#define memory_map_READB(MEM,ADDR,DST,HMEM,ERR)                         \
+  ((MEM)->trace ?                                                       \
+   (MEM)->readb ( (MEM), (ADDR), (DST), (HMEM), (ERR) ) :               \
+   memory_map_fast_readb ( (MEM), (ADDR), (DST), (HMEM), (ERR) ))
+#define memory_map_READW(MEM,ADDR,DST,HMEM,ERR)                         \
+  ((MEM)->trace ?                                                       \
+   (MEM)->readw ( (MEM), (ADDR), (DST), (HMEM), (ERR) ) :               \
+   memory_map_fast_readw ( (MEM), (ADDR), (DST), (HMEM), (ERR) ))
+#define memory_map_WRITEB(MEM,ADDR,VAL,HMEM,ERR)                        \
+  ((MEM)->trace ?                                                       \
+   (MEM)->writeb ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ) :              \
+   memory_map_fast_writeb ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ))
+#define memory_map_WRITEW(MEM,ADDR,VAL,HMEM,ERR)                        \
+  ((MEM)->trace ?                                                       \
+   (MEM)->writew ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ) :              \
+   memory_map_fast_writew ( (MEM), (ADDR), (VAL), (HMEM), (ERR) ))
 
 // NOTA!! No comprova res
-#define memory_map_readvar(MEM,IND)             \
-  ((MEM)->readvar ( (MEM), (IND) ))
-#define memory_map_writevar(MEM,IND,VAL)        \
-  ((MEM)->writevar ( (MEM), (IND), (VAL) ))
+#define memory_map_readvar(MEM,IND)                                     \
+  ((MEM)->trace ?                                                       \
+   (MEM)->readvar ( (MEM), (IND) ) :                                    \
+   memory_map_fast_readvar ( (MEM), (IND) ))
+#define memory_map_writevar(MEM,IND,VAL)                                \
+  ((MEM)->trace ?                                                       \
+   (MEM)->writevar ( (MEM), (IND), (VAL) ) :                            \
+   memory_map_fast_writevar ( (MEM), (IND), (VAL) ))
 
 void
 memory_map_enable_trace (
@@ -0,0 +1,594 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  profiler.c - Implementació de 'profiler.h'.
+ *
+ */
+
+
+#include <glib.h>
+#include <inttypes.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "profiler.h"
+#include "utils/error.h"
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+#define DEPTHS_INIT_SIZE 64
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+// Dades acumulades d'una rutina (de tots els nodes amb la mateixa
+// adreça).
+typedef struct
+{
+  uint16_t paddr;
+  uint64_t calls;
+  uint64_t insts;
+  uint64_t self;
+  uint64_t total;
+} Routine;
+
+typedef struct
+{
+  uint32_t key; // caller<<16 | callee
+  uint64_t calls;
+} Edge;
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+// En x86 són cicles del processador, en la resta nanosegons.
+static inline uint64_t
+get_ticks (void)
+{
+  
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+  return (uint64_t) __builtin_ia32_rdtsc ();
+#else
+  struct timespec ts;
+  
+  clock_gettime ( CLOCK_MONOTONIC, &ts );
+  return ((uint64_t) ts.tv_sec)*1000000000 + (uint64_t) ts.tv_nsec;
+#endif
+  
+} // end get_ticks
+
+
+static ProfilerNode *
+node_new (
+          ProfilerNode   *parent,
+          const uint16_t  paddr
+          )
+{
+
+  ProfilerNode *ret;
+
+
+  ret= g_new0 ( ProfilerNode, 1 );
+  ret->paddr= paddr;
+  ret->parent= parent;
+  if ( parent != NULL )
+    {
+      ret->sibling= parent->child;
+      parent->child= ret;
+    }
+  
+  return ret;
+  
+} // end node_new
+
+
+static void
+node_free (
+           ProfilerNode *node
+           )
+{
+
+  ProfilerNode *p,*q;
+
+
+  for ( p= node->child; p != NULL; p= q )
+    {
+      q= p->sibling;
+      node_free ( p );
+    }
+  g_free ( node );
+  
+} // end node_free
+
+
+static void
+push_depth (
+            Profiler       *prof,
+            const uint16_t  depth
+            )
+{
+
+  if ( prof->depths.N == prof->depths.size )
+    {
+      prof->depths.size*= 2;
+      prof->depths.v= g_renew ( uint16_t, prof->depths.v, prof->depths.size );
+    }
+  prof->depths.v[prof->depths.N++]= depth;
+  
+} // end push_depth
+
+
+// Torna el total (propis més fills) del node i acumula les dades en
+// 'routines' i 'edges'.
+static uint64_t
+collect (
+         const ProfilerNode *node,
+         GHashTable         *routines,
+         GHashTable         *edges
+         )
+{
+
+  const ProfilerNode *p;
+  uint64_t total;
+  Routine *r;
+  Edge *e;
+  uint32_t key;
+  bool recursive;
+  
+  
+  total= node->ticks;
+  for ( p= node->child; p != NULL; p= p->sibling )
+    total+= collect ( p, routines, edges );
+  if ( node->parent == NULL ) return total;
+  
+  // Rutina. En rutines recursives el total sols es compta en la
+  // crida més externa.
+  r= g_hash_table_lookup ( routines, GUINT_TO_POINTER ( node->paddr ) );
+  if ( r == NULL )
+    {
+      r= g_new0 ( Routine, 1 );
+      r->paddr= node->paddr;
+      g_hash_table_insert ( routines, GUINT_TO_POINTER ( node->paddr ), r );
+    }
+  r->calls+= node->calls;
+  r->insts+= node->insts;
+  r->self+= node->ticks;
+  recursive= false;
+  for ( p= node->parent; p->parent != NULL && !recursive; p= p->parent )
+    if ( p->paddr == node->paddr ) recursive= true;
+  if ( !recursive ) r->total+= total;
+
+  // Aresta.
+  key= (((uint32_t) node->parent->paddr)<<16) | (uint32_t) node->paddr;
+  e= g_hash_table_lookup ( edges, GUINT_TO_POINTER ( key ) );
+  if ( e == NULL )
+    {
+      e= g_new0 ( Edge, 1 );
+      e->key= key;
+      g_hash_table_insert ( edges, GUINT_TO_POINTER ( key ), e );
+    }
+  e->calls+= node->calls;
+  
+  return total;
+  
+} // end collect
+
+
+static void
+append_to_array (
+                 gpointer key,
+                 gpointer value,
+                 gpointer user_data
+                 )
+{
+  g_ptr_array_add ( (GPtrArray *) user_data, value );
+} // end append_to_array
+
+
+static int
+cmp_routines (
+              const void *a,
+              const void *b
+              )
+{
+
+  const Routine *ra,*rb;
+
+
+  ra= *((const Routine * const *) a);
+  rb= *((const Routine * const *) b);
+  
+  return ra->self < rb->self ? 1 : (ra->self > rb->self ? -1 : 0);
+  
+} // end cmp_routines
+
+
+static int
+cmp_edges (
+           const void *a,
+           const void *b
+           )
+{
+
+  const Edge *ea,*eb;
+
+
+  ea= *((const Edge * const *) a);
+  eb= *((const Edge * const *) b);
+  
+  return ea->calls < eb->calls ? 1 : (ea->calls > eb->calls ? -1 : 0);
+  
+} // end cmp_edges
+
+
+static bool
+write_folded_node (
+                   FILE               *f,
+                   const ProfilerNode *node,
+                   GString            *path
+                   )
+{
+
+  const ProfilerNode *p;
+  gsize len;
+  
+
+  len= path->len;
+  if ( node->parent == NULL ) g_string_append ( path, "main" );
+  else g_string_append_printf ( path, ";%04X", node->paddr );
+  if ( node->ticks > 0 &&
+       fprintf ( f, "%s %" PRIu64 "\n", path->str, node->ticks ) < 0 )
+    return false;
+  for ( p= node->child; p != NULL; p= p->sibling )
+    if ( !write_folded_node ( f, p, path ) )
+      return false;
+  g_string_truncate ( path, len );
+  
+  return true;
+  
+} // end write_folded_node
+
+
+static bool
+write_folded (
+              Profiler    *prof,
+              const char  *file_name,
+              char       **err
+              )
+{
+
+  FILE *f;
+  GString *path;
+  bool ok;
+  
+
+  f= fopen ( file_name, "w" );
+  if ( f == NULL )
+    {
+      error_create_file ( err, file_name );
+      return false;
+    }
+  path= g_string_new ( "" );
+  ok= write_folded_node ( f, prof->root, path );
+  g_string_free ( path, TRUE );
+  if ( fclose ( f ) != 0 ) ok= false;
+  if ( !ok )
+    {
+      error_write_file ( err, file_name );
+      return false;
+    }
+  
+  return true;
+  
+} // end write_folded
+
+
+static double
+percent (
+         const uint64_t val,
+         const uint64_t total
+         )
+{
+  return total > 0 ? (100.0*val)/total : 0.0;
+} // end percent
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+profiler_free (
+               Profiler *prof
+               )
+{
+
+  if ( prof->root != NULL ) node_free ( prof->root );
+  g_free ( prof->depths.v );
+  g_free ( prof );
+  
+} // end profiler_free
+
+
+Profiler *
+profiler_new (void)
+{
+
+  Profiler *ret;
+
+
+  ret= g_new0 ( Profiler, 1 );
+  ret->last_opcode= -1;
+  ret->root= node_new ( NULL, 0 );
+  ret->root->calls= 1;
+  ret->current= ret->root;
+  ret->depths.size= DEPTHS_INIT_SIZE;
+  ret->depths.v= g_new ( uint16_t, ret->depths.size );
+  ret->depths.N= 0;
+  
+  return ret;
+  
+} // end profiler_new
+
+
+void
+profiler_inst (
+               Profiler  *prof,
+               const int  opcode
+               )
+{
+
+  uint64_t t,delta;
+
+
+  t= get_ticks ();
+  if ( prof->last_opcode != -1 )
+    {
+      delta= t-prof->last_t;
+      prof->opcode_ticks[prof->last_opcode]+= delta;
+      prof->current->ticks+= delta;
+    }
+  else prof->first_t= t;
+  prof->last_t= t;
+  prof->last_opcode= opcode;
+  ++(prof->opcode_count[opcode]);
+  ++(prof->current->insts);
+  
+} // end profiler_inst
+
+
+void
+profiler_call (
+               Profiler       *prof,
+               const uint16_t  paddr,
+               const uint16_t  depth
+               )
+{
+
+  ProfilerNode *p;
+
+  
+  // Descarta els frames que ja no existeixen.
+  while ( prof->depths.N > 0 && prof->depths.v[prof->depths.N-1] >= depth )
+    {
+      --(prof->depths.N);
+      prof->current= prof->current->parent;
+    }
+
+  // Busca o crea el node.
+  for ( p= prof->current->child; p != NULL && p->paddr != paddr;
+        p= p->sibling );
+  if ( p == NULL ) p= node_new ( prof->current, paddr );
+  ++(p->calls);
+  prof->current= p;
+  push_depth ( prof, depth );
+  
+} // end profiler_call
+
+
+void
+profiler_return (
+                 Profiler       *prof,
+                 const uint16_t  depth
+                 )
+{
+
+  while ( prof->depths.N > 0 && prof->depths.v[prof->depths.N-1] > depth )
+    {
+      --(prof->depths.N);
+      prof->current= prof->current->parent;
+    }
+  
+} // end profiler_return
+
+
+void
+profiler_screen_begin (
+                       Profiler *prof
+                       )
+{
+  prof->screen_t0= get_ticks ();
+} // end profiler_screen_begin
+
+
+void
+profiler_screen_end (
+                     Profiler *prof
+                     )
+{
+  prof->screen_ticks+= get_ticks () - prof->screen_t0;
+} // end profiler_screen_end
+
+
+bool
+profiler_write_report (
+                       Profiler    *prof,
+                       const char  *file_name,
+                       char       **err
+                       )
+{
+
+  FILE *f;
+  GHashTable *routines,*edges;
+  GPtrArray *v;
+  uint64_t total,insts,count;
+  int n,best;
+  bool printed[PROFILER_OPCODES_NUM];
+  guint i;
+  const Routine *r;
+  const Edge *e;
+  gchar *folded_fn;
+  bool ok;
+  
+  
+  // Prepara.
+  f= NULL;
+  routines= g_hash_table_new_full ( g_direct_hash, g_direct_equal,
+                                    NULL, g_free );
+  edges= g_hash_table_new_full ( g_direct_hash, g_direct_equal,
+                                 NULL, g_free );
+  v= g_ptr_array_new ();
+  total= collect ( prof->root, routines, edges );
+  insts= 0;
+  for ( n= 0; n < PROFILER_OPCODES_NUM; ++n )
+    insts+= prof->opcode_count[n];
+  
+  // Obri.
+  f= fopen ( file_name, "w" );
+  if ( f == NULL )
+    {
+      error_create_file ( err, file_name );
+      goto error;
+    }
+
+  // Resum.
+  fprintf ( f, "Instructions: %" PRIu64 "\n", insts );
+  fprintf ( f, "Ticks:        %" PRIu64 "\n", total );
+  fprintf ( f, "Core:         %" PRIu64 " (%.2f%%)\n",
+            total-prof->screen_ticks,
+            percent ( total-prof->screen_ticks, total ) );
+  fprintf ( f, "Screen:       %" PRIu64 " (%.2f%%)\n",
+            prof->screen_ticks, percent ( prof->screen_ticks, total ) );
+  
+  // Opcodes ordenats per ticks.
+  fprintf ( f, "\nOPCODES\n%-6s %14s %18s %8s %10s\n",
+            "opcode", "count", "ticks", "%", "ticks/op" );
+  for ( n= 0; n < PROFILER_OPCODES_NUM; ++n )
+    printed[n]= prof->opcode_count[n] == 0;
+  for (;;)
+    {
+      best= -1;
+      for ( n= 0; n < PROFILER_OPCODES_NUM; ++n )
+        if ( !printed[n] &&
+             (best == -1 ||
+              prof->opcode_ticks[n] > prof->opcode_ticks[best]) )
+          best= n;
+      if ( best == -1 ) break;
+      printed[best]= true;
+      count= prof->opcode_count[best];
+      if ( best < 256 ) fprintf ( f, "   %02X ", best );
+      else              fprintf ( f, "BE %02X ", best-256 );
+      fprintf ( f, "%14" PRIu64 " %18" PRIu64 " %7.2f%% %10.1f\n",
+                count, prof->opcode_ticks[best],
+                percent ( prof->opcode_ticks[best], total ),
+                ((double) prof->opcode_ticks[best])/count );
+    }
+
+  // Rutines ordenades per ticks propis.
+  fprintf ( f, "\nROUTINES\n%-6s %12s %14s %18s %8s %18s %8s\n",
+            "paddr", "calls", "insts", "self", "%", "total", "%" );
+  g_hash_table_foreach ( routines, append_to_array, v );
+  qsort ( v->pdata, v->len, sizeof(gpointer), cmp_routines );
+  for ( i= 0; i < v->len; ++i )
+    {
+      r= (const Routine *) g_ptr_array_index ( v, i );
+      fprintf ( f, "  %04X %12" PRIu64 " %14" PRIu64 " %18" PRIu64
+                " %7.2f%% %18" PRIu64 " %7.2f%%\n",
+                r->paddr, r->calls, r->insts,
+                r->self, percent ( r->self, total ),
+                r->total, percent ( r->total, total ) );
+    }
+  g_ptr_array_free ( v, TRUE );
+  v= g_ptr_array_new ();
+  
+  // Arestes del graf de crides. 'main' és el codi fora de qualsevol
+  // rutina cridada (incloent la rutina inicial).
+  fprintf ( f, "\nCALL GRAPH\n%-6s    %-6s %12s\n",
+            "caller", "callee", "calls" );
+  g_hash_table_foreach ( edges, append_to_array, v );
+  qsort ( v->pdata, v->len, sizeof(gpointer), cmp_edges );
+  for ( i= 0; i < v->len; ++i )
+    {
+      e= (const Edge *) g_ptr_array_index ( v, i );
+      if ( (e->key>>16) == 0 ) fprintf ( f, "  main -> " );
+      else fprintf ( f, "  %04X -> ", e->key>>16 );
+      fprintf ( f, "%04X   %12" PRIu64 "\n", e->key&0xFFFF, e->calls );
+    }
+  
+  // Tanca.
+  ok= ferror ( f ) == 0;
+  if ( fclose ( f ) != 0 ) ok= false;
+  f= NULL;
+  if ( !ok )
+    {
+      error_write_file ( err, file_name );
+      goto error;
+    }
+
+  // Piles.
+  folded_fn= g_strconcat ( file_name, ".folded", NULL );
+  ok= write_folded ( prof, folded_fn, err );
+  g_free ( folded_fn );
+  if ( !ok ) goto error;
+  
+  // Allibera.
+  g_ptr_array_free ( v, TRUE );
+  g_hash_table_destroy ( edges );
+  g_hash_table_destroy ( routines );
+  
+  return true;
+
+ error:
+  if ( f != NULL ) fclose ( f );
+  g_ptr_array_free ( v, TRUE );
+  g_hash_table_destroy ( edges );
+  g_hash_table_destroy ( routines );
+  return false;
+  
+} // end profiler_write_report
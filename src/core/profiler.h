@@ -0,0 +1,135 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  profiler.h - Perfilador d'execució: opcodes, rutines i graf de
+ *               crides.
+ *
+ */
+
+#ifndef __CORE__PROFILER_H__
+#define __CORE__PROFILER_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Opcodes (256) més opcodes estesos (256).
+#define PROFILER_OPCODES_NUM 512
+
+// Node de l'arbre de crides. Cada node és una rutina cridada des del
+// camí que el connecta amb l'arrel.
+typedef struct _ProfilerNode ProfilerNode;
+
+struct _ProfilerNode
+{
+  uint16_t      paddr;     // Adreça empaquetada (0 per a l'arrel)
+  uint64_t      calls;
+  uint64_t      insts;     // Instruccions executades dins la rutina
+  uint64_t      ticks;     // Ticks propis (sense les rutines cridades)
+  ProfilerNode *parent;
+  ProfilerNode *child;     // Primer fill
+  ProfilerNode *sibling;   // Següent germà
+};
+
+typedef struct
+{
+
+  // CAMPS PRIVATS.
+  
+  // Opcodes.
+  uint64_t opcode_count[PROFILER_OPCODES_NUM];
+  uint64_t opcode_ticks[PROFILER_OPCODES_NUM];
+  int      last_opcode; // -1 si no n'hi ha
+  uint64_t last_t;
+  uint64_t first_t;
+  
+  // Arbre de crides.
+  ProfilerNode  *root;
+  ProfilerNode  *current;
+  struct
+  {
+    uint16_t *v;         // Profunditat (frame_ind) de cada node actiu
+    size_t    N;
+    size_t    size;
+  }              depths;
+  
+  // Pantalla.
+  uint64_t screen_t0;
+  uint64_t screen_ticks;
+  
+} Profiler;
+
+void
+profiler_free (
+               Profiler *prof
+               );
+
+Profiler *
+profiler_new (void);
+
+// Cal cridar-la abans d'executar cada instrucció. Els ticks des de
+// l'anterior crida s'assignen a l'anterior instrucció i a la rutina
+// actual.
+void
+profiler_inst (
+               Profiler  *prof,
+               const int  opcode
+               );
+
+// Cal cridar-la després de crear el frame d'una rutina. 'depth' és
+// el 'frame_ind' del nou frame.
+void
+profiler_call (
+               Profiler       *prof,
+               const uint16_t  paddr,
+               const uint16_t  depth
+               );
+
+// Cal cridar-la després d'alliberar el frame d'una rutina. 'depth'
+// és el 'frame_ind' actual. Funciona encara que s'hagen descartat
+// diversos frames (throw, restore, etc.).
+void
+profiler_return (
+                 Profiler       *prof,
+                 const uint16_t  depth
+                 );
+
+// Delimiten el temps dedicat a la pantalla.
+void
+profiler_screen_begin (
+                       Profiler *prof
+                       );
+
+void
+profiler_screen_end (
+                     Profiler *prof
+                     );
+
+// Escriu l'informe en 'file_name' i les piles en format "collapsed"
+// (flamegraph) en 'file_name'.folded.
+bool
+profiler_write_report (
+                       Profiler    *prof,
+                       const char  *file_name,
+                       char       **err
+                       );
+
+#endif // __CORE__PROFILER_H__
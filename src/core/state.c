@@ -42,6 +42,15 @@
 /* FUNCIONS PRIVADES */
 /*********************/
 
+static void
+set_all_dirty (
+               State *state
+               )
+{
+  memset ( state->dirty, STATE_DIRTY_ALL, state->undo.npages );
+} // end set_all_dirty
+
+
 static void
 reset_header_values (
                      State      *state,
@@ -161,6 +170,9 @@ reset_header_values (
   // 0x33: Standard revision number (minor)
   state->mem[0x32]= 1;
   state->mem[0x33]= 1;
+
+  // La capçalera està en la primera pàgina.
+  if ( state->dirty != NULL ) STATE_SET_DIRTY ( state, 0 );
   
 } // end reset_header_values
 
@@ -232,95 +244,122 @@ call_main (
 } // end call_main
 
 
-static uint32_t
-calc_quetzal_cmem_size (
-                        const State *state
-                        )
+// Llig 8 bytes sense requerir alineament.
+static inline uint64_t
+load_u64 (
+          const uint8_t *p
+          )
 {
+
+  uint64_t ret;
+
+
+  memcpy ( &ret, p, sizeof(ret) );
+
+  return ret;
   
-  uint32_t ret,n;
-  uint8_t val;
-  bool is_zero;
-  int zeros;
+} // end load_u64
+
+
+// Codifica en format 'CMem' de Quetzal (XOR + seqüències de zeros)
+// la diferència entre 'a' i 'b' i l'escriu en '*buf' a partir de
+// 'off'. Redimensiona '*buf' si cal. Els zeros finals no es
+// codifiquen. Torna el nombre de bytes escrits.
+static uint32_t
+encode_cmem (
+             uint8_t        **buf,
+             size_t          *size,
+             const size_t     off,
+             const uint8_t   *a,
+             const uint8_t   *b,
+             const uint32_t   len
+             )
+{
+
+  uint8_t *p;
+  uint32_t i,n,zeros,run;
   
 
-  ret= 0;
-  is_zero= false;
+  // Capacitat. En el pitjor cas ocupa 1.5 vegades 'len'.
+  if ( off + 2*((size_t) len) > *size )
+    {
+      while ( off + 2*((size_t) len) > *size )
+        *size= *size==0 ? 1024 : (*size)*2;
+      *buf= g_renew ( uint8_t, *buf, *size );
+    }
+
+  // Codifica.
+  p= &((*buf)[off]);
+  n= 0;
   zeros= 0;
-  for ( n= 0; n < state->mem_size; ++n )
+  i= 0;
+  while ( i < len )
     {
-      val= state->mem[n]^state->sf->data[n];
-      if ( val != 0x00 )
-        {
-          is_zero= false;
-          ++ret;
-        }
-      else if ( !is_zero )
-        {
-          ret+= 2;
-          zeros= 0;
-          is_zero= true;
-        }
-      else if ( ++zeros == 256 )
+      
+      // Bota ràpidament blocs de 8 bytes iguals.
+      while ( i+8 <= len && load_u64 ( &a[i] ) == load_u64 ( &b[i] ) )
+        { zeros+= 8; i+= 8; }
+      while ( i < len && a[i] == b[i] )
+        { ++zeros; ++i; }
+      if ( i == len ) break;
+      
+      // Zeros pendents.
+      while ( zeros > 0 )
         {
-          ret+= 2;
-          zeros= 0;
+          run= zeros > 256 ? 256 : zeros;
+          p[n++]= 0x00;
+          p[n++]= (uint8_t) (run-1);
+          zeros-= run;
         }
+
+      // Bytes diferents.
+      do {
+        p[n++]= a[i]^b[i];
+        ++i;
+      } while ( i < len && a[i] != b[i] );
+      
     }
   
-  return ret;
+  return n;
   
-} // end calc_quetzal_cmem_size
+} // end encode_cmem
 
 
-// Return compressed data
-static uint8_t *
-get_quetzal_cmem (
-                  const State    *state,
-                  const uint32_t  cmem_size
-                  )
+// Aplica (XOR) sobre 'dst' les dades codificades en format
+// 'CMem'. Torna false si les dades no són vàlides. Si 'dst' és NULL
+// sols es comprova que les dades són vàlides.
+static bool
+decode_cmem (
+             uint8_t        *dst,
+             const uint32_t  dst_len,
+             const uint8_t  *data,
+             const size_t    n
+             )
 {
 
-  uint32_t n,p;
-  uint8_t val;
-  bool is_zero;
-  int zeros;
-  uint8_t *ret;
-
+  size_t i;
+  uint32_t pos;
+  
 
-  ret= g_new ( uint8_t, cmem_size );
-  is_zero= false;
-  zeros= 0;
-  p= 0;
-  for ( n= 0; n < state->mem_size; ++n )
+  pos= 0;
+  for ( i= 0; i < n && pos < dst_len; ++i )
     {
-      val= state->mem[n]^state->sf->data[n];
-      if ( val != 0x00 )
+      if ( data[i] != 0x00 )
         {
-          if ( is_zero ) ret[p++]= (uint8_t) zeros;
-          ret[p++]= val;
-          is_zero= false;
-        }
-      else if ( !is_zero )
-        {
-          ret[p++]= 0x00;
-          zeros= 0;
-          is_zero= true;
+          if ( dst != NULL ) dst[pos]^= data[i];
+          ++pos;
         }
-      else if ( ++zeros == 256 )
+      else
         {
-          ret[p++]= 0xff;
-          ret[p++]= 0x00;
-          zeros= 0;
+          if ( ++i >= n ) return false;
+          pos+= 1 + (uint32_t) data[i];
+          if ( pos > dst_len ) return false;
         }
     }
-  if ( is_zero ) ret[p++]= (uint8_t) zeros;
-  
-  assert ( p == cmem_size );
   
-  return ret;
+  return true;
   
-} // end get_quetzal_cmem
+} // end decode_cmem
 
 
 static uint8_t *
@@ -547,8 +586,7 @@ load_quetzal_cmem (
 {
 
   uint8_t *data;
-  uint8_t flags2_10,flags2_11,val;
-  uint32_t i,pos,num_zeros,j;
+  uint8_t flags2_10,flags2_11;
   
 
   // Prepara.
@@ -564,35 +602,13 @@ load_quetzal_cmem (
   // Carrega (S'ha de descomprimir)
   flags2_10= state->mem[0x10];
   flags2_11= state->mem[0x11];
-  pos= 0;
-  for ( i= 0; i < chunk->length && pos < state->mem_size; ++i )
-    {
-      val= data[i];
-      if ( val != 0x00 )
-        {
-          state->mem[pos]= state->sf->data[pos]^val;
-          ++pos;
-        }
-      else
-        {
-          state->mem[pos]= state->sf->data[pos];
-          ++pos; ++i;
-          if ( i >= chunk->length ) goto error_invalid_cmem;
-          num_zeros= (uint32_t) data[i];
-          for ( j= 0; j < num_zeros && pos < state->mem_size; ++j )
-            {
-              state->mem[pos]= state->sf->data[pos];
-              ++pos;
-            }
-          if ( j != num_zeros ) goto error_invalid_cmem;
-        }
-    }
-  if ( pos > state->mem_size ) goto error_invalid_cmem;
-  for ( ; pos < state->mem_size; ++pos )
-    state->mem[pos]= state->sf->data[pos];
+  memcpy ( state->mem, state->sf->data, state->mem_size );
+  if ( !decode_cmem ( state->mem, state->mem_size, data, chunk->length ) )
+    goto error_invalid_cmem;
   reset_header_values ( state, false );
   state->mem[0x10]= flags2_10;
   state->mem[0x11]= flags2_11;
+  set_all_dirty ( state );
   
   // Allibera
   g_free ( data );
@@ -823,6 +839,54 @@ readvar_trace (
 
 
 
+static uint32_t
+page_length (
+             const State    *state,
+             const uint32_t  page
+             )
+{
+
+  uint32_t beg;
+
+
+  beg= page<<STATE_PAGE_BITS;
+  
+  return (state->mem_size-beg) < STATE_PAGE_SIZE ?
+    (state->mem_size-beg) : STATE_PAGE_SIZE;
+  
+} // end page_length
+
+
+// Afegeix a 'u' la diferència (XOR) entre 'mem' i 'last' de la
+// pàgina indicada. No afegeix res si no hi ha diferències.
+static void
+undo_add_page (
+               StateUndo      *u,
+               const uint8_t  *mem,
+               const uint8_t  *last,
+               const uint32_t  page,
+               const uint32_t  len
+               )
+{
+
+  size_t beg;
+  uint32_t n;
+  
+  
+  beg= u->data_N;
+  n= encode_cmem ( &(u->data), &(u->data_size), beg+4, mem, last, len );
+  if ( n == 0 ) return;
+  u->data[beg]= (uint8_t) (page>>8);
+  u->data[beg+1]= (uint8_t) page;
+  u->data[beg+2]= (uint8_t) (n>>8);
+  u->data[beg+3]= (uint8_t) n;
+  u->data_N+= 4 + n;
+  
+} // end undo_add_page
+
+
+
+
 /**********************/
 /* FUNCIONS PÚBLIQUES */
 /**********************/
@@ -833,6 +897,20 @@ state_free (
             )
 {
 
+  int n;
+
+  
+  if ( state->undo.v != NULL )
+    {
+      for ( n= 0; n < state->undo.size; ++n )
+        {
+          g_free ( state->undo.v[n].data );
+          g_free ( state->undo.v[n].stack );
+        }
+      g_free ( state->undo.v );
+    }
+  g_free ( state->undo.last );
+  g_free ( state->dirty );
   g_free ( state->mem );
   g_free ( state );
   
@@ -844,21 +922,29 @@ state_new (
            StoryFile     *sf,
            const Screen  *screen,
            Tracer        *tracer,
+           const int      undo_levels,
            char         **err
            )
 {
 
   State *ret;
   uint8_t version;
+  int n;
   
   
   // Prepara.
   ret= g_new ( State, 1 );
   ret->mem= NULL;
+  ret->dirty= NULL;
   ret->sf= sf;
   ret->tracer= tracer;
   ret->frame_ind= 0;
   ret->screen= screen;
+  ret->undo.v= NULL;
+  ret->undo.size= undo_levels > 0 ? undo_levels : 0;
+  ret->undo.N= 0;
+  ret->undo.pos= 0;
+  ret->undo.last= NULL;
   
   // Crea memòria dinàmica.
   version= sf->data[0];
@@ -872,6 +958,8 @@ state_new (
     ret->mem_size= (uint16_t) sf->size;
   ret->mem= g_new ( uint8_t, ret->mem_size );
   memcpy ( ret->mem, sf->data, ret->mem_size );
+  ret->undo.npages= (ret->mem_size+STATE_PAGE_SIZE-1)>>STATE_PAGE_BITS;
+  ret->dirty= g_new0 ( uint8_t, ret->undo.npages );
   reset_header_values ( ret, true );
 
   // PC
@@ -887,6 +975,23 @@ state_new (
     }
   else create_dummy_frame ( ret );
 
+  // Undo. La memòria de cada instantània es reserva quan s'utilitza.
+  if ( ret->undo.size > 0 )
+    {
+      ret->undo.v= g_new ( StateUndo, ret->undo.size );
+      for ( n= 0; n < ret->undo.size; ++n )
+        {
+          ret->undo.v[n].data= NULL;
+          ret->undo.v[n].data_size= 0;
+          ret->undo.v[n].data_N= 0;
+          ret->undo.v[n].stack= NULL;
+          ret->undo.v[n].stack_size= 0;
+        }
+      ret->undo.last= g_new ( uint8_t, ret->mem_size );
+      memcpy ( ret->undo.last, ret->mem, ret->mem_size );
+      memset ( ret->dirty, 0, ret->undo.npages );
+    }
+  
   // Callbacks.
   ret->writevar= writevar;
   ret->readvar= readvar;
@@ -1036,8 +1141,12 @@ state_save (
   uint8_t buf_PC[3];
   uint8_t *cmem,*stks;
   uint32_t cmem_size,ifhd_size,stks_size,total_size;
-  size_t welems;
+  size_t welems,cmem_capacity;
+  
   
+  // Prepara.
+  cmem= NULL;
+  cmem_capacity= 0;
   
   // Obri fitxer.
   f= fopen ( file_name, "wb" );
@@ -1049,7 +1158,8 @@ state_save (
 
   // Calcula grandàries seccions.
   ifhd_size= 13;
-  cmem_size= calc_quetzal_cmem_size ( state );
+  cmem_size= encode_cmem ( &cmem, &cmem_capacity, 0,
+                          state->mem, state->sf->data, state->mem_size );
   stks_size= ((uint32_t) (state->SP))*2;
   total_size=
     4 + // FORM TYPE
@@ -1082,10 +1192,8 @@ state_save (
   // Content of dynamic memory
   if ( fprintf ( f, "CMem" ) != 4 ) goto error_write;
   if ( !fwrite_u32_be ( f, cmem_size ) ) goto error_write;
-  cmem= get_quetzal_cmem ( state, cmem_size );
-  welems= fwrite ( cmem, cmem_size, 1, f );
-  g_free ( cmem );
-  if ( welems != 1 ) goto error_write;
+  if ( cmem_size > 0 && fwrite ( cmem, cmem_size, 1, f ) != 1 )
+    goto error_write;
   if ( cmem_size&0x1 )
     { if ( fwrite ( &ZERO_VAL, 1, 1, f ) != 1 ) goto error_write; }
   
@@ -1101,13 +1209,15 @@ state_save (
   
   // Tanca
   fclose ( f );
-
+  g_free ( cmem );
+  
   return true;
 
  error_write:
   error_write_file ( err, file_name );
  error:
   if ( f != NULL ) fclose ( f );
+  g_free ( cmem );
   return false;
   
 } // end state_save
@@ -1174,6 +1284,138 @@ state_load (
 } // end state_load
 
 
+bool
+state_save_undo (
+                 State *state
+                 )
+{
+
+  StateUndo *u;
+  int pos;
+  uint32_t p,beg,len;
+  
+  
+  if ( state->undo.size == 0 ) return false;
+  
+  // Si està ple es sobreescriu la més antiga.
+  if ( state->undo.N == state->undo.size )
+    {
+      --(state->undo.N);
+      state->undo.pos= (state->undo.pos+1)%state->undo.size;
+    }
+  pos= (state->undo.pos + state->undo.N)%state->undo.size;
+  u= &(state->undo.v[pos]);
+  
+  // Memòria dinàmica. Sols les pàgines modificades.
+  u->data_N= 0;
+  for ( p= 0; p < state->undo.npages; ++p )
+    if ( state->dirty[p]&STATE_DIRTY_UNDO )
+      {
+        beg= p<<STATE_PAGE_BITS;
+        len= page_length ( state, p );
+        undo_add_page ( u, &(state->mem[beg]), &(state->undo.last[beg]),
+                        p, len );
+        memcpy ( &(state->undo.last[beg]), &(state->mem[beg]), len );
+        state->dirty[p]&= ~STATE_DIRTY_UNDO;
+      }
+
+  // Pila
+  if ( u->stack_size < state->SP )
+    {
+      g_free ( u->stack );
+      u->stack= g_new ( uint16_t, state->SP );
+      u->stack_size= state->SP;
+    }
+  memcpy ( u->stack, state->stack, sizeof(uint16_t)*state->SP );
+  u->SP= state->SP;
+  u->frame= state->frame;
+  u->frame_ind= state->frame_ind;
+  u->PC= state->PC;
+  ++(state->undo.N);
+  
+  return true;
+  
+} // end state_save_undo
+
+
+bool
+state_restore_undo (
+                    State  *state,
+                    char  **err
+                    )
+{
+
+  const StateUndo *u;
+  uint8_t flags2_10,flags2_11;
+  uint32_t p,beg,n;
+  size_t i;
+  
+  
+  if ( state->undo.N == 0 )
+    {
+      msgerror ( err, "no undo state available" );
+      return false;
+    }
+  --(state->undo.N);
+  u= &(state->undo.v[(state->undo.pos + state->undo.N)%state->undo.size]);
+
+  // Comprova la instantània abans de modificar res. Si no és vàlida
+  // la resta tampoc es poden aplicar i es descarten.
+  for ( i= 0; i < u->data_N; i+= 4 + n )
+    {
+      if ( i+4 > u->data_N ) goto error_invalid_cmem;
+      p= (((uint32_t) u->data[i])<<8) | ((uint32_t) u->data[i+1]);
+      n= (((uint32_t) u->data[i+2])<<8) | ((uint32_t) u->data[i+3]);
+      if ( p >= state->undo.npages || i+4+n > u->data_N ||
+           !decode_cmem ( NULL, page_length ( state, p ),
+                          &(u->data[i+4]), n ) )
+        goto error_invalid_cmem;
+    }
+  
+  // Memòria dinàmica (com en 'load_quetzal_cmem').
+  flags2_10= state->mem[0x10];
+  flags2_11= state->mem[0x11];
+  // --> Torna a l'última instantània les pàgines modificades.
+  for ( p= 0; p < state->undo.npages; ++p )
+    if ( state->dirty[p]&STATE_DIRTY_UNDO )
+      {
+        beg= p<<STATE_PAGE_BITS;
+        memcpy ( &(state->mem[beg]), &(state->undo.last[beg]),
+                 page_length ( state, p ) );
+        state->dirty[p]= // La memòria ha canviat.
+          STATE_DIRTY_WATCH|STATE_DIRTY_PROPS|STATE_DIRTY_STRS;
+      }
+  // --> 'last' passa a ser l'instantània anterior. Les pàgines que
+  //     canvien queden com a modificades. Les dades ja s'han validat.
+  for ( i= 0; i < u->data_N; i+= 4 + n )
+    {
+      p= (((uint32_t) u->data[i])<<8) | ((uint32_t) u->data[i+1]);
+      n= (((uint32_t) u->data[i+2])<<8) | ((uint32_t) u->data[i+3]);
+      decode_cmem ( &(state->undo.last[p<<STATE_PAGE_BITS]),
+                    page_length ( state, p ), &(u->data[i+4]), n );
+      state->dirty[p]= STATE_DIRTY_ALL;
+    }
+  reset_header_values ( state, false );
+  state->mem[0x10]= flags2_10;
+  state->mem[0x11]= flags2_11;
+
+  // Pila
+  memcpy ( state->stack, u->stack, sizeof(uint16_t)*u->SP );
+  state->SP= u->SP;
+  state->frame= u->frame;
+  state->frame_ind= u->frame_ind;
+  state->PC= u->PC;
+  
+  return true;
+
+ error_invalid_cmem:
+  state->undo.N= 0;
+  msgerror ( err, "invalid CMem compressed data in undo state" );
+  return false;
+  
+} // end state_restore_undo
+
+
 void
 state_enable_trace (
                     State      *state,
@@ -1225,6 +1467,7 @@ state_restart (
   // --> Fixa memòria
   memcpy ( state->mem, mem, state->mem_size );
   g_free ( mem );
+  set_all_dirty ( state );
   // --> Reseteja capçalera.
   reset_header_values ( state, false );
   
@@ -37,6 +37,33 @@
 
 #define STACK_SIZE 0xFFFF
 
+// Pàgines de la memòria dinàmica utilitzades per a saber què ha
+// canviat entre instantànies d'undo.
+#define STATE_PAGE_BITS 8
+#define STATE_PAGE_SIZE (1<<STATE_PAGE_BITS)
+
+// Bits de 'dirty'. UNDO indica que la pàgina ha canviat des de
+// l'última instantània d'undo, WATCH que ha canviat des de l'última
+// vegada que la cache de diccionaris l'ha consultat i esborrat,
+// PROPS el mateix per a l'índex de propietats i STRS per a la cache
+// de cadenes.
+#define STATE_DIRTY_UNDO  0x01
+#define STATE_DIRTY_WATCH 0x02
+#define STATE_DIRTY_PROPS 0x04
+#define STATE_DIRTY_STRS  0x08
+#define STATE_DIRTY_ALL                                         \
+  (STATE_DIRTY_UNDO|STATE_DIRTY_WATCH|STATE_DIRTY_PROPS|        \
+   STATE_DIRTY_STRS)
+
+// Bits que marca una escriptura en una entrada de la taula
+// d'objectes. Les entrades no se solapen mai amb les llistes de
+// propietats, per tant no cal invalidar l'índex de propietats.
+#define STATE_DIRTY_OBJ (STATE_DIRTY_ALL&~STATE_DIRTY_PROPS)
+
+// Marca com a modificada la pàgina que conté ADDR.
+#define STATE_SET_DIRTY(ST,ADDR)                                \
+  ((ST)->dirty[(ADDR)>>STATE_PAGE_BITS]= STATE_DIRTY_ALL)
+
 // IMPORTANT!! Aquests macros no fan comprovacions.
 #define FRAME_NLOCAL(ST) ((uint8_t) ((ST)->stack[(ST)->frame+2]&0xF))
 #define FRAME_DISCARD_RES(ST) (((ST)->stack[(ST)->frame+2]&0x10)!=0)
@@ -60,6 +87,25 @@
  */
 typedef struct _State State;
 
+// Instantània de l'estat utilitzada per 'undo'. De la memòria
+// dinàmica sols es guarden les pàgines que han canviat respecte a
+// l'instantània anterior, fent XOR i comprimint els zeros com en el
+// 'CMem' de Quetzal. Cada pàgina es codifica com:
+//
+//   NUM_PÀGINA (2 bytes) | LONGITUD (2 bytes) | DADES (LONGITUD bytes)
+typedef struct
+{
+  uint8_t  *data;       // Pàgines modificades
+  size_t    data_size;  // Capacitat de 'data'
+  size_t    data_N;     // Bytes utilitzats de 'data'
+  uint16_t *stack;      // Còpia de la pila [0,SP[
+  uint16_t  stack_size; // Capacitat de 'stack'
+  uint16_t  SP;
+  uint16_t  frame;
+  uint16_t  frame_ind;
+  uint32_t  PC;
+} StateUndo;
+
 struct _State
 {
 
@@ -75,11 +121,27 @@ struct _State
                                 // Quetzal, indica el nombre de frames
                                 // actius en la pila. És el que
                                 // utilitzem en catch/throw.
+  uint8_t  *dirty;              // Per cada pàgina de 'mem', bits
+                                // STATE_DIRTY_* que indiquen si ha
+                                // canviat.
 
   // Camps privats
   const StoryFile *sf;
   Tracer          *tracer; // Pot ser NULL
   const Screen    *screen;
+
+  // Undo en memòria. Anell d'instantànies, quan està ple es
+  // sobreescriu la més antiga. 'last' és la memòria dinàmica en
+  // l'última instantània.
+  struct
+  {
+    StateUndo *v;
+    int        size; // Nombre màxim d'instantànies
+    int        N;
+    int        pos;  // Principi de l'anell
+    uint8_t   *last;
+    uint32_t   npages;
+  }                undo;
   
   // Callbacks.
   bool (*writevar) (State *,const uint8_t,const uint16_t,char **);
@@ -92,11 +154,14 @@ state_free (
             State *state
             );
 
+// 'undo_levels' és el nombre màxim d'instantànies que es guarden
+// per a 'undo'. Si és 0 no es pot fer 'undo'.
 State *
 state_new (
            StoryFile     *sf,
            const Screen  *screen,
            Tracer        *tracer, // Pot ser NULL
+           const int      undo_levels,
            char         **err
            );
 
@@ -162,6 +227,24 @@ state_load (
             char       **err
             );
 
+// Desa l'estat actual en memòria per a fer 'undo'. Torna fals si
+// 'undo' està desactivat.
+bool
+state_save_undo (
+                 State *state
+                 );
+
+// Recupera l'última instantània desada amb 'state_save_undo' i
+// l'elimina. Igual que 'state_load' es conserven els valors de la
+// capçalera que fixa l'intèrpret. Torna fals si no hi ha cap
+// instantània o si no és vàlida, i en aquest cas no es modifica
+// l'estat i es descarten totes les instantànies.
+bool
+state_restore_undo (
+                    State  *state,
+                    char  **err
+                    );
+
 void
 state_enable_trace (
                     State      *state,
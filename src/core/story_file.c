@@ -30,6 +30,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <sys/stat.h>
 
 #include "iff.h"
 #include "story_file.h"
@@ -43,6 +44,9 @@
 /* MACROS */
 /**********/
 
+// Grup de les entrades de la cache d'identificadors.
+#define ID_CACHE_GROUP "Id"
+
 #define BUF_TO_U32(BUF)                          \
   (((uint32_t) ((uint8_t) (BUF)[3])) |           \
    (((uint32_t) ((uint8_t) (BUF)[2]))<<8) |      \
@@ -143,6 +147,29 @@ check_data (
 } // end check_data
 
 
+// Projecta el fitxer en memòria de sols lectura. Les pàgines es
+// llegeixen sota demanda i es comparteixen amb altres processos que
+// projecten el mateix fitxer. La memòria dinàmica es copia en 'State'.
+static bool
+map_file (
+          StoryFile   *sf,
+          const char  *file_name,
+          char       **err
+          )
+{
+
+  sf->map= g_mapped_file_new ( file_name, FALSE, NULL );
+  if ( sf->map == NULL )
+    {
+      error_open_file ( err, file_name );
+      return false;
+    }
+
+  return true;
+  
+} // end map_file
+
+
 static StoryFile *
 new_from_zfile (
                 const char  *file_name,
@@ -151,46 +178,29 @@ new_from_zfile (
 {
 
   StoryFile *ret;
-  FILE *f;
-  long size;
   
 
   // Reserva i prepara.
   ret= g_new ( StoryFile, 1 );
   ret->file_name= NULL;
   ret->title= NULL;
+  ret->path= NULL;
   ret->data= NULL;
+  ret->map= NULL;
   ret->resources= NULL;
   ret->Nres= 0;
-  ret->fres= NULL;
   ret->frontispiece= ret->Nres;
   ret->raw_metadata= NULL;
-  f= NULL;
 
-  // Llig contingut.
-  f= fopen ( file_name, "rb" );
-  if ( f == NULL ) { error_open_file ( err, file_name ); goto error; }
-  if ( fseek ( f, 0, SEEK_END ) == -1 )
-    { error_read_file ( err, file_name ); goto error; }
-  size= ftell ( f );
-  if ( size == -1 ) { error_read_file ( err, file_name ); goto error; }
-  if ( size == 0 )
+  // Projecta contingut.
+  if ( !map_file ( ret, file_name, err ) ) goto error;
+  if ( g_mapped_file_get_length ( ret->map ) == 0 )
     {
       msgerror ( err, "Failed to read from empty file: %s", file_name );
       goto error;
     }
-  ret->size= (size_t) size;
-  if ( ret->size != size )
-    {
-      msgerror ( err, "Failed to read from file [file is too large %ld]: %s",
-                 size, file_name );
-      goto error;
-    }
-  rewind ( f );
-  ret->data= g_new ( uint8_t, ret->size );
-  if ( fread ( ret->data, ret->size, 1, f ) != 1 )
-    { error_read_file ( err, file_name ); goto error; }
-  fclose ( f ); f= NULL;
+  ret->data= (const uint8_t *) g_mapped_file_get_contents ( ret->map );
+  ret->size= g_mapped_file_get_length ( ret->map );
   
   // Comprovacions bàsiques.
   if ( !check_data ( ret, file_name, err ) )
@@ -199,46 +209,37 @@ new_from_zfile (
   return ret;
   
  error:
-  if ( f != NULL ) fclose ( f );
   story_file_free ( ret );
   return NULL;
   
 } // end new_from_zfile
 
 
-// NOTA!! En aquest punt sf->fres està apuntant a la següent entrada en RIdx.
+// 'entry' apunta a l'entrada n de RIdx (12 bytes) dins del fitxer
+// projectat. 'index' relaciona la posició de cada chunk amb el seu
+// índex+1 en 'iff->chunks'.
 static bool
 read_resource (
                StoryFile       *sf,
                const uint32_t   n,
                const IFF       *iff,
+               GHashTable      *index,
+               const uint8_t   *entry,
                const char      *file_name,
                char           **err
                )
 {
 
-  char buf[4],usage[4];
+  const char *usage;
   uint32_t num,start,i;
-  long entry_offset;
   const IFFChunk *chunk;
   
   
   // Llig usage.
-  if ( fread ( usage, sizeof(usage), 1, sf->fres ) != 1 )
-    {
-      msgerror ( err, "Unable to read RIdx[%u].usage: %s",
-                 n, file_name );
-      return false;
-    }
+  usage= (const char *) entry;
 
   // Llig number i comprova
-  if ( fread ( buf, sizeof(buf), 1, sf->fres ) != 1 )
-    {
-      msgerror ( err, "Unable to read RIdx[%u].number: %s",
-                 n, file_name );
-      return false;
-    }
-  num= BUF_TO_U32(buf);
+  num= BUF_TO_U32(entry+4);
   if ( num >= sf->Nres )
     {
       msgerror ( err, "RIdx[%u].number==%u is out of range [0,%u]: %s",
@@ -253,25 +254,25 @@ read_resource (
     }
 
   // Llig start
-  if ( fread ( buf, sizeof(buf), 1, sf->fres ) != 1 )
-    {
-      msgerror ( err, "Unable to read RIdx[%u].start: %s",
-                 n, file_name );
-      return false;
-    }
-  start= BUF_TO_U32(buf);
+  start= BUF_TO_U32(entry+8);
 
   // Cerca chunk que coincidisca amb start.
-  entry_offset= (long) ((int64_t) ((uint64_t) start));
-  for ( i= 0;
-        i < iff->N && iff->chunks[i].offset != entry_offset;
-        ++i );
-  if ( i == iff->N )
+  i= GPOINTER_TO_UINT ( g_hash_table_lookup ( index,
+                                              GUINT_TO_POINTER ( start ) ) );
+  if ( i == 0 )
     {
       msgerror ( err, "RIdx[%u] chunk not found: %s", n, file_name );
       return false;
     }
-  chunk= &(iff->chunks[i]);
+  chunk= &(iff->chunks[i-1]);
+  if ( (size_t) chunk->offset + 8 + (size_t) chunk->length >
+       g_mapped_file_get_length ( sf->map ) )
+    {
+      msgerror ( err, "RIdx[%u] chunk (offset:%ld,length:%u) exceeds the"
+                 " file size: %s", n, chunk->offset, chunk->length,
+                 file_name );
+      return false;
+    }
 
   // Emplena camps resource.
   sf->resources[num].offset= chunk->offset+8; // Ignora capçalera
@@ -335,6 +336,32 @@ read_resource (
 } // end read_resource
 
 
+// Índex de la posició de cada chunk al seu índex+1 en 'iff->chunks'.
+// Si hi ha chunks repetits es queda el primer.
+static GHashTable *
+build_chunk_index (
+                   const IFF *iff
+                   )
+{
+
+  GHashTable *ret;
+  size_t i;
+  gpointer key;
+  
+
+  ret= g_hash_table_new ( g_direct_hash, g_direct_equal );
+  for ( i= 0; i < iff->N; ++i )
+    {
+      key= GUINT_TO_POINTER ( (uint32_t) iff->chunks[i].offset );
+      if ( g_hash_table_lookup ( ret, key ) == NULL )
+        g_hash_table_insert ( ret, key, GUINT_TO_POINTER ( i+1 ) );
+    }
+
+  return ret;
+  
+} // end build_chunk_index
+
+
 static bool
 init_resources (
                 StoryFile   *sf,
@@ -344,7 +371,8 @@ init_resources (
                 )
 {
 
-  char buf[4];
+  const uint8_t *ridx;
+  GHashTable *index;
   uint32_t n;
   
   
@@ -354,22 +382,19 @@ init_resources (
       msgerror ( err, "RIdx chunk not found: %s", file_name );
       return false;
     }
-  
-  // Obri fitxer resources
-  sf->fres= fopen ( file_name, "rb" );
-  if ( sf->fres == NULL )
-    { error_read_file ( err, file_name ); return false; }
-  if ( fseek ( sf->fres, iff->chunks[0].offset+8, SEEK_SET ) != 0 )
+  if ( iff->chunks[0].length < 4 ||
+       (size_t) iff->chunks[0].offset + 8 + iff->chunks[0].length >
+       g_mapped_file_get_length ( sf->map ) )
     { error_read_file ( err, file_name ); return false; }
+  ridx= (const uint8_t *) g_mapped_file_get_contents ( sf->map ) +
+    iff->chunks[0].offset + 8;
   
   // Llig num entrades i inicialitza resources
-  if ( fread ( buf, sizeof(buf), 1, sf->fres ) != 1 )
-    { error_read_file ( err, file_name ); return false; }
-  sf->Nres= BUF_TO_U32(buf);
+  sf->Nres= BUF_TO_U32(ridx);
   if ( (sf->Nres*12 + 4) != iff->chunks[0].length )
     {
       msgerror ( err,
-                 "RIdx length (%lu) does not match with"
+                 "RIdx length (%u) does not match with"
                  " number of resource entries (%u): %s",
                  iff->chunks[0].length, sf->Nres, file_name );
       return false;
@@ -387,9 +412,15 @@ init_resources (
     }
   
   // Llig resources
+  index= build_chunk_index ( iff );
   for ( n= 0; n < sf->Nres; ++n )
-    if ( !read_resource ( sf, n, iff, file_name, err ) )
-      return false;
+    if ( !read_resource ( sf, n, iff, index, ridx + 4 + n*12,
+                          file_name, err ) )
+      {
+        g_hash_table_destroy ( index );
+        return false;
+      }
+  g_hash_table_destroy ( index );
 
   // Comprova que tots els resources estiguen assignats.
   for ( n= 0; n < sf->Nres; ++n )
@@ -423,16 +454,11 @@ load_zcode_chunk (
   if ( n == sf->Nres )
     {
       msgerror ( err, "No ZCode found: %s", file_name );
-      return true;
+      return false;
     }
 
-  // Carrega
-  sf->data= g_new ( uint8_t, sf->resources[n].size );
-  sf->size= sf->resources[n].size;
-  if ( fseek ( sf->fres, sf->resources[n].offset, SEEK_SET ) != 0 )
-    { error_read_file ( err, file_name ); return false; }
-  if ( fread ( sf->data, sf->size, 1, sf->fres ) != 1 )
-    { error_read_file ( err, file_name ); return false; }
+  // Apunta al chunk dins del fitxer projectat.
+  sf->data= story_file_get_resource ( sf, n, &(sf->size) );
 
   // Comprovacions bàsiques.
   if ( !check_data ( sf, file_name, err ) )
@@ -453,19 +479,20 @@ load_chunk (
             )
 {
 
-  if ( fseek ( sf->fres, chunk->offset+8, SEEK_SET ) != 0 )
-    goto error;
-  if ( fread ( mem, (size_t) chunk->length, 1, sf->fres ) != 1 )
-    goto error;
+  if ( chunk->offset < 0 ||
+       (size_t) chunk->offset + 8 + (size_t) chunk->length >
+       g_mapped_file_get_length ( sf->map ) )
+    {
+      msgerror ( err,
+                 "Failed to read chunk (type:'%s',offset:%ld,length:%u): %s",
+                 chunk->type, chunk->offset, chunk->length, file_name );
+      return false;
+    }
+  memcpy ( mem, g_mapped_file_get_contents ( sf->map ) + chunk->offset + 8,
+           (size_t) chunk->length );
 
   return true;
   
- error:
-  msgerror ( err,
-             "Failed to read chunk (type:'%s',offset:%ld,length:%u): %s",
-             chunk->type, chunk->offset, chunk->length, file_name );
-  return false;
-  
 } // end load_chunk
 
 
@@ -563,10 +590,11 @@ new_from_blorb (
   ret= g_new ( StoryFile, 1 );
   ret->file_name= NULL;
   ret->title= NULL;
+  ret->path= NULL;
   ret->data= NULL;
   ret->resources= NULL;
   ret->Nres= 0;
-  ret->fres= NULL;
+  ret->map= NULL;
   ret->frontispiece= UINT32_MAX;
   ret->raw_metadata= NULL;
   iff= NULL;
@@ -583,6 +611,8 @@ new_from_blorb (
     }
 
   // Inicialitza resources
+  if ( !map_file ( ret, file_name, err ) )
+    goto error;
   if ( !init_resources ( ret, iff, file_name, err ) )
     goto error;
 
@@ -648,6 +678,128 @@ build_id (
 } // end build_id
 
 
+// Cada story file té el seu fitxer en la cache, amb el SHA1 de la
+// ruta com a nom.
+static gchar *
+get_id_cache_file_name (
+                        const StoryFile *sf
+                        )
+{
+
+  gchar *hash,*ret;
+
+
+  hash= g_compute_checksum_for_string ( G_CHECKSUM_SHA1, sf->path, -1 );
+  ret= g_build_path ( G_DIR_SEPARATOR_S,
+                      g_get_user_cache_dir (),
+                      "run-zcode", "ids", hash, NULL );
+  g_free ( hash );
+
+  return ret;
+  
+} // end get_id_cache_file_name
+
+
+// Torna cert si s'ha trobat un identificador vàlid en la cache.
+static bool
+read_id_cache (
+               StoryFile   *sf,
+               const gchar *cache_fn
+               )
+{
+
+  GKeyFile *f;
+  gchar *path,*id;
+  bool ret;
+  
+  
+  ret= false;
+  path= id= NULL;
+  f= g_key_file_new ();
+  if ( !g_key_file_load_from_file ( f, cache_fn, G_KEY_FILE_NONE, NULL ) )
+    goto end;
+  path= g_key_file_get_string ( f, ID_CACHE_GROUP, "path", NULL );
+  id= g_key_file_get_string ( f, ID_CACHE_GROUP, "id", NULL );
+  if ( path != NULL && id != NULL &&
+       strcmp ( path, sf->path ) == 0 &&
+       strlen ( id ) < STORY_FILE_IDSIZE &&
+       g_key_file_get_int64 ( f, ID_CACHE_GROUP, "size", NULL ) ==
+       sf->fsize &&
+       g_key_file_get_int64 ( f, ID_CACHE_GROUP, "mtime", NULL ) ==
+       sf->mtime &&
+       g_key_file_get_uint64 ( f, ID_CACHE_GROUP, "inode", NULL ) ==
+       sf->inode )
+    {
+      strcpy ( sf->id, id );
+      ret= true;
+    }
+  
+ end:
+  g_free ( path );
+  g_free ( id );
+  g_key_file_free ( f );
+  return ret;
+  
+} // end read_id_cache
+
+
+// Els errors s'ignoren, la cache és opcional.
+static void
+write_id_cache (
+                const StoryFile *sf,
+                const gchar     *cache_fn
+                )
+{
+
+  GKeyFile *f;
+  gchar *dir;
+  
+
+  dir= g_path_get_dirname ( cache_fn );
+  g_mkdir_with_parents ( dir, 0755 );
+  g_free ( dir );
+  f= g_key_file_new ();
+  g_key_file_set_string ( f, ID_CACHE_GROUP, "path", sf->path );
+  g_key_file_set_int64 ( f, ID_CACHE_GROUP, "size", sf->fsize );
+  g_key_file_set_int64 ( f, ID_CACHE_GROUP, "mtime", sf->mtime );
+  g_key_file_set_uint64 ( f, ID_CACHE_GROUP, "inode", sf->inode );
+  g_key_file_set_string ( f, ID_CACHE_GROUP, "id", sf->id );
+  if ( !g_key_file_save_to_file ( f, cache_fn, NULL ) )
+    ww ( "Failed to write story identifier cache: %s", cache_fn );
+  g_key_file_free ( f );
+  
+} // end write_id_cache
+
+
+// Anota ruta, grandària, data de modificació i inode per a la cache
+// d'identificadors. La data es desa en nanosegons perquè una
+// modificació dins del mateix segon sense canviar la grandària no
+// passe desapercebuda. Si falla no es fa servir la cache.
+static void
+init_id_key (
+             StoryFile  *sf,
+             const char *file_name
+             )
+{
+
+  struct stat st;
+
+
+  sf->id[0]= '\0';
+  sf->path= NULL;
+  sf->fsize= 0;
+  sf->mtime= 0;
+  sf->inode= 0;
+  if ( stat ( file_name, &st ) != 0 ) return;
+  sf->path= g_canonicalize_filename ( file_name, NULL );
+  sf->fsize= (gint64) st.st_size;
+  sf->mtime= ((gint64) st.st_mtim.tv_sec)*G_GINT64_CONSTANT(1000000000) +
+    (gint64) st.st_mtim.tv_nsec;
+  sf->inode= (guint64) st.st_ino;
+  
+} // end init_id_key
+
+
 static void
 get_title_start_element (
                          GMarkupParseContext  *context,
@@ -801,9 +953,9 @@ story_file_free (
 
   g_free ( sf->title );
   g_free ( sf->file_name );
+  g_free ( sf->path );
   if ( sf->raw_metadata != NULL ) g_free ( sf->raw_metadata );
-  if ( sf->fres != NULL ) fclose ( sf->fres );
-  if ( sf->data != NULL ) g_free ( sf->data );
+  if ( sf->map != NULL ) g_mapped_file_unref ( sf->map );
   if ( sf->resources != NULL )
     {
       for ( n= 0; n < sf->Nres; ++n )
@@ -848,10 +1000,11 @@ story_file_new_from_file_name (
     ret= new_from_blorb ( file_name, err );
   else
     ret= new_from_zfile ( file_name, err );
+  if ( ret == NULL ) return NULL;
   ret->file_name= g_path_get_basename ( file_name );
 
-  // Crea id
-  build_id ( ret );
+  // L'id es calcula quan es demana.
+  init_id_key ( ret, file_name );
   
   return ret;
   
@@ -867,22 +1020,36 @@ story_file_read_resource (
                           )
 {
 
-  assert ( resource < sf->Nres );
-
-  if ( fseek ( sf->fres, sf->resources[resource].offset, SEEK_SET ) != 0 )
-    goto error;
-  if ( fread ( mem, sf->resources[resource].size, 1, sf->fres ) != 1 )
-    goto error;
+  const uint8_t *data;
+  size_t size;
+  
+  
+  data= story_file_get_resource ( sf, resource, &size );
+  memcpy ( mem, data, size );
   
   return true;
-
- error:
-  msgerror ( err, "Failed to read resource %u", resource );
-  return false;
   
 } // end story_file_read_resource
 
 
+const uint8_t *
+story_file_get_resource (
+                         StoryFile      *sf,
+                         const uint32_t  resource,
+                         size_t         *size
+                         )
+{
+
+  assert ( resource < sf->Nres );
+
+  *size= sf->resources[resource].size;
+  
+  return (const uint8_t *) g_mapped_file_get_contents ( sf->map ) +
+    sf->resources[resource].offset;
+  
+} // end story_file_get_resource
+
+
 bool
 story_file_get_frontispiece (
                              StoryFile  *sf,
@@ -931,3 +1098,141 @@ story_file_get_title (
   return ret;
   
 } // end story_file_get_title
+
+
+const char *
+story_file_get_id (
+                   StoryFile *sf
+                   )
+{
+
+  gchar *cache_fn;
+
+
+  if ( sf->id[0] != '\0' ) return sf->id;
+  if ( sf->path == NULL ) build_id ( sf );
+  else
+    {
+      cache_fn= get_id_cache_file_name ( sf );
+      if ( !read_id_cache ( sf, cache_fn ) )
+        {
+          build_id ( sf );
+          write_id_cache ( sf, cache_fn );
+        }
+      g_free ( cache_fn );
+    }
+  
+  return sf->id;
+  
+} // end story_file_get_id
+
+
+bool
+story_file_find_cover (
+                       const char             *file_name,
+                       long                   *offset,
+                       size_t                 *size,
+                       StoryFileResourceType  *type,
+                       char                  **err
+                       )
+{
+
+  FILE *f;
+  IFF *iff;
+  const IFFChunk *chunk;
+  uint8_t buf[12];
+  uint32_t num,N,n,start;
+  size_t i;
+  
+  
+  // Prepara.
+  *offset= -1;
+  *size= 0;
+  *type= STORY_FILE_RESOURCE_NONE;
+  f= NULL;
+  iff= NULL;
+  
+  // Sols els blorbs poden tindre portada.
+  f= fopen ( file_name, "rb" );
+  if ( f == NULL ) { error_open_file ( err, file_name ); goto error; }
+  if ( fread ( buf, 4, 1, f ) != 1 )
+    {
+      // Un fitxer de menys de 4 bytes tampoc és un blorb.
+      if ( ferror ( f ) ) { error_read_file ( err, file_name ); goto error; }
+      goto end;
+    }
+  if ( strncmp ( (const char *) buf, "FORM", 4 ) != 0 ) goto end;
+  iff= iff_new_from_file_name ( file_name, err );
+  if ( iff == NULL ) goto error;
+  if ( strcmp ( iff->type, "IFRS" ) != 0 ||
+       iff->N == 0 || strcmp ( iff->chunks[0].type, "RIdx" ) != 0 )
+    goto end;
+
+  // Número del resource (Fspc).
+  for ( i= 0; i < iff->N && strcmp ( iff->chunks[i].type, "Fspc" ) != 0; ++i );
+  if ( i == iff->N || iff->chunks[i].length < 4 ) goto end;
+  if ( fseek ( f, iff->chunks[i].offset+8, SEEK_SET ) != 0 ||
+       fread ( buf, 4, 1, f ) != 1 )
+    { error_read_file ( err, file_name ); goto error; }
+  num= BUF_TO_U32(buf);
+
+  // Cerca en RIdx.
+  if ( fseek ( f, iff->chunks[0].offset+8, SEEK_SET ) != 0 ||
+       fread ( buf, 4, 1, f ) != 1 )
+    { error_read_file ( err, file_name ); goto error; }
+  N= BUF_TO_U32(buf);
+  if ( ((uint64_t) N)*12 + 4 != iff->chunks[0].length )
+    {
+      msgerror ( err,
+                 "RIdx length (%u) does not match with"
+                 " number of resource entries (%u): %s",
+                 iff->chunks[0].length, N, file_name );
+      goto error;
+    }
+  for ( n= 0; n < N; ++n )
+    {
+      if ( fread ( buf, 12, 1, f ) != 1 )
+        { error_read_file ( err, file_name ); goto error; }
+      if ( strncmp ( (const char *) buf, "Pict", 4 ) == 0 &&
+           BUF_TO_U32(buf+4) == num )
+        break;
+    }
+  if ( n == N )
+    {
+      ww ( "Invalid frontispiece identifier %u: %s", num, file_name );
+      goto end;
+    }
+  start= BUF_TO_U32(buf+8);
+  for ( i= 0; i < iff->N && iff->chunks[i].offset != (long) start; ++i );
+  if ( i == iff->N )
+    {
+      msgerror ( err, "RIdx[%u] chunk not found: %s", n, file_name );
+      goto error;
+    }
+  chunk= &(iff->chunks[i]);
+  if ( strcmp ( chunk->type, "PNG " ) == 0 )
+    *type= STORY_FILE_RESOURCE_PICTURE_PNG;
+  else if ( strcmp ( chunk->type, "JPEG" ) == 0 )
+    *type= STORY_FILE_RESOURCE_PICTURE_JPEG;
+  else if ( strcmp ( chunk->type, "Rect" ) == 0 )
+    *type= STORY_FILE_RESOURCE_PICTURE_PLACEHOLDER;
+  else
+    {
+      msgerror ( err, "RIdx[%u] references to an unsupported picture"
+                 " resource chunk '%s': %s", n, chunk->type, file_name );
+      goto error;
+    }
+  *offset= chunk->offset+8;
+  *size= (size_t) chunk->length;
+  
+ end:
+  if ( iff != NULL ) iff_free ( iff );
+  fclose ( f );
+  return true;
+  
+ error:
+  if ( iff != NULL ) iff_free ( iff );
+  if ( f != NULL ) fclose ( f );
+  return false;
+  
+} // end story_file_find_cover
@@ -26,6 +26,7 @@
 #ifndef __CORE__STORY_FILE_H__
 #define __CORE__STORY_FILE_H__
 
+#include <glib.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -57,20 +58,26 @@ typedef struct
 
 typedef struct
 {
-  uint8_t           *data;         // Bytes del story file
+  const uint8_t     *data;         // Bytes del story file (sols
+                                   // lectura, apunten a 'map')
   size_t             size;         // Nombre de bytes
+  GMappedFile       *map;          // Fitxer projectat en memòria
+                                   // (també els 'resources')
   StoryFileResource *resources;    // Llista de 'resources'
   uint32_t           Nres;         // Nombre de 'resources'
-  FILE              *fres;         // Descriptor fitxer on llegir
-                                   // 'resources'.
   char              *raw_metadata; // Raw metadata en format XML. Pot
                                    // ser NULL.
   uint32_t           frontispiece; // Resource que s'utilitza com a
                                    // "portada". Sempre serà de tipus
                                    // 'PICTURE'. Si el seu valor es >=
                                    // Nres vol dir que no hi ha.
-  char               id[STORY_FILE_IDSIZE]; // Identificador.
+  char               id[STORY_FILE_IDSIZE]; // Identificador. Buit
+                                            // fins que es demana.
   char              *file_name;    // File name.
+  char              *path;         // Ruta canònica. Pot ser NULL.
+  gint64             fsize;        // Grandària, data de modificació
+  gint64             mtime;        // (en nanosegons) i inode del
+  guint64            inode;        // fitxer en obrir-lo.
   char              *title;
   
 } StoryFile;
@@ -99,6 +106,17 @@ story_file_read_resource (
                           char           **err
                           );
 
+// Torna un punter a les dades del resource dins del fitxer projectat
+// (sense còpia) i en 'size' la seua grandària. El punter és vàlid
+// mentre no s'allibere 'sf'.
+// NOTA!! resource ha de ser un índex vàlid.
+const uint8_t *
+story_file_get_resource (
+                         StoryFile      *sf,
+                         const uint32_t  resource,
+                         size_t         *size
+                         );
+
 // Llig en 'mem' (reserva memòria) la portada. Si no en té assigna
 // NULL (no és considera error). Torna false en cas d'error.
 bool
@@ -109,12 +127,31 @@ story_file_get_frontispiece (
                              char      **err
                              );
 
+// Localitza la portada d'un fitxer blorb sense carregar-lo: sols
+// llig l'índex IFF, la taula RIdx i el chunk Fspc. Torna en 'offset'
+// i 'size' la posició de les dades dins del fitxer, i en 'type' el
+// tipus d'imatge. Si no té portada (o no és un blorb) 'offset' val
+// -1. Torna false en cas d'error.
+bool
+story_file_find_cover (
+                       const char             *file_name,
+                       long                   *offset,
+                       size_t                 *size,
+                       StoryFileResourceType  *type,
+                       char                  **err
+                       );
+
 const gchar *
 story_file_get_title (
                       StoryFile *sf
                       );
 
-// ID del StoryFile
-#define story_file_GETID(SF) ((SF)->id)
+// ID del StoryFile. Es calcula (MD5 de tot el story file) la primera
+// vegada que es demana, i es desa en una cache en disc indexada per
+// ruta, grandària i data de modificació del fitxer.
+const char *
+story_file_get_id (
+                   StoryFile *sf
+                   );
 
 #endif // __CORE__STORY_FILE_H__
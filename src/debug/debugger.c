@@ -217,8 +217,8 @@ debugger_run (
   if ( tracer == NULL ) goto error;
   if ( verbose )
     ii ( "Loading Z-Code file '%s' ...", zcode_fn );
-  intp= interpreter_new_from_file_name ( zcode_fn, conf, NULL, verbose,
-                                         TRACER(tracer), err );
+  intp= interpreter_new_from_file_name ( zcode_fn, conf, NULL, SCREEN_SDL,
+                                         NULL, verbose, TRACER(tracer), err );
   if ( intp == NULL ) goto error;
 
   // Processa línia
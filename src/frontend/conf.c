@@ -44,6 +44,7 @@
 
 #define GROUP_SCREEN "Screen"
 #define GROUP_FONTS "Fonts"
+#define GROUP_SAVES "Saves"
 
 #define DIRNAME "runzcode"
 
@@ -67,6 +68,9 @@
 #define MIN_FONT_SIZE 6
 #define MAX_FONT_SIZE 64
 
+#define DEFAULT_UNDO_LEVELS 100
+#define MAX_UNDO_LEVELS     1000
+
 
 
 
@@ -141,6 +145,9 @@ set_default_values (
   conf->font_fpitch_bold= g_strdup ( DEFAULT_FONT_FPITCH_BOLD );
   conf->font_fpitch_italic= g_strdup ( DEFAULT_FONT_FPITCH_ITALIC );
   conf->font_fpitch_bold_italic= g_strdup ( DEFAULT_FONT_FPITCH_BOLD_ITALIC );
+
+  // Saves
+  conf->undo_levels= DEFAULT_UNDO_LEVELS;
   
 } // end set_default_values
 
@@ -234,6 +241,14 @@ read_conf (
                 &(conf->font_fpitch_italic) );
   read_string ( f, GROUP_FONTS, "fpitch-bold-italic",
                 &(conf->font_fpitch_bold_italic) );
+
+  // Saves. Fitxers antics poden no tindre aquest grup.
+  gerr= NULL;
+  val_i= g_key_file_get_integer ( f, GROUP_SAVES, "undo-levels", &gerr );
+  if ( gerr != NULL ) { g_error_free ( gerr ); gerr= NULL; }
+  else if ( val_i < 0 || val_i > MAX_UNDO_LEVELS )
+    ww ( "Invalid number of undo levels %d. Using default value", val_i );
+  else conf->undo_levels= val_i;
   
   // Allibera.
   g_key_file_free ( f );
@@ -364,6 +379,9 @@ conf_write (
                           conf->font_fpitch_italic );
   g_key_file_set_string ( f, GROUP_FONTS, "fpitch-bold-italic",
                           conf->font_fpitch_bold_italic );
+
+  // Saves
+  g_key_file_set_integer ( f, GROUP_SAVES, "undo-levels", conf->undo_levels );
   
   // Escriu
   gerr= NULL;
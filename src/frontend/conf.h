@@ -46,6 +46,9 @@ typedef struct
   gchar *font_fpitch_bold;
   gchar *font_fpitch_italic;
   gchar *font_fpitch_bold_italic;
+
+  // --> Saves
+  gint undo_levels; // Nombre màxim d'undo desats en memòria
   
   // CAMPS PRIVATS
   gboolean  _verbose;
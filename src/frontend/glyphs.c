@@ -0,0 +1,293 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  glyphs.c - Implementació de 'glyphs.h'.
+ *
+ */
+
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <SDL_ttf.h>
+
+#include "glyphs.h"
+#include "utils/error.h"
+#include "utils/log.h"
+
+
+
+
+/**********/
+/* MACROS */
+/**********/
+
+// Quan una taula supera aquest nombre d'entrades es buida. Amb els
+// caràcters que solen utilitzar-se no hauria de passar mai.
+#define MAX_GLYPHS 4096
+#define MAX_KERNINGS 16384
+
+#define KERNING_KEY(PREV,CH)                            \
+  ((gint64) (((guint64) (PREV)) | (((guint64) (CH))<<21)))
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static void
+glyph_free (
+            gpointer data
+            )
+{
+
+  Glyph *glyph;
+
+
+  glyph= (Glyph *) data;
+  g_free ( glyph->alpha );
+  g_free ( glyph );
+  
+} // end glyph_free
+
+
+// La tinta es renderitza com ho fa TTF_RenderUTF8_Blended amb un
+// únic caràcter: la columna 0 de la superfície correspon a l'origen
+// més 'minx' si aquest és negatiu. Es retallen les columnes buides.
+static Glyph *
+render_glyph (
+              Glyphs          *g,
+              TTF_Font        *font,
+              const uint32_t   ch,
+              char           **err
+              )
+{
+
+  static const SDL_Color WHITE= { 0xff, 0xff, 0xff, 0xff };
+  
+  Glyph *ret;
+  SDL_Surface *text;
+  gchar buf[8];
+  gint len;
+  int minx,maxx,miny,maxy,r,c,first,last;
+  const uint32_t *row;
+  uint8_t *p;
+  
+  
+  // Prepara.
+  text= NULL;
+  ret= g_new ( Glyph, 1 );
+  ret->key= (gint64) ch;
+  ret->x0= 0;
+  ret->w= 0;
+  ret->h= 0;
+  ret->alpha= NULL;
+  len= g_unichar_to_utf8 ( (gunichar) ch, buf );
+  buf[len]= '\0';
+
+  // Mètriques.
+  if ( TTF_GlyphMetrics32 ( font, ch, &minx, &maxx,
+                            &miny, &maxy, &(ret->advance) ) != 0 )
+    goto error_sdl;
+  if ( ret->advance < 0 ) ret->advance= 0;
+  if ( maxx <= minx ) return ret;
+
+  // Tinta (ARGB8888).
+  text= TTF_RenderUTF8_Blended ( font, buf, WHITE );
+  if ( text == NULL ) goto error_sdl;
+  ret->h= text->h < g->_height ? text->h : g->_height;
+  first= text->w; last= -1;
+  for ( r= 0; r < ret->h; ++r )
+    {
+      row= (const uint32_t *) (((const uint8_t *) text->pixels) +
+                               r*text->pitch);
+      for ( c= 0; c < text->w; ++c )
+        if ( (row[c]>>24) != 0 )
+          {
+            if ( c < first ) first= c;
+            if ( c > last ) last= c;
+          }
+    }
+  if ( last < first )
+    {
+      ret->h= 0;
+      SDL_FreeSurface ( text );
+      return ret;
+    }
+  ret->x0= (minx < 0 ? minx : 0) + first;
+  ret->w= last - first + 1;
+  ret->alpha= g_new ( uint8_t, ret->w*ret->h );
+  for ( r= 0; r < ret->h; ++r )
+    {
+      row= (const uint32_t *) (((const uint8_t *) text->pixels) +
+                               r*text->pitch);
+      p= &(ret->alpha[r*ret->w]);
+      for ( c= 0; c < ret->w; ++c )
+        p[c]= (uint8_t) (row[first+c]>>24);
+    }
+  
+  // Allibera.
+  SDL_FreeSurface ( text );
+  
+  return ret;
+
+ error_sdl:
+  msgerror ( err, "Failed to render glyph U+%04X: %s", ch, SDL_GetError () );
+  if ( text != NULL ) SDL_FreeSurface ( text );
+  glyph_free ( ret );
+  return NULL;
+  
+} // end render_glyph
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+glyphs_free (
+             Glyphs *g
+             )
+{
+
+  int i,j;
+
+  
+  for ( i= 0; i < F_NUM_FONTS; ++i )
+    for ( j= 0; j < F_NUM_STYLES; ++j )
+      {
+        if ( g->_glyphs[i][j] != NULL )
+          g_hash_table_destroy ( g->_glyphs[i][j] );
+        if ( g->_kerning[i][j] != NULL )
+          g_hash_table_destroy ( g->_kerning[i][j] );
+      }
+  g_free ( g );
+  
+} // end glyphs_free
+
+
+Glyphs *
+glyphs_new (
+            Fonts     *fonts,
+            const int  height
+            )
+{
+
+  Glyphs *ret;
+  int i,j;
+  
+
+  // Prepara.
+  ret= g_new ( Glyphs, 1 );
+  ret->_fonts= fonts;
+  ret->_height= height;
+  for ( i= 0; i < F_NUM_FONTS; ++i )
+    for ( j= 0; j < F_NUM_STYLES; ++j )
+      {
+        ret->_glyphs[i][j]= g_hash_table_new_full ( g_int64_hash,
+                                                    g_int64_equal,
+                                                    NULL,
+                                                    glyph_free );
+        ret->_use_kerning[i][j]=
+          (TTF_GetFontKerning ( fonts->_fonts[i][j] ) != 0);
+        ret->_kerning[i][j]= g_hash_table_new_full ( g_int64_hash,
+                                                     g_int64_equal,
+                                                     NULL,
+                                                     g_free );
+      }
+  
+  return ret;
+  
+} // end glyphs_new
+
+
+const Glyph *
+glyphs_get (
+            Glyphs          *g,
+            const int        font,
+            const int        style,
+            const uint32_t   ch,
+            char           **err
+            )
+{
+
+  GHashTable *table;
+  Glyph *ret;
+  gint64 key;
+  
+
+  table= g->_glyphs[font][style];
+  key= (gint64) ch;
+  ret= (Glyph *) g_hash_table_lookup ( table, &key );
+  if ( ret == NULL )
+    {
+      if ( g_hash_table_size ( table ) >= MAX_GLYPHS )
+        g_hash_table_remove_all ( table );
+      ret= render_glyph ( g, g->_fonts->_fonts[font][style], ch, err );
+      if ( ret == NULL ) return NULL;
+      g_hash_table_insert ( table, &(ret->key), ret );
+    }
+  
+  return ret;
+  
+} // end glyphs_get
+
+
+int
+glyphs_get_kerning (
+                    Glyphs         *g,
+                    const int       font,
+                    const int       style,
+                    const uint32_t  prev,
+                    const uint32_t  ch
+                    )
+{
+
+  GHashTable *table;
+  GlyphsKerning *ret;
+  gint64 key;
+  
+
+  if ( prev == 0 || !g->_use_kerning[font][style] ) return 0;
+  table= g->_kerning[font][style];
+  key= KERNING_KEY ( prev, ch );
+  ret= (GlyphsKerning *) g_hash_table_lookup ( table, &key );
+  if ( ret == NULL )
+    {
+      if ( g_hash_table_size ( table ) >= MAX_KERNINGS )
+        g_hash_table_remove_all ( table );
+      ret= g_new ( GlyphsKerning, 1 );
+      ret->key= key;
+      ret->value= TTF_GetFontKerningSizeGlyphs32
+        ( g->_fonts->_fonts[font][style], prev, ch );
+      g_hash_table_insert ( table, &(ret->key), ret );
+    }
+  
+  return ret->value;
+  
+} // end glyphs_get_kerning
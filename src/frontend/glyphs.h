@@ -0,0 +1,105 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  glyphs.h - Atles de glifs pre-renderitzats.
+ *
+ *  Cada glif es renderitza una única vegada per font, estil i
+ *  caràcter, i es desa com la cobertura (alfa) de la seua tinta. Per
+ *  a pintar text es compon la cobertura amb el color del text sobre
+ *  el que ja hi ha en el framebuffer, de manera que la tinta que
+ *  sobreïx de la cel·la del caràcter (cursiva, kerning negatiu) no
+ *  es perd.
+ *
+ */
+
+#ifndef __FRONTEND__GLYPHS_H__
+#define __FRONTEND__GLYPHS_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stdint.h>
+
+#include "fonts.h"
+
+typedef struct
+{
+  gint64   key;     // Codi de caràcter.
+  int      advance; // Avanç en píxels.
+  int      x0;      // Desplaçament de la tinta respecte a l'origen.
+  int      w;       // Amplària de la tinta (pot ser 0).
+  int      h;       // Files de la tinta (com a molt l'alçada de línia).
+  uint8_t *alpha;   // w x h valors de cobertura.
+} Glyph;
+
+typedef struct
+{
+  gint64 key;   // Parella de caràcters.
+  int    value; // Ajust en píxels.
+} GlyphsKerning;
+
+typedef struct
+{
+
+  // CAMPS PRIVATS.
+  Fonts        *_fonts; // No s'allibera
+  int           _height;
+  GHashTable   *_glyphs[F_NUM_FONTS][F_NUM_STYLES];
+  bool          _use_kerning[F_NUM_FONTS][F_NUM_STYLES];
+  GHashTable   *_kerning[F_NUM_FONTS][F_NUM_STYLES];
+  
+} Glyphs;
+
+void
+glyphs_free (
+             Glyphs *g
+             );
+
+// 'height' és l'altura en píxels de tots els glifs (alçada de
+// línia).
+Glyphs *
+glyphs_new (
+            Fonts     *fonts,
+            const int  height
+            );
+
+// Torna el glif del caràcter Unicode 'ch', renderitzant-lo si no
+// està en l'atles. Torna NULL en cas d'error. El punter és vàlid
+// fins a la següent crida.
+const Glyph *
+glyphs_get (
+            Glyphs          *g,
+            const int        font,
+            const int        style,
+            const uint32_t   ch,
+            char           **err
+            );
+
+// Torna l'ajust en píxels (kerning) que cal aplicar a la posició de
+// 'ch' quan va just després de 'prev'. Si 'prev' és 0 torna 0.
+int
+glyphs_get_kerning (
+                    Glyphs         *g,
+                    const int       font,
+                    const int       style,
+                    const uint32_t  prev,
+                    const uint32_t  ch
+                    );
+
+#endif // __FRONTEND__GLYPHS_H__
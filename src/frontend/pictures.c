@@ -0,0 +1,509 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  pictures.c - Implementació de 'pictures.h'.
+ *
+ */
+
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <SDL.h>
+#include <SDL_image.h>
+
+#include "pictures.h"
+#include "utils/error.h"
+#include "utils/log.h"
+
+
+
+
+/*********/
+/* TIPUS */
+/*********/
+
+struct _PicturesEntry
+{
+  uint32_t       resource;
+  enum {
+    ENTRY_QUEUED,   // En la cua del fil auxiliar
+    ENTRY_DECODING, // Algú l'està descodificant
+    ENTRY_READY,    // En la llista LRU
+    ENTRY_FAILED
+  }              state;
+  SDL_Surface   *surface;
+  size_t         bytes;
+  PicturesEntry *prev;
+  PicturesEntry *next;
+};
+
+
+
+
+/*********************/
+/* FUNCIONS PRIVADES */
+/*********************/
+
+static void
+entry_free (
+            gpointer data
+            )
+{
+
+  PicturesEntry *e;
+
+
+  e= (PicturesEntry *) data;
+  if ( e->surface != NULL ) SDL_FreeSurface ( e->surface );
+  g_free ( e );
+  
+} // end entry_free
+
+
+static bool
+is_picture (
+            const Pictures *p,
+            const uint32_t  resource
+            )
+{
+
+  StoryFileResourceType type;
+  
+
+  if ( resource >= p->_sf->Nres ) return false;
+  type= p->_sf->resources[resource].type;
+  
+  return type == STORY_FILE_RESOURCE_PICTURE_PNG ||
+    type == STORY_FILE_RESOURCE_PICTURE_JPEG ||
+    type == STORY_FILE_RESOURCE_PICTURE_PLACEHOLDER;
+  
+} // end is_picture
+
+
+// Es crida sense '_mutex'. Descodifica directament des del fitxer
+// projectat. Torna NULL en cas d'error (vegeu SDL_GetError).
+static SDL_Surface *
+decode (
+        Pictures       *p,
+        const uint32_t  resource
+        )
+{
+
+  const uint8_t *data;
+  size_t size;
+  SDL_RWops *rw;
+  SDL_Surface *ret;
+  int w,h;
+  
+  
+  data= story_file_get_resource ( p->_sf, resource, &size );
+  
+  // Els 'placeholders' sols tenen amplària i altura. Es representen
+  // com una imatge transparent.
+  if ( p->_sf->resources[resource].type ==
+       STORY_FILE_RESOURCE_PICTURE_PLACEHOLDER )
+    {
+      if ( size < 8 )
+        {
+          SDL_SetError ( "invalid placeholder size" );
+          return NULL;
+        }
+      w= (int) ((((uint32_t) data[0])<<24) | (((uint32_t) data[1])<<16) |
+                (((uint32_t) data[2])<<8) | ((uint32_t) data[3]));
+      h= (int) ((((uint32_t) data[4])<<24) | (((uint32_t) data[5])<<16) |
+                (((uint32_t) data[6])<<8) | ((uint32_t) data[7]));
+      return SDL_CreateRGBSurfaceWithFormat ( 0, w, h, 32,
+                                              SDL_PIXELFORMAT_RGBA32 );
+    }
+
+  // PNG i JPEG.
+  rw= SDL_RWFromConstMem ( data, (int) size );
+  if ( rw == NULL ) return NULL;
+  ret= IMG_Load_RW ( rw, 1 );
+  
+  return ret;
+  
+} // end decode
+
+
+// Es crida amb '_mutex'.
+static void
+lru_remove (
+            Pictures      *p,
+            PicturesEntry *e
+            )
+{
+
+  if ( e->prev != NULL ) e->prev->next= e->next;
+  else                   p->_first= e->next;
+  if ( e->next != NULL ) e->next->prev= e->prev;
+  else                   p->_last= e->prev;
+  e->prev= e->next= NULL;
+  
+} // end lru_remove
+
+
+// Es crida amb '_mutex'.
+static void
+lru_push_front (
+                Pictures      *p,
+                PicturesEntry *e
+                )
+{
+
+  e->prev= NULL;
+  e->next= p->_first;
+  if ( p->_first != NULL ) p->_first->prev= e;
+  else                     p->_last= e;
+  p->_first= e;
+  
+} // end lru_push_front
+
+
+// Es crida amb '_mutex'. Anota el resultat de descodificar l'entrada
+// i descarta les imatges menys utilitzades si no hi ha espai. L'última
+// imatge mai es descarta.
+static void
+set_decoded (
+             Pictures      *p,
+             PicturesEntry *e,
+             SDL_Surface   *surface,
+             const gint64   time
+             )
+{
+
+  PicturesEntry *old;
+  
+  
+  p->_stats.decode_time+= time;
+  if ( surface == NULL )
+    {
+      e->state= ENTRY_FAILED;
+      return;
+    }
+  e->state= ENTRY_READY;
+  e->surface= surface;
+  e->bytes= (size_t) surface->pitch * (size_t) surface->h;
+  p->_bytes+= e->bytes;
+  lru_push_front ( p, e );
+  while ( p->_bytes > p->_max_bytes && p->_last != e )
+    {
+      old= p->_last;
+      lru_remove ( p, old );
+      p->_bytes-= old->bytes;
+      ++(p->_stats.evictions);
+      g_hash_table_remove ( p->_entries, GUINT_TO_POINTER ( old->resource ) );
+    }
+  
+} // end set_decoded
+
+
+static gpointer
+worker_run (
+            gpointer data
+            )
+{
+
+  Pictures *p;
+  PicturesEntry *e;
+  SDL_Surface *surface;
+  uint32_t resource;
+  gint64 t0;
+  
+  
+  p= (Pictures *) data;
+  g_mutex_lock ( &(p->_mutex) );
+  for (;;)
+    {
+
+      // Espera.
+      while ( !p->_quit && p->_queue.N == 0 )
+        g_cond_wait ( &(p->_cond), &(p->_mutex) );
+      if ( p->_quit ) break;
+      resource= p->_queue.v[p->_queue.beg];
+      p->_queue.beg= (p->_queue.beg+1)%p->_queue.size;
+      --(p->_queue.N);
+
+      // Si ningú l'ha agafada la descodifica.
+      e= g_hash_table_lookup ( p->_entries, GUINT_TO_POINTER ( resource ) );
+      if ( e == NULL || e->state != ENTRY_QUEUED ) continue;
+      e->state= ENTRY_DECODING;
+      g_mutex_unlock ( &(p->_mutex) );
+      t0= g_get_monotonic_time ();
+      surface= decode ( p, resource );
+      if ( surface == NULL )
+        ww ( "Failed to decode picture %u: %s", resource, SDL_GetError () );
+      t0= g_get_monotonic_time () - t0;
+      g_mutex_lock ( &(p->_mutex) );
+      set_decoded ( p, e, surface, t0 );
+      ++(p->_stats.prefetched);
+      g_cond_broadcast ( &(p->_cond) );
+      
+    }
+  g_mutex_unlock ( &(p->_mutex) );
+  
+  return NULL;
+  
+} // end worker_run
+
+
+// Es crida amb '_mutex'.
+static void
+queue_push (
+            Pictures       *p,
+            const uint32_t  resource
+            )
+{
+
+  size_t nsize,i;
+  uint32_t *v;
+  
+
+  if ( p->_queue.N == p->_queue.size )
+    {
+      nsize= p->_queue.size*2;
+      v= g_new ( uint32_t, nsize );
+      for ( i= 0; i < p->_queue.N; ++i )
+        v[i]= p->_queue.v[(p->_queue.beg+i)%p->_queue.size];
+      g_free ( p->_queue.v );
+      p->_queue.v= v;
+      p->_queue.size= nsize;
+      p->_queue.beg= 0;
+    }
+  p->_queue.v[(p->_queue.beg+p->_queue.N)%p->_queue.size]= resource;
+  ++(p->_queue.N);
+  
+} // end queue_push
+
+
+
+
+/**********************/
+/* FUNCIONS PÚBLIQUES */
+/**********************/
+
+void
+pictures_free (
+               Pictures *p
+               )
+{
+
+  // Para el fil.
+  if ( p->_thread != NULL )
+    {
+      g_mutex_lock ( &(p->_mutex) );
+      p->_quit= true;
+      g_cond_broadcast ( &(p->_cond) );
+      g_mutex_unlock ( &(p->_mutex) );
+      g_thread_join ( p->_thread );
+    }
+
+  if ( p->_verbose )
+    ii ( "Pictures: %lu hits, %lu misses, %lu prefetched, %lu evicted,"
+         " %.3f ms decoding",
+         (unsigned long) p->_stats.hits, (unsigned long) p->_stats.misses,
+         (unsigned long) p->_stats.prefetched,
+         (unsigned long) p->_stats.evictions,
+         p->_stats.decode_time/1000.0 );
+  
+  g_hash_table_destroy ( p->_entries );
+  g_free ( p->_queue.v );
+  g_cond_clear ( &(p->_cond) );
+  g_mutex_clear ( &(p->_mutex) );
+  g_free ( p );
+  
+} // end pictures_free
+
+
+Pictures *
+pictures_new (
+              StoryFile     *sf,
+              const size_t   max_bytes,
+              const bool     verbose
+              )
+{
+
+  Pictures *ret;
+
+
+  ret= g_new ( Pictures, 1 );
+  ret->_sf= sf;
+  ret->_verbose= verbose;
+  ret->_max_bytes= max_bytes;
+  ret->_bytes= 0;
+  ret->_entries= g_hash_table_new_full ( g_direct_hash, g_direct_equal,
+                                         NULL, entry_free );
+  ret->_first= ret->_last= NULL;
+  memset ( &(ret->_stats), 0, sizeof(ret->_stats) );
+  ret->_thread= NULL;
+  g_mutex_init ( &(ret->_mutex) );
+  g_cond_init ( &(ret->_cond) );
+  ret->_quit= false;
+  ret->_queue.size= 16;
+  ret->_queue.v= g_new ( uint32_t, ret->_queue.size );
+  ret->_queue.beg= 0;
+  ret->_queue.N= 0;
+  
+  return ret;
+  
+} // end pictures_new
+
+
+void
+pictures_prefetch (
+                   Pictures       *p,
+                   const uint32_t  resource
+                   )
+{
+
+  PicturesEntry *e;
+  
+
+  if ( !is_picture ( p, resource ) ) return;
+  g_mutex_lock ( &(p->_mutex) );
+  if ( g_hash_table_lookup ( p->_entries,
+                             GUINT_TO_POINTER ( resource ) ) == NULL )
+    {
+      if ( p->_thread == NULL )
+        p->_thread= g_thread_new ( "pictures", worker_run, p );
+      e= g_new0 ( PicturesEntry, 1 );
+      e->resource= resource;
+      e->state= ENTRY_QUEUED;
+      g_hash_table_insert ( p->_entries, GUINT_TO_POINTER ( resource ), e );
+      queue_push ( p, resource );
+      g_cond_broadcast ( &(p->_cond) );
+    }
+  g_mutex_unlock ( &(p->_mutex) );
+  
+} // end pictures_prefetch
+
+
+SDL_Surface *
+pictures_get (
+              Pictures        *p,
+              const uint32_t   resource,
+              char           **err
+              )
+{
+
+  PicturesEntry *e;
+  SDL_Surface *ret;
+  gint64 t0;
+  
+  
+  if ( !is_picture ( p, resource ) )
+    {
+      msgerror ( err, "Resource %u is not a picture", resource );
+      return NULL;
+    }
+  
+  g_mutex_lock ( &(p->_mutex) );
+  e= g_hash_table_lookup ( p->_entries, GUINT_TO_POINTER ( resource ) );
+
+  // L'està descodificant el fil auxiliar.
+  while ( e != NULL && e->state == ENTRY_DECODING )
+    {
+      g_cond_wait ( &(p->_cond), &(p->_mutex) );
+      e= g_hash_table_lookup ( p->_entries, GUINT_TO_POINTER ( resource ) );
+    }
+
+  // Ja està.
+  if ( e != NULL && e->state == ENTRY_READY )
+    {
+      ++(p->_stats.hits);
+      lru_remove ( p, e );
+      lru_push_front ( p, e );
+    }
+
+  // Cal descodificar-la ací.
+  else if ( e == NULL || e->state == ENTRY_QUEUED )
+    {
+      ++(p->_stats.misses);
+      if ( e == NULL )
+        {
+          e= g_new0 ( PicturesEntry, 1 );
+          e->resource= resource;
+          g_hash_table_insert ( p->_entries,
+                                GUINT_TO_POINTER ( resource ), e );
+        }
+      e->state= ENTRY_DECODING;
+      g_mutex_unlock ( &(p->_mutex) );
+      t0= g_get_monotonic_time ();
+      ret= decode ( p, resource );
+      if ( ret == NULL )
+        msgerror ( err, "Failed to decode picture %u: %s",
+                   resource, SDL_GetError () );
+      t0= g_get_monotonic_time () - t0;
+      g_mutex_lock ( &(p->_mutex) );
+      set_decoded ( p, e, ret, t0 );
+      g_cond_broadcast ( &(p->_cond) );
+      if ( ret == NULL )
+        {
+          g_mutex_unlock ( &(p->_mutex) );
+          return NULL;
+        }
+    }
+  
+  // Error anterior.
+  if ( e->state == ENTRY_FAILED )
+    {
+      g_mutex_unlock ( &(p->_mutex) );
+      msgerror ( err, "Failed to decode picture %u", resource );
+      return NULL;
+    }
+  ret= e->surface;
+  ++(ret->refcount);
+  g_mutex_unlock ( &(p->_mutex) );
+  
+  return ret;
+  
+} // end pictures_get
+
+
+void
+pictures_release (
+                  Pictures    *p,
+                  SDL_Surface *surface
+                  )
+{
+
+  g_mutex_lock ( &(p->_mutex) );
+  SDL_FreeSurface ( surface );
+  g_mutex_unlock ( &(p->_mutex) );
+  
+} // end pictures_release
+
+
+void
+pictures_get_stats (
+                    Pictures      *p,
+                    PicturesStats *stats
+                    )
+{
+
+  g_mutex_lock ( &(p->_mutex) );
+  *stats= p->_stats;
+  g_mutex_unlock ( &(p->_mutex) );
+  
+} // end pictures_get_stats
@@ -0,0 +1,124 @@
+/*
+ * Copyright 2023 Adrià Giménez Pastor.
+ *
+ * This file is part of adriagipas/run-zcode.
+ *
+ * adriagipas/run-zcode is free software: you can redistribute it and/or
+ * modify it under the terms of the GNU General Public License as
+ * published by the Free Software Foundation, either version 3 of the
+ * License, or (at your option) any later version.
+ *
+ * adriagipas/run-zcode is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with adriagipas/run-zcode.  If not, see
+ * <https://www.gnu.org/licenses/>.
+ */
+/*
+ *  pictures.h - Cache d'imatges descodificades.
+ *
+ *  Les imatges dels 'resources' del story file es descodifiquen com a
+ *  SDL_Surface i es mantenen en una cache LRU limitada en bytes. Un
+ *  fil auxiliar pot descodificar per avançat les imatges que es
+ *  necessitaran.
+ *
+ */
+
+#ifndef __FRONTEND__PICTURES_H__
+#define __FRONTEND__PICTURES_H__
+
+#include <glib.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <SDL.h>
+
+#include "core/story_file.h"
+
+typedef struct
+{
+  uint64_t hits;        // Imatges ja descodificades en demanar-les
+  uint64_t misses;      // Imatges descodificades en demanar-les
+  uint64_t prefetched;  // Imatges descodificades pel fil auxiliar
+  uint64_t evictions;   // Imatges descartades per falta d'espai
+  gint64   decode_time; // Temps total descodificant (microsegons)
+} PicturesStats;
+
+typedef struct _PicturesEntry PicturesEntry;
+
+typedef struct
+{
+
+  // CAMPS PRIVATS.
+  StoryFile     *_sf; // No s'allibera
+  bool           _verbose;
+  size_t         _max_bytes;
+  size_t         _bytes;   // Bytes de les imatges en la cache
+  GHashTable    *_entries; // Resource -> PicturesEntry
+  PicturesEntry *_first;   // Llista LRU, primer la més recent
+  PicturesEntry *_last;
+  PicturesStats  _stats;
+
+  // Fil auxiliar. Tot està protegit per '_mutex'.
+  GThread       *_thread; // NULL fins que es demana una imatge
+  GMutex         _mutex;
+  GCond          _cond;
+  bool           _quit;
+  struct
+  {
+    uint32_t *v;
+    size_t    size;
+    size_t    beg;
+    size_t    N;
+  }              _queue; // Resources pendents de descodificar
+  
+} Pictures;
+
+void
+pictures_free (
+               Pictures *p
+               );
+
+// 'max_bytes' és el màxim de memòria que poden ocupar les imatges
+// descodificades.
+Pictures *
+pictures_new (
+              StoryFile     *sf,
+              const size_t   max_bytes,
+              const bool     verbose
+              );
+
+// Demana que es descodifique el resource en el fil auxiliar. No fa
+// res si ja està en la cache o no és una imatge.
+void
+pictures_prefetch (
+                   Pictures       *p,
+                   const uint32_t  resource
+                   );
+
+// Torna la imatge del resource, descodificant-la si cal (o esperant
+// al fil auxiliar si ja l'està descodificant). Torna NULL en cas
+// d'error. La imatge s'ha d'alliberar amb 'pictures_release'.
+SDL_Surface *
+pictures_get (
+              Pictures        *p,
+              const uint32_t   resource,
+              char           **err
+              );
+
+void
+pictures_release (
+                  Pictures    *p,
+                  SDL_Surface *surface
+                  );
+
+void
+pictures_get_stats (
+                    Pictures      *p,
+                    PicturesStats *stats
+                    );
+
+#endif // __FRONTEND__PICTURES_H__
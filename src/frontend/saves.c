@@ -23,8 +23,6 @@
  */
 
 
-#include <assert.h>
-#include <errno.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <libintl.h>
@@ -33,7 +31,6 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
-#include <unistd.h>
 
 #include "saves.h"
 #include "utils/log.h"
@@ -50,8 +47,6 @@
 
 #define NSLOTS 5
 
-#define TIME_SLEEP 10000
-
 
 
 
@@ -59,27 +54,6 @@
 /* FUNCIONS PRIVADES */
 /*********************/
 
-static void
-remove_undo_fn (
-                Saves     *s,
-                const int  n
-                )
-{
-
-  assert ( s->_undo_fn[n] != NULL );
-  
-  if ( s->_verbose )
-    ii ( "Removing undo save file: '%s'", s->_undo_fn[n] );
-  errno= 0;
-  if ( remove ( s->_undo_fn[n] ) != 0 )
-    ww ( "Failed to remove '%s': %s",
-         s->_undo_fn[n], errno!=0 ? strerror ( errno ) : "unknown error" );
-  g_free ( s->_undo_fn[n] );
-  s->_undo_fn[n]= NULL;
-  
-} // end remove_undo_fn
-
-
 // Obté el nom del fitxer. S'ha d'esborrar
 static gchar *
 get_save_slot_name (
@@ -230,9 +204,11 @@ select_save_slot (
   do {
     if ( !screen_read_char ( screen, buf, &nread, err ) )
       return -1;
-    g_usleep ( TIME_SLEEP );
-  } while ( nread == 0 );
-  if ( nread == 1 )
+    if ( nread == 0 ) screen_wait_input ( screen, -1 );
+  } while ( nread == 0 && !screen_INPUT_FINISHED ( screen ) );
+  // NOTA!!! Quan es llig d'un fitxer el caràcter ve seguit del retorn
+  // de carro.
+  if ( nread >= 1 )
     {
       zc= buf[0];
       if ( zc >= '1' && zc <= ('0'+NSLOTS) )
@@ -259,17 +235,8 @@ saves_free (
             Saves *s
             )
 {
-
-  int n;
-
-
+  
   g_free ( s->_savedir );
-  for ( n= 0; n < SAVES_MAX_UNDO; ++n )
-    if ( s->_undo_fn[n] != NULL )
-      {
-        remove_undo_fn ( s, n );
-        g_free ( s->_undo_fn[n] );
-      }
   g_free ( s );
   
 } // end saves_free
@@ -282,16 +249,11 @@ saves_new (
 {
 
   Saves *ret;
-  int n;
   
   
   // Prepara.
   ret= g_new ( Saves, 1 );
   ret->_verbose= verbose;
-  ret->_N_undo= 0;
-  ret->_pos= 0;
-  for ( n= 0; n < SAVES_MAX_UNDO; ++n )
-    ret->_undo_fn[n]= NULL;
   ret->_savedir= NULL;
 
   // Savedir
@@ -305,107 +267,6 @@ saves_new (
 } // end saves_new
 
 
-const gchar *
-saves_get_new_undo_file_name (
-                              Saves  *s,
-                              char  **err
-                              )
-{
-
-  GString *buffer;
-  GDateTime *dt;
-  gchar *time_str;
-  int pos;
-  
-  
-  // Comprova queda espai, si no esborra
-  if ( s->_N_undo == SAVES_MAX_UNDO )
-    {
-      remove_undo_fn ( s, s->_pos );
-      --(s->_N_undo);
-      s->_pos= (s->_pos+1)%SAVES_MAX_UNDO;
-    }
-  
-  // Prepara.
-  buffer= NULL;
-  dt= NULL;
-  time_str= NULL;
-  
-  // Crea el nom del fitxer.
-  buffer= g_string_new ( NULL );
-  dt= g_date_time_new_now_local ();
-  if ( dt == NULL )
-    {
-      msgerror ( err,
-                 "Failed to build undo file name. Error occurred while"
-                 " calling g_date_time_new_now_local" );
-      goto error;
-    }
-  time_str= g_date_time_format_iso8601 ( dt );
-  g_date_time_unref ( dt ); dt= NULL;
-  g_string_printf ( buffer, "%s/run_zcode-undo-%d-%s.sav%d",
-                    g_get_tmp_dir (),
-                    getpid (),
-                    time_str,
-                    s->_N_undo );
-  g_free ( time_str ); time_str= NULL;
-
-  // Desa el nom del fitxer.
-  pos= (s->_pos + s->_N_undo)%SAVES_MAX_UNDO;
-  s->_undo_fn[pos]= buffer->str;
-  ++(s->_N_undo);
-  g_string_free ( buffer, FALSE );
-  
-  return s->_undo_fn[pos];
-  
- error:
-  if ( buffer != NULL ) g_string_free ( buffer, TRUE );
-  if ( dt != NULL ) g_date_time_unref ( dt );
-  g_free ( time_str );
-  return NULL;
-  
-} // end saves_get_new_undo_file_name
-
-
-const gchar *
-saves_get_undo_file_name (
-                          Saves  *s
-                          )
-{
-
-  int pos;
-
-  
-  if ( s->_N_undo == 0 )
-    return NULL;
-  else
-    {
-      pos= (s->_pos + s->_N_undo - 1)%SAVES_MAX_UNDO;
-      return s->_undo_fn[pos];
-    }
-  
-} // end saves_get_undo_file_name
-
-
-void
-saves_remove_last_undo_file_name (
-                                  Saves *s
-                                  )
-{
-
-  int pos;
-
-  
-  if ( s->_N_undo > 0 )
-    {
-      --(s->_N_undo);
-      pos= (s->_pos + s->_N_undo)%SAVES_MAX_UNDO;
-      remove_undo_fn ( s, pos );
-    }
-  
-} // end saves_remove_undo_file_name
-
-
 gchar *
 saves_get_save_file_name (
                           Saves       *s,
@@ -32,16 +32,11 @@
 
 #include "screen.h"
 
-#define SAVES_MAX_UNDO 10
-
 typedef struct
 {
 
   // TOT PRIVAT!!
   gboolean  _verbose;
-  gchar    *_undo_fn[SAVES_MAX_UNDO];
-  int       _N_undo;
-  int       _pos; // Principi de la llista
   gchar    *_savedir;
   
 } Saves;
@@ -56,27 +51,6 @@ saves_new (
            const gboolean verbose
            );
 
-// NULL en cas d'error. Si està ple esborra la més antiga.
-const gchar *
-saves_get_new_undo_file_name (
-                              Saves  *s,
-                              char  **err
-                              );
-
-// Torna l'últim undo fet, però no l'esborra. Podria torna NULL si no
-// s'ha cridat abans a saves_get_new_undo_file_name
-const gchar *
-saves_get_undo_file_name (
-                          Saves  *s
-                          );
-
-// Elimina l'últim fitxer undo. S'ha de cridar sabent que hi ha un
-// fitxer.
-void
-saves_remove_last_undo_file_name (
-                                  Saves *s
-                                  );
-
 // NULL en cas d'error. S'ha d'alliberar memòria. La pantalla és on es
 // va a preguntar a l'usuari.
 gchar *
@@ -31,7 +31,6 @@
 #include <stdlib.h>
 #include <string.h>
 #include <SDL.h>
-#include <SDL_image.h>
 #include <SDL_ttf.h>
 
 #include "screen.h"
@@ -87,19 +86,169 @@ true_color_to_u32 (
 } // end true_color_to_u32
 
 
+// Marca com a modificada una regió de '_fb'.
 static void
-true_color_to_sdlcolor (
-                        const uint16_t  color,
-                        SDL_Color      *ret
-                        )
+mark_dirty_fb (
+               Screen    *s,
+               const int  x,
+               const int  y,
+               const int  w,
+               const int  h
+               )
+{
+
+  SDL_Rect rect,*r;
+  int i;
+  
+  
+  if ( w <= 0 || h <= 0 ) return;
+  rect.x= x; rect.y= y; rect.w= w; rect.h= h;
+
+  // Intenta ajuntar-la amb una regió que ocupe les mateixes files, o
+  // que ja la continga.
+  for ( i= 0; i < s->_dirty.N; ++i )
+    {
+      r= &(s->_dirty.rects[i]);
+      if ( (r->y == y && r->h == h && x <= r->x+r->w && r->x <= x+w) ||
+           (x >= r->x && x+w <= r->x+r->w && y >= r->y && y+h <= r->y+r->h) )
+        {
+          SDL_UnionRect ( r, &rect, r );
+          return;
+        }
+    }
+
+  // Nova regió. Si no queda espai s'ajunten totes.
+  if ( s->_dirty.N == SCREEN_MAX_DIRTY )
+    {
+      r= &(s->_dirty.rects[0]);
+      for ( i= 1; i < s->_dirty.N; ++i )
+        SDL_UnionRect ( r, &(s->_dirty.rects[i]), r );
+      SDL_UnionRect ( r, &rect, r );
+      s->_dirty.N= 1;
+    }
+  else s->_dirty.rects[s->_dirty.N++]= rect;
+  
+} // end mark_dirty_fb
+
+
+// Com mark_dirty_fb però amb coordenades de '_fb_draw'.
+static void
+mark_dirty (
+            Screen    *s,
+            const int  x,
+            const int  y,
+            const int  w,
+            const int  h
+            )
+{
+  mark_dirty_fb ( s, x, y + (int) ((s->_fb_draw-s->_fb)/s->_width), w, h );
+} // end mark_dirty
+
+
+static void
+mark_all_dirty (
+                Screen *s
+                )
 {
 
-  ret->r= (color&0x1F)<<3;
-  ret->g= ((color>>5)&0x1F)<<3;
-  ret->b= ((color>>10)&0x1F)<<3;
-  ret->a= 0xff;
+  s->_dirty.rects[0].x= 0;
+  s->_dirty.rects[0].y= 0;
+  s->_dirty.rects[0].w= s->_width;
+  s->_dirty.rects[0].h= s->_height;
+  s->_dirty.N= 1;
   
-} // end true_color_to_sdlcolor
+} // end mark_all_dirty
+
+
+// Torna el punter a la primera fila de píxels de la línia 'line' (-1
+// és la línia d'estat). La finestra inferior és un buffer circular de
+// línies que comença en '_low_origin'.
+static uint32_t *
+line_ptr (
+          const Screen *s,
+          int           line
+          )
+{
+  
+  if ( line >= s->_upwin_lines && s->_low_origin != 0 )
+    line= s->_upwin_lines +
+      (line - s->_upwin_lines + s->_low_origin)%(s->_lines-s->_upwin_lines);
+  
+  return s->_fb_draw + line*s->_line_height*s->_width;
+  
+} // end line_ptr
+
+
+// Reordena les línies de la finestra inferior perquè '_low_origin'
+// torne a ser 0. Cal fer-ho abans de canviar la grandària de les
+// finestres.
+static void
+normalize_low (
+               Screen *s
+               )
+{
+
+  uint32_t *tmp;
+  size_t line_size;
+  int n,i;
+  
+
+  if ( s->_low_origin == 0 ) return;
+  n= s->_lines - s->_upwin_lines;
+  line_size= ((size_t) s->_line_height)*((size_t) s->_width);
+  tmp= g_new ( uint32_t, line_size*n );
+  for ( i= 0; i < n; ++i )
+    memcpy ( &(tmp[i*line_size]), line_ptr ( s, s->_upwin_lines+i ),
+             line_size*sizeof(uint32_t) );
+  memcpy ( s->_fb_draw + s->_upwin_lines*line_size, tmp,
+           n*line_size*sizeof(uint32_t) );
+  g_free ( tmp );
+  s->_low_origin= 0;
+  
+} // end normalize_low
+
+
+// Puja a la finestra una regió de la pantalla. Com la finestra
+// inferior és un buffer circular, la regió es divideix en trossos
+// contigus en memòria.
+static bool
+upload_rect (
+             Screen          *s,
+             const SDL_Rect  *r,
+             char           **err
+             )
+{
+
+  SDL_Rect chunk;
+  const uint32_t *pixels;
+  int off,y,end,line,next,line_size;
+  
+
+  off= (int) ((s->_fb_draw-s->_fb)/s->_width);
+  line_size= s->_line_height*s->_width;
+  chunk.x= r->x;
+  chunk.w= r->w;
+  end= r->y + r->h;
+  for ( y= r->y; y < end; y= next )
+    {
+      line= (y - off + s->_line_height)/s->_line_height - 1;
+      pixels= line_ptr ( s, line ) +
+        ((y-off) - line*s->_line_height)*s->_width + r->x;
+      next= (line+1)*s->_line_height + off;
+      for ( ; next < end && line+1 < s->_lines &&
+              line_ptr ( s, line+1 ) == line_ptr ( s, line ) + line_size;
+            ++line, next+= s->_line_height );
+      if ( next > end ) next= end;
+      chunk.y= y;
+      chunk.h= next - y;
+      if ( !window_update_rect ( s->_win, &chunk, pixels,
+                                 s->_width*sizeof(uint32_t), err ) )
+        return false;
+    }
+  
+  return true;
+  
+} // end upload_rect
 
 
 static bool
@@ -109,24 +258,24 @@ redraw_fb (
            )
 {
 
-  bool ret;
   Uint32 t;
+  int i;
   
 
-  if ( s->_fb_changed )
-    {
-      t= SDL_GetTicks ();
-      if ( t < s->_last_redraw_t || (t-s->_last_redraw_t) >= REPAINT_TICKS )
-        {
-          ret= window_update ( s->_win, s->_fb, err );
-          s->_last_redraw_t= t;
-          s->_fb_changed= false;
-        }
-      else ret= true;
-    }
-  else ret= true;
+  if ( s->_dirty.N == 0 ) return true;
+  t= SDL_GetTicks ();
+  if ( t >= s->_last_redraw_t && (t-s->_last_redraw_t) < REPAINT_TICKS )
+    return true;
+
+  // Si falla es conserven les regions per a tornar-ho a intentar.
+  for ( i= 0; i < s->_dirty.N; ++i )
+    if ( !upload_rect ( s, &(s->_dirty.rects[i]), err ) )
+      return false;
+  window_redraw ( s->_win );
+  s->_last_redraw_t= t;
+  s->_dirty.N= 0;
   
-  return ret;
+  return true;
   
 } // end redraw_fb
 
@@ -139,25 +288,23 @@ scroll_low (
 
   uint32_t *fb;
   uint32_t color;
-  size_t i,j,line_size,end;
+  size_t i,line_size;
 
   
-  fb= s->_fb_draw;
-
   assert ( s->_upwin_lines < s->_lines );
   
-  // Cópia amunt
-  line_size= ((size_t) s->_line_height)*((size_t) s->_width);
-  end= ((size_t) ((s->_lines-1))) * line_size;
-  for ( i= line_size*((size_t) s->_upwin_lines), j= i+line_size;
-        i < end;
-        ++i, ++j )
-    fb[i]= fb[j];
-
+  // Avança l'origen, la primera línia passa a ser l'última.
+  s->_low_origin= (s->_low_origin+1)%(s->_lines-s->_upwin_lines);
+  
   // Última línia
+  fb= line_ptr ( s, s->_lines-1 );
+  line_size= ((size_t) s->_line_height)*((size_t) s->_width);
   color= true_color_to_u32 ( s, s->_cursors[W_LOW].set_bg_color );
-  for ( i= end, j= 0; j < line_size; ++i, ++j )
+  for ( i= 0; i < line_size; ++i )
     fb[i]= color;
+
+  mark_dirty ( s, 0, s->_upwin_lines*s->_line_height, s->_width,
+               (s->_lines-s->_upwin_lines)*s->_line_height );
   
 } // end scroll_low
 
@@ -271,6 +418,7 @@ resize_cursor (
       return false;
     }
   c->text= g_renew ( char, c->text, nsize );
+  c->layout= g_renew ( ScreenLayoutChar, c->layout, nsize );
   c->size= nsize;
 
   return true;
@@ -302,84 +450,200 @@ resize_cursor_remain (
 } // end resize_cursor_remain
 
 
-static void
-draw_render_buf (
-                 Screen    *s,
-                 const int  x,
-                 const int  y,
-                 const int  width
-                 )
+// Descodifica el següent caràcter UTF-8 i avança el punter.
+static uint32_t
+utf8_next_char (
+                const char **p
+                )
 {
+
+  const uint8_t *q;
+  uint32_t ret;
+  int n;
+
+
+  q= (const uint8_t *) *p;
+  if ( *q < 0x80 )              { ret= *q; n= 0; }
+  else if ( (*q&0xE0) == 0xC0 ) { ret= *q&0x1F; n= 1; }
+  else if ( (*q&0xF0) == 0xE0 ) { ret= *q&0x0F; n= 2; }
+  else                          { ret= *q&0x07; n= 3; }
+  for ( ++q; n > 0 && ((*q)&0xC0) == 0x80; --n, ++q )
+    ret= (ret<<6) | ((*q)&0x3F);
+  *p= (const char *) q;
+  
+  return ret;
   
+} // end utf8_next_char
+
+
+// Ompli amb el color 'color' (true colour) 'width' píxels de la línia
+// que comença en (x,y).
+static void
+fill_line (
+           Screen         *s,
+           const int       x,
+           const int       line,
+           const int       width,
+           const uint16_t  color
+           )
+{
+
   uint32_t *fb;
-  int c,r,off;
-  const uint8_t *data;
-  const SDL_Surface *surface;
+  uint32_t val;
+  int r,c;
 
 
-  surface= s->_render_buf;
-  data= (const uint8_t *) (surface->pixels);
-  fb= s->_fb_draw;
-  off= y*s->_width + x;
-  for ( r= 0; r < surface->h; ++r )
+  if ( width <= 0 ) return;
+  val= true_color_to_u32 ( s, color );
+  fb= line_ptr ( s, line ) + x;
+  for ( r= 0; r < s->_line_height; ++r )
     {
       for ( c= 0; c < width; ++c )
-        fb[off + c]= ((const uint32_t *) data)[c];
-      off+= s->_width;
-      data+= surface->pitch;
+        fb[c]= val;
+      fb+= s->_width;
     }
+  mark_dirty ( s, x, line*s->_line_height, width, s->_line_height );
   
-} // end draw_render_buf
+} // end fill_line
+
+
+// Compon 'src' sobre 'dst' amb cobertura 'alpha'. Tots els canals
+// són de 8 bits, per tant es pot fer byte a byte sense conéixer el
+// format de la finestra (dos canals per operació).
+static inline uint32_t
+blend_pixel (
+             const uint32_t dst,
+             const uint32_t src,
+             const uint8_t  alpha
+             )
+{
+
+  uint32_t a,rb,ag;
 
 
-// Fa retrocedir els comptadors N i Nc d'acord amb el text que es
-// passa.
+  if ( alpha == 0 ) return dst;
+  if ( alpha == 0xff ) return src;
+  a= ((uint32_t) alpha) + (alpha>>7); // 0..256
+  rb= (((src&0x00FF00FF)*a + (dst&0x00FF00FF)*(256-a))>>8)&0x00FF00FF;
+  ag= (((src>>8)&0x00FF00FF)*a + ((dst>>8)&0x00FF00FF)*(256-a))&0xFF00FF00;
+  
+  return rb|ag;
+  
+} // end blend_pixel
+
+
+// Compon la tinta del glif amb el color 'color' (true colour) sobre
+// el que hi ha en el framebuffer. L'origen del glif és 'x'.
 static void
-rewind_utf8_chars (
-                   const char *text,
-                   const int   count,
-                   size_t     *N,
-                   size_t     *Nc
-                   )
+draw_glyph (
+            Screen         *s,
+            const Glyph    *glyph,
+            const int       x,
+            const int       line,
+            const uint16_t  color
+            )
 {
 
-  size_t l_Nc,l_N;
+  uint32_t *fb;
+  const uint8_t *alpha;
+  uint32_t val;
+  int r,c,beg,end;
+
+
+  beg= x + glyph->x0;
+  end= beg + glyph->w;
+  if ( beg < 0 ) beg= 0;
+  if ( end > s->_width ) end= s->_width;
+  if ( beg >= end || glyph->h == 0 ) return;
+  val= true_color_to_u32 ( s, color );
+  fb= line_ptr ( s, line );
+  alpha= glyph->alpha - (x + glyph->x0);
+  for ( r= 0; r < glyph->h; ++r )
+    {
+      for ( c= beg; c < end; ++c )
+        fb[c]= blend_pixel ( fb[c], val, alpha[c] );
+      fb+= s->_width;
+      alpha+= glyph->w;
+    }
+  mark_dirty ( s, beg, line*s->_line_height, end-beg, glyph->h );
+  
+} // end draw_glyph
+
+
+// Pinta els primers 'N' bytes de 'text' en la posició 'x' de la
+// línia 'line' amb glifs de l'atles: primer el fons de tot el text i
+// després la tinta. El que no cap en la línia es descarta. En
+// 'end_x' torna la posició on acaba el que s'ha pintat (el text o la
+// tinta que sobreïx).
+static bool
+draw_text (
+           Screen          *s,
+           const char      *text,
+           const size_t     N,
+           const int        font,
+           const int        style,
+           const uint16_t   fg_color,
+           const uint16_t   bg_color,
+           int              x,
+           const int        line,
+           int             *end_x,
+           char           **err
+           )
+{
 
+  const char *p,*end;
+  const Glyph *glyph;
+  int xe,ink;
   
-  l_N= *N;
-  l_Nc= *Nc;
-  while ( count < l_Nc )
+
+  // Fons.
+  end= text + N;
+  ink= x;
+  for ( p= text, xe= x; p < end && xe < s->_width; xe+= glyph->advance )
     {
-      if ( (text[--l_N]&0xC0) != 0x80 )
-        --l_Nc;
+      glyph= glyphs_get ( s->_glyphs, font, style,
+                          utf8_next_char ( &p ), err );
+      if ( glyph == NULL ) return false;
+      if ( glyph->w > 0 && xe + glyph->x0 + glyph->w > ink )
+        ink= xe + glyph->x0 + glyph->w;
     }
-  *N= l_N;
-  *Nc= l_Nc;
+  if ( xe > ink ) ink= xe;
+  if ( ink > s->_width ) ink= s->_width;
+  fill_line ( s, x, line, ink-x, bg_color );
+
+  // Tinta.
+  for ( p= text; p < end && x < s->_width; x+= glyph->advance )
+    {
+      glyph= glyphs_get ( s->_glyphs, font, style,
+                          utf8_next_char ( &p ), err );
+      if ( glyph == NULL ) return false;
+      draw_glyph ( s, glyph, x, line, fg_color );
+    }
+  *end_x= ink;
+  
+  return true;
   
-} // end rewind_utf_chars
+} // end draw_text
 
 
+// Fa retrocedir fins a l'últim espai a partir del caràcter 'Nc'
+// (inclòs), sense passar de 'old_Nc'. Torna false si no hi ha cap
+// espai.
 static bool
 rewind_to_space (
-                 const char   *text,
-                 const size_t  old_N,
-                 size_t       *N,
-                 size_t       *Nc
+                 const ScreenCursor *c,
+                 const size_t        old_Nc,
+                 size_t             *N,
+                 size_t             *Nc
                  )
 {
 
-  size_t l_Nc,l_N;
+  size_t l_Nc;
 
   
-  l_N= *N;
-  l_Nc= *Nc;
-  while ( l_N > old_N && text[l_N] != ' ' )
-    {
-      if ( (text[--l_N]&0xC0) != 0x80 )
-        --l_Nc;
-    }
-  if ( l_N == old_N ) return false;
-  *N= l_N;
+  for ( l_Nc= *Nc; l_Nc > old_Nc && c->layout[l_Nc].ch != ' '; --l_Nc );
+  if ( l_Nc == old_Nc ) return false;
+  *N= c->layout[l_Nc].off;
   *Nc= l_Nc;
   
   return true;
@@ -422,35 +686,25 @@ more (
       )
 {
 
-  const gulong MORE_SLEEP= 10000; // 10 milisegons
-  
-  SDL_Surface *surface;
-  SDL_Color color;
-  uint32_t bg_color;
-  SDL_Rect rect;
   uint8_t buf[SCREEN_INPUT_TEXT_BUF];
-  int nread;
+  int nread,x;
   
 
+  // Quan l'entrada es llig d'un fitxer no s'espera.
+  if ( s->_input.f != NULL )
+    {
+      s->_more_counter= 0;
+      return true;
+    }
+  
   // Marca per a poder desfer el canvi d'imprimir.
   screen_set_undo_mark ( s );
 
-  // Renderitza text.
-  surface= NULL;
-  true_color_to_sdlcolor ( c->fg_color, &color );
-  surface= TTF_RenderUTF8_Blended
-    ( s->_fonts->_fonts[c->font][c->style], _("[MORE]"), color );
-  if ( surface == NULL ) goto error_render_sdl;
-  bg_color= true_color_to_u32 ( s, c->bg_color );
-  rect.x= 0; rect.w= s->_width;
-  rect.y= 0; rect.h= s->_line_height;
-  if ( SDL_FillRect ( s->_render_buf, &rect, (Uint32) bg_color ) != 0 )
-    goto error_render_sdl;
-  if ( SDL_BlitSurface ( surface, NULL, s->_render_buf, &rect ) != 0 )
-    goto error_render_sdl;
-  draw_render_buf ( s, c->x, c->line*s->_line_height, s->_width );
-  SDL_FreeSurface ( surface ); surface= NULL;
-  s->_fb_changed= true;
+  // Pinta text.
+  if ( !draw_text ( s, _("[MORE]"), strlen ( _("[MORE]") ), c->font, c->style,
+                    c->fg_color, c->bg_color, c->x, c->line, &x, err ) )
+    return false;
+  fill_line ( s, x, c->line, s->_width-x, c->bg_color );
   if ( !redraw_fb ( s, err ) ) return false;
       
   // Espera
@@ -458,10 +712,9 @@ more (
     
     if ( !screen_read_char ( s, buf, &nread, err ) )
       return false;
+    if ( nread == 0 ) screen_wait_input ( s, -1 );
     
-    g_usleep ( MORE_SLEEP );
-    
-  } while ( nread == 0);
+  } while ( nread == 0 );
 
   // Torna a l'estat anterior.
   screen_undo ( s );
@@ -470,11 +723,6 @@ more (
   s->_more_counter= 0;
   
   return true;
-
- error_render_sdl:
-  msgerror ( err, "Failed to render [MORE]: %s", SDL_GetError () );
-  if ( surface != NULL ) SDL_FreeSurface ( surface );
-  return false;
   
 } // end more
 
@@ -491,13 +739,11 @@ print_line (
 {
 
   ScreenCursor *c;
+  ScreenLayoutChar *l;
   const char *p,*remain;
-  size_t new_N,new_Nc;
-  int extent,count,draw_w,new_width;
-  SDL_Surface *surface;
-  SDL_Color color;
-  uint32_t bg_color;
-  SDL_Rect rect;
+  const Glyph *glyph;
+  size_t new_N,new_Nc,i;
+  int count,end,ink,x,new_width;
   
   
   // Prepara.
@@ -544,26 +790,37 @@ print_line (
       if ( new_N == c->size ) { if ( !resize_cursor ( c, err ) ) return false; }
       c->text[new_N]= *p;
       
-      // Calcula si cap o no, i reajusta.
-      if ( TTF_MeasureUTF8 ( s->_fonts->_fonts[c->font][c->style], c->text,
-                             s->_width - c->x, &extent, &count ) )
-        goto error_render;
-      // NOTA!!!! TTF_MeasureUTF8 a vegades es ratlla i vols
-      // desdibuixar més caràcters dels que estem pintant ara (és a
-      // dir, coses que ha pintat ara diuen que no caben), per tal
-      // d'intentar solucionar açò vaig a forçar que count no supere
-      // mai a la longitut del text nou, independentment que amb
-      // buffering calga rebobinar més)
-      // NOTA!! MOLT ESTRANY, LA FULLA NO ACABA DE SOLUCIONAR-HO
+      // Calcula la disposició dels caràcters nous i quants caben. Els
+      // anteriors ja estan mesurats i pintats.
+      count= c->Nc;
+      end= count>0 ? c->layout[count-1].end : 0;
+      for ( p= &(c->text[c->N]); *p != '\0'; ++count )
+        {
+          l= &(c->layout[count]);
+          l->off= (size_t) (p-c->text);
+          l->ch= utf8_next_char ( &p );
+          glyph= glyphs_get ( s->_glyphs, c->font, c->style, l->ch, err );
+          if ( glyph == NULL ) return false;
+          l->x= end;
+          if ( count > 0 )
+            l->x+= glyphs_get_kerning ( s->_glyphs, c->font, c->style,
+                                        c->layout[count-1].ch, l->ch );
+          if ( c->x + l->x + glyph->advance > s->_width ) break;
+          end= l->end= l->x + glyph->advance;
+          ink= count>0 ? c->layout[count-1].ink : 0;
+          if ( end > ink ) ink= end;
+          if ( glyph->w > 0 && l->x + glyph->x0 + glyph->w > ink )
+            ink= l->x + glyph->x0 + glyph->w;
+          l->ink= c->x + ink > s->_width ? s->_width - c->x : ink;
+        }
       if ( count < new_Nc )
         {
-          if ( count < c->Nc ) count= c->Nc; // <-- FULLA
-          rewind_utf8_chars ( c->text, count, &new_N, &new_Nc );
-          assert ( count == new_Nc );
+          new_N= c->layout[count].off;
+          new_Nc= count;
           if ( c->buffered )
             {
               // Mou fins primer espai que pot ser l'últim impres
-              if ( !rewind_to_space ( c->text, c->N, &new_N, &new_Nc ) &&
+              if ( !rewind_to_space ( c, c->Nc, &new_N, &new_Nc ) &&
                    c->space )
                 { new_N= c->N; new_Nc= c->Nc; }
             }
@@ -574,30 +831,28 @@ print_line (
         }
       else remain= NULL;
       
-      // Renderitza
+      // Pinta sols els caràcters nous. El fons comença on acaba el
+      // que ja està pintat, de manera que cobreix els buits del
+      // kerning sense esborrar la tinta anterior que sobreïx, i
+      // després es compon la tinta dels caràcters nous.
       if ( count > 0 )
         {
-          // --> Renderitza text.
-          true_color_to_sdlcolor ( c->fg_color, &color );
-          surface= TTF_RenderUTF8_Blended
-            ( s->_fonts->_fonts[c->font][c->style], c->text, color );
-          if ( surface == NULL ) goto error_render;
-          // --> Ompli fons color
-          bg_color= true_color_to_u32 ( s, c->bg_color );
-          draw_w= remain!=NULL ? (s->_width-c->x) : surface->w;
-          if ( draw_w > s->_width ) draw_w= s->_width;
-          new_width= draw_w;
-          rect.x= 0; rect.w= draw_w;
-          rect.y= 0; rect.h= s->_line_height;
-          if ( SDL_FillRect ( s->_render_buf, &rect, (Uint32) bg_color ) != 0 )
-            goto error_render_sdl;
-          // --> Aplica text a surface
-          if ( SDL_BlitSurface ( surface, NULL, s->_render_buf, &rect ) != 0 )
-            goto error_render_sdl;
-          // --> Pinta
-          draw_render_buf ( s, c->x, c->line*s->_line_height, draw_w );
-          // --> Allibera memòria
-          SDL_FreeSurface ( surface );
+          x= c->x + (c->Nc>0 ? c->layout[c->Nc-1].ink : 0);
+          ink= c->x + (new_Nc>0 ? c->layout[new_Nc-1].ink : 0);
+          fill_line ( s, x, c->line, ink-x, c->bg_color );
+          for ( i= c->Nc; i < new_Nc; ++i )
+            {
+              l= &(c->layout[i]);
+              glyph= glyphs_get ( s->_glyphs, c->font, c->style, l->ch, err );
+              if ( glyph == NULL ) return false;
+              draw_glyph ( s, glyph, c->x + l->x, c->line, c->fg_color );
+            }
+          if ( remain != NULL )
+            {
+              fill_line ( s, ink, c->line, s->_width-ink, c->bg_color );
+              new_width= s->_width-c->x;
+            }
+          else new_width= new_Nc>0 ? c->layout[new_Nc-1].end : 0;
         }
       else new_width= c->width; // ???
 
@@ -622,13 +877,6 @@ print_line (
     }
   
   return true;
-
- error_render_sdl:
-  msgerror ( err, "Failed to render: %s", SDL_GetError () );
-  return false;
- error_render:
-  msgerror ( err, "Failed to render: %s", c->text );
-  return false;
   
 } // end print_line
 
@@ -768,6 +1016,7 @@ unsplit_window (
 {
 
   reset_cursor ( s, W_UP );
+  normalize_low ( s );
   s->_upwin_lines= 0;
   s->_current_win= W_LOW;
   
@@ -806,51 +1055,231 @@ erase_window (
   s->_cursors[window].Nc= 0;
 
   // Neteja
+  if ( s->_mode != SCREEN_SDL ) return;
+  if ( window == W_LOW ) s->_low_origin= 0;
   fb= s->_fb_draw;
   line_size= ((size_t) s->_line_height)*((size_t) s->_width);
   color= true_color_to_u32 ( s, s->_cursors[window].set_bg_color );
   for ( i= beg*line_size, r= beg; r != end; ++r )
     for ( j= 0; j < line_size; ++j, ++i )
       fb[i]= color;
+  mark_dirty ( s, 0, beg*s->_line_height, s->_width,
+               (end-beg)*s->_line_height );
   
 } // end erase_window
 
 
-// Torna NULL en cas d'error.
-static SDL_Surface *
-load_icon (
-           const uint8_t  *icon,
-           const size_t    icon_size,
-           char          **err
-           )
+// Genera en '_status_line' el text de la línia d'estat.
+static void
+format_status_line (
+                    Screen      *screen,
+                    const char  *text,
+                    const bool   is_score_game,
+                    const int    score_hours,
+                    const int    turns_minutes
+                    )
+{
+
+  const char *SCORE= "Score";
+  const char *TURNS= "Turns";
+  
+  int pos,count,remain,text_len;
+  
+  
+  // Càlcul espai necessari dreta
+  pos= 0;
+  if ( is_score_game )
+    {
+      // Text _ SCORE : _999 TURN : _9999
+      count= strlen ( SCORE ) + strlen ( TURNS ) +
+        4 + // : i espai
+        2 + // espai principi
+        3 + // score
+        4;  // turns
+      remain= screen->_width_chars-count;
+    }
+  else
+    {
+      // Text _ HH:MM
+      count= 1 + 2 + 1 + 2;
+      remain= screen->_width_chars-count;
+    }
+  // Còpia text
+  if ( remain >= 3 )
+    {
+      text_len= strlen ( text );
+      if ( text_len <= remain )
+        {
+          for ( ; pos < text_len; ++pos )
+            screen->_status_line[pos]= text[pos];
+          for ( ; pos < remain; ++pos )
+            screen->_status_line[pos]= ' ';
+        }
+      else
+        {
+          for ( ; pos < remain-3; ++pos )
+            screen->_status_line[pos]= text[pos];
+          screen->_status_line[pos++]= '.';
+          screen->_status_line[pos++]= '.';
+          screen->_status_line[pos++]= '.';
+        }
+    }
+  // Part dreta
+  if ( count <= screen->_width_chars )
+    {
+      if ( is_score_game )
+        {
+          sprintf ( &(screen->_status_line[pos]),
+                    " %s: %3d %s: %4d",
+                    SCORE, score_hours, TURNS, turns_minutes );
+          pos+= count;
+        }
+      else
+        {
+          sprintf ( &(screen->_status_line[pos]),
+                    " %02d:%02d", score_hours, turns_minutes );
+          pos+= count;
+        }
+    }
+  // Tanca
+  for ( ; pos < screen->_width_chars; ++pos )
+    screen->_status_line[pos]= ' ';
+  screen->_status_line[pos]= '\0';
+  
+} // end format_status_line
+
+
+static void
+dumb_append_json_string (
+                         GString    *buf,
+                         const char *text
+                         )
 {
 
-  SDL_RWops *rw;
-  SDL_Surface *ret;
+  const char *p;
   
+  
+  g_string_append_c ( buf, '"' );
+  for ( p= text; *p != '\0'; ++p )
+    switch ( *p )
+      {
+      case '"': g_string_append ( buf, "\\\"" ); break;
+      case '\\': g_string_append ( buf, "\\\\" ); break;
+      case '\n': g_string_append ( buf, "\\n" ); break;
+      case '\t': g_string_append ( buf, "\\t" ); break;
+      default:
+        if ( ((unsigned char) *p) < 0x20 )
+          g_string_append_printf ( buf, "\\u%04x", (unsigned char) *p );
+        else g_string_append_c ( buf, *p );
+      }
+  g_string_append_c ( buf, '"' );
+  
+} // end dumb_append_json_string
 
-  // Prepara.
-  rw= NULL;
-  ret= NULL;
+
+// Escriu l'eixida pendent. Si 'all' és fals sols escriu fins la marca
+// de undo.
+static void
+dumb_flush (
+            Screen     *s,
+            const bool  all
+            )
+{
+
+  gsize n;
   
-  // Carrega.
-  rw= SDL_RWFromConstMem ( icon, (int) icon_size );
-  if ( rw == NULL ) goto error_sdl;
-  ret= IMG_Load_RW ( rw, 0 );
-  if ( ret == NULL ) goto error_sdl;
+
+  n= (all || s->_dumb.mark == -1) ? s->_dumb.buf->len : (gsize) s->_dumb.mark;
+  if ( n == 0 ) return;
+  fwrite ( s->_dumb.buf->str, n, 1, stdout );
+  fflush ( stdout );
+  g_string_erase ( s->_dumb.buf, 0, n );
+  if ( s->_dumb.mark != -1 ) s->_dumb.mark-= n;
   
-  // Allibera memòria.
-  SDL_RWclose ( rw );
+} // end dumb_flush
 
-  return ret;
+
+static void
+dumb_print (
+            Screen     *s,
+            const char *text
+            )
+{
+
+  if ( s->_mode == SCREEN_DUMB_JSON )
+    {
+      g_string_append_printf ( s->_dumb.buf,
+                                "{\"type\":\"print\",\"window\":%d,\"text\":",
+                                s->_current_win );
+      dumb_append_json_string ( s->_dumb.buf, text );
+      g_string_append ( s->_dumb.buf, "}\n" );
+    }
+  else if ( s->_current_win == W_LOW )
+    g_string_append ( s->_dumb.buf, text );
+  
+} // end dumb_print
+
+
+// Llig de '_input.f'. Torna les línies com a caràcters ZSCII acabats
+// en retorn de carro.
+static bool
+read_input_file (
+                 Screen   *s,
+                 uint8_t   buf[SCREEN_INPUT_TEXT_BUF],
+                 int      *N,
+                 char    **err
+                 )
+{
+
+  ssize_t len;
+  int end_pos;
+  uint8_t zc;
   
- error_sdl:
-  if ( ret != NULL ) SDL_FreeSurface ( ret );
-  if ( rw != NULL ) SDL_RWclose ( rw );
-  msgerror ( err, "Failed to load icon: %s", SDL_GetError () );
-  return NULL;
   
-} // end load_icon
+  // Nova línia.
+  if ( s->_input.p == NULL )
+    {
+      if ( s->_input.finished ) return true;
+      len= getline ( &(s->_input.line), &(s->_input.size), s->_input.f );
+      if ( len == -1 )
+        {
+          if ( ferror ( s->_input.f ) )
+            {
+              msgerror ( err, "Failed to read input" );
+              return false;
+            }
+          s->_input.finished= true;
+          return true;
+        }
+      while ( len > 0 && (s->_input.line[len-1] == '\n' ||
+                          s->_input.line[len-1] == '\r') )
+        s->_input.line[--len]= '\0';
+      s->_input.p= s->_input.line;
+    }
+
+  // Converteix.
+  while ( *(s->_input.p) != '\0' && *N < SCREEN_INPUT_TEXT_BUF )
+    {
+      if ( *(s->_input.p) >= 32 && *(s->_input.p) <= 126 )
+        buf[(*N)++]= *(s->_input.p++);
+      else
+        {
+          zc= extra_chars_decode_next_char ( s->_extra_chars,
+                                             s->_input.p, &end_pos );
+          s->_input.p+= end_pos;
+          if ( zc != 0 ) buf[(*N)++]= zc;
+        }
+    }
+  if ( *(s->_input.p) == '\0' && *N < SCREEN_INPUT_TEXT_BUF )
+    {
+      buf[(*N)++]= 13;
+      s->_input.p= NULL;
+      s->_dumb.line_read= true;
+    }
+  
+  return true;
+  
+} // end read_input_file
 
 
 
@@ -868,16 +1297,25 @@ screen_free (
   int i;
 
 
-  SDL_StopTextInput ();
+  if ( s->_mode == SCREEN_SDL ) SDL_StopTextInput ();
+  if ( s->_dumb.buf != NULL )
+    {
+      dumb_flush ( s, true );
+      g_string_free ( s->_dumb.buf, TRUE );
+    }
+  if ( s->_input.f != NULL && s->_input.close ) fclose ( s->_input.f );
+  free ( s->_input.line );
   g_free ( s->_status_line );
   if ( s->_undo.cursor.text != NULL ) g_free ( s->_undo.cursor.text );
+  g_free ( s->_undo.cursor.layout );
   if ( s->_undo.fb != NULL ) g_free ( s->_undo.fb );
-  if ( s->_render_buf != NULL ) SDL_FreeSurface ( s->_render_buf );
+  if ( s->_glyphs != NULL ) glyphs_free ( s->_glyphs );
   g_free ( s->_split.buf );
   for ( i= 0; i < 2; ++i )
     {
       if ( s->_cursors[i].text != NULL )
         g_free ( s->_cursors[i].text );
+      g_free ( s->_cursors[i].layout );
       if ( s->_cursors[i].text_remain != NULL )
         g_free ( s->_cursors[i].text_remain );
     }
@@ -892,26 +1330,24 @@ screen_free (
 
 Screen *
 screen_new (
-            Conf            *conf,
-            const int        version,
-            const char      *title,
-            const uint8_t   *icon, // Pot ser NULL
-            const size_t     icon_size,
-            const gboolean   verbose,
-            char           **err
+            Conf              *conf,
+            const int          version,
+            const char        *title,
+            const ScreenMode   mode,
+            const char        *input_fn, // Pot ser NULL
+            const gboolean     verbose,
+            char             **err
             )
 {
   
   Screen *ret;
   int n;
   uint32_t color;
-  SDL_Surface *icon_sf;
   
   
   assert ( version >= 1 && version <= 8 && version != 6 );
   
   // Prepara.
-  icon_sf= NULL;
   ret= g_new ( Screen, 1 );
   ret->_conf= conf;
   ret->_win= NULL;
@@ -919,82 +1355,119 @@ screen_new (
   ret->_extra_chars= NULL;
   ret->_version= version;
   ret->_fb= NULL;
+  ret->_dirty.N= 0;
   ret->_status_line= NULL;
   ret->_more_counter= 0;
   for ( n= 0; n < 2; ++n )
     {
       ret->_cursors[n].text= NULL;
+      ret->_cursors[n].layout= NULL;
       ret->_cursors[n].text_remain= NULL;
     }
   ret->_split.buf= NULL;
-  ret->_render_buf= NULL;
+  ret->_glyphs= NULL;
   ret->_undo.fb= NULL;
   ret->_undo.cursor.text= NULL;
-  
-  // Inicialitza fonts i calcula dimensions pantalla.
-  ret->_fonts= fonts_new ( conf, verbose, err );
-  if ( ret->_fonts == NULL ) goto error;
-  ret->_line_height= fonts_char_height ( ret->_fonts );
-  if ( ret->_line_height <= 0 )
+  ret->_undo.cursor.layout= NULL;
+  ret->_mode= mode;
+  ret->_dumb.buf= NULL;
+  ret->_dumb.mark= -1;
+  ret->_dumb.line_read= false;
+  ret->_input.f= NULL;
+  ret->_input.close= false;
+  ret->_input.finished= false;
+  ret->_input.line= NULL;
+  ret->_input.size= 0;
+  ret->_input.p= NULL;
+
+  // Entrada.
+  if ( input_fn == NULL && mode != SCREEN_SDL ) input_fn= "-";
+  if ( input_fn != NULL )
     {
-      msgerror ( err, "Failed to create screen: invalid font height %d",
-                 ret->_line_height );
-      goto error;
-    }
-  if ( !fonts_char0_width ( ret->_fonts, &(ret->_char_width), err ) )
-    goto error;
-  if ( ret->_char_width <= 0 )
-    {
-      msgerror ( err, "Failed to create screen: invalid char width %d",
-                 ret->_char_width );
-      goto error;
+      if ( strcmp ( input_fn, "-" ) == 0 ) ret->_input.f= stdin;
+      else
+        {
+          ret->_input.f= fopen ( input_fn, "r" );
+          if ( ret->_input.f == NULL )
+            {
+              msgerror ( err, "Failed to open input file '%s'", input_fn );
+              goto error;
+            }
+          ret->_input.close= true;
+        }
     }
+  
+  // Dimensions.
   ret->_lines= conf->screen_lines;
-  ret->_height= ret->_lines*ret->_line_height;
   ret->_width_chars= conf->screen_width;
-  ret->_width= ret->_width_chars*ret->_char_width;
   if ( ret->_version <= 3 )
+    ret->_status_line= g_new ( char, ret->_width_chars+1 );
+  if ( mode == SCREEN_SDL )
     {
-      ret->_height+= ret->_line_height;
-      ret->_status_line= g_new ( char, ret->_width_chars+1 );
-    }
-  if ( ret->_width <= 0 || ret->_height <= 0 )
-    {
-      msgerror ( err, "Failed to create screen" );
-      goto error;
+      
+      // Inicialitza fonts i calcula dimensions pantalla.
+      ret->_fonts= fonts_new ( conf, verbose, err );
+      if ( ret->_fonts == NULL ) goto error;
+      ret->_line_height= fonts_char_height ( ret->_fonts );
+      if ( ret->_line_height <= 0 )
+        {
+          msgerror ( err, "Failed to create screen: invalid font height %d",
+                     ret->_line_height );
+          goto error;
+        }
+      if ( !fonts_char0_width ( ret->_fonts, &(ret->_char_width), err ) )
+        goto error;
+      if ( ret->_char_width <= 0 )
+        {
+          msgerror ( err, "Failed to create screen: invalid char width %d",
+                     ret->_char_width );
+          goto error;
+        }
+      ret->_height= ret->_lines*ret->_line_height;
+      ret->_width= ret->_width_chars*ret->_char_width;
+      if ( ret->_version <= 3 )
+        ret->_height+= ret->_line_height;
+      if ( ret->_width <= 0 || ret->_height <= 0 )
+        {
+          msgerror ( err, "Failed to create screen" );
+          goto error;
+        }
+      
+      // Crea finestra.
+      ret->_win= window_new ( conf->screen_fullscreen ? 0 : ret->_width,
+                              ret->_height,
+                              ret->_width, ret->_height,
+                              title, err );
+      if ( ret->_win == NULL ) goto error;
+      window_show ( ret->_win );
+      
+      // Inicialitza framebuffer
+      ret->_fb= g_new ( uint32_t, ret->_width*ret->_height );
+      if ( ret->_version <= 3 )
+        ret->_fb_draw= ret->_fb + ret->_width*ret->_line_height;
+      else ret->_fb_draw= ret->_fb;
+      ret->_reverse_color= false;
+      color= true_color_to_u32 ( ret, C_WHITE );
+      for ( n= 0; n < ret->_width*ret->_height; ++n )
+        ret->_fb[n]= color;
+      ret->_last_redraw_t= (Uint32) -1;
+      mark_all_dirty ( ret );
+      if ( !redraw_fb ( ret, err ) ) goto error;
+      
     }
-
-  // Crea finestra.
-  if ( icon != NULL )
+  else
     {
-      icon_sf= load_icon ( icon, icon_size, err );
-      if ( icon_sf == NULL ) goto error;
+      ret->_line_height= 1;
+      ret->_char_width= 1;
+      ret->_height= ret->_lines;
+      ret->_width= ret->_width_chars;
+      ret->_reverse_color= false;
+      ret->_dumb.buf= g_string_new ( "" );
     }
-  else icon_sf= NULL;
-  ret->_win= window_new ( conf->screen_fullscreen ? 0 : ret->_width,
-                          ret->_height,
-                          ret->_width, ret->_height,
-                          title, icon_sf, err );
-  if ( ret->_win == NULL ) goto error;
-  if ( icon_sf != NULL ) SDL_FreeSurface ( icon_sf );
-  icon_sf= NULL;
-  window_show ( ret->_win );
-  
-  // Inicialitza framebuffer
-  ret->_fb= g_new ( uint32_t, ret->_width*ret->_height );
-  if ( ret->_version <= 3 )
-    ret->_fb_draw= ret->_fb + ret->_width*ret->_line_height;
-  else ret->_fb_draw= ret->_fb;
-  ret->_reverse_color= false;
-  color= true_color_to_u32 ( ret, C_WHITE );
-  for ( n= 0; n < ret->_width*ret->_height; ++n )
-    ret->_fb[n]= color;
-  ret->_last_redraw_t= (Uint32) -1;
-  ret->_fb_changed= true;
-  if ( !redraw_fb ( ret, err ) ) goto error;
   
   // Altres.
   ret->_upwin_lines= 0;
+  ret->_low_origin= 0;
   ret->_current_win= W_LOW;
   ret->_current_font= ret->_version<=4 ? F_FPITCH : F_NORMAL;
   ret->_current_style= F_ROMAN;
@@ -1016,6 +1489,7 @@ screen_new (
       ret->_cursors[n].width= 0;
       ret->_cursors[n].text= g_new ( char, 1 );
       ret->_cursors[n].text[0]= '\0';
+      ret->_cursors[n].layout= g_new ( ScreenLayoutChar, 1 );
       ret->_cursors[n].size= 1;
       ret->_cursors[n].N= 0;
       ret->_cursors[n].Nc= 0;
@@ -1032,14 +1506,16 @@ screen_new (
   ret->_split.buf= g_new ( char, 1 );
   ret->_split.buf[0]= '\0';
   ret->_split.size= 1;
-
-  // Inicialitza el buffer de renderitzat.
-  ret->_render_buf= window_get_surface ( ret->_win, ret->_width,
-                                         ret->_line_height, err );
-  if ( ret->_render_buf == NULL ) goto error;
+  
+  // Sense finestra no cal res més.
+  if ( mode != SCREEN_SDL ) return ret;
+  
+  // Inicialitza l'atles de glifs.
+  ret->_glyphs= glyphs_new ( ret->_fonts, ret->_line_height );
 
   // Undo.
   ret->_undo.cursor.text= g_new ( char, 1 );
+  ret->_undo.cursor.layout= g_new ( ScreenLayoutChar, 1 );
   ret->_undo.cursor.size= 1;
   ret->_undo.fb= g_new ( uint32_t, ret->_width*ret->_height );
   
@@ -1049,7 +1525,6 @@ screen_new (
   return ret;
   
  error:
-  if ( icon_sf != NULL ) SDL_FreeSurface ( icon_sf );
   screen_free ( ret );
   return NULL;
   
@@ -1070,6 +1545,13 @@ screen_print (
   char *line_text;
   
   
+  // Sense finestra.
+  if ( s->_mode != SCREEN_SDL )
+    {
+      dumb_print ( s, text );
+      return true;
+    }
+  
   // Obté estil, color, etc.
   if ( s->_current_win == W_UP ) font= F_FPITCH;
   else font= s->_current_font;
@@ -1103,7 +1585,6 @@ screen_print (
       return false;
   
   // Actualitza
-  s->_fb_changed= true;
   if ( !redraw_fb ( s, err ) ) return false;
   
   return true;
@@ -1149,6 +1630,16 @@ screen_set_style (
 } // end screen_set_style
 
 
+void
+screen_set_icon (
+                 Screen      *screen,
+                 SDL_Surface *icon
+                 )
+{
+  if ( screen->_mode == SCREEN_SDL ) window_set_icon ( screen->_win, icon );
+} // end screen_set_icon
+
+
 // NOTA!!! Sols s'utilitza en V5
 uint16_t
 screen_set_font (
@@ -1216,11 +1707,20 @@ screen_read_char (
   screen->_more_counter= 0;
   
   // Repinta si cal.
-  if ( !redraw_fb ( screen, err ) ) return false;
+  if ( screen->_mode != SCREEN_SDL ) dumb_flush ( screen, false );
+  else if ( !redraw_fb ( screen, err ) ) return false;
+
+  // Llig del fitxer. Els events de la finestra es descarten.
+  *N= 0;
+  if ( screen->_input.f != NULL )
+    {
+      if ( screen->_mode == SCREEN_SDL )
+        while ( window_next_event ( screen->_win, &e ) ) {}
+      return read_input_file ( screen, buf, N, err );
+    }
   
   // Intenta llegit caràcter i aprofita per a gestionar events interns
   // de la interfície.
-  *N= 0;
   while ( window_next_event ( screen->_win, &e ) )
     switch ( e.type )
       {
@@ -1242,6 +1742,38 @@ screen_read_char (
 } // end screen_read_char
 
 
+void
+screen_wait_input (
+                   Screen       *screen,
+                   const gint64  usecs
+                   )
+{
+
+  gint64 ms;
+  Uint32 t;
+  
+
+  if ( screen->_input.f != NULL || screen->_mode != SCREEN_SDL ) return;
+  
+  // Arredoneix cap amunt per no tornar abans d'hora.
+  if ( usecs == -1 ) ms= -1;
+  else ms= usecs <= 0 ? 0 : (usecs+999)/1000;
+  if ( ms > G_MAXINT32 ) ms= G_MAXINT32;
+
+  // Si falta repintar, sols fins al següent repintat.
+  if ( screen->_dirty.N > 0 )
+    {
+      t= SDL_GetTicks () - screen->_last_redraw_t;
+      t= t >= REPAINT_TICKS ? 0 : REPAINT_TICKS-t;
+      if ( ms < 0 || ms > t ) ms= t;
+    }
+  
+  if ( ms < 0 ) SDL_WaitEvent ( NULL );
+  else SDL_WaitEventTimeout ( NULL, (int) ms );
+  
+} // end screen_wait_input
+
+
 void
 screen_set_undo_mark (
                       Screen *screen
@@ -1251,16 +1783,30 @@ screen_set_undo_mark (
   ScreenCursor *c;
 
   
+  // Sense finestra.
+  if ( screen->_mode != SCREEN_SDL )
+    {
+      dumb_flush ( screen, true );
+      screen->_dumb.mark= 0;
+      screen->_dumb.line_read= false;
+      return;
+    }
+  
   c= &(screen->_cursors[screen->_current_win]);
   if ( c->size > screen->_undo.cursor.size )
     {
       screen->_undo.cursor.text=
         g_renew ( char, screen->_undo.cursor.text, c->size );
+      screen->_undo.cursor.layout=
+        g_renew ( ScreenLayoutChar, screen->_undo.cursor.layout, c->size );
       screen->_undo.cursor.size= c->size;
     }
   memcpy ( screen->_undo.fb, screen->_fb,
            screen->_width*screen->_height*sizeof(uint32_t) );
+  screen->_undo.low_origin= screen->_low_origin;
   strcpy ( screen->_undo.cursor.text, c->text );
+  memcpy ( screen->_undo.cursor.layout, c->layout,
+           c->Nc*sizeof(ScreenLayoutChar) );
   screen->_undo.cursor.line= c->line;
   screen->_undo.cursor.x= c->x;
   screen->_undo.cursor.width= c->width;
@@ -1280,10 +1826,26 @@ screen_undo (
   ScreenCursor *c;
 
   
+  // Sense finestra. Descarta l'eixida des de la marca. Després de
+  // llegir una línia completa ja no es torna a desfer.
+  if ( screen->_mode != SCREEN_SDL )
+    {
+      if ( screen->_dumb.mark != -1 )
+        {
+          g_string_truncate ( screen->_dumb.buf, screen->_dumb.mark );
+          if ( screen->_dumb.line_read ) screen->_dumb.mark= -1;
+        }
+      return;
+    }
+  
   c= &(screen->_cursors[screen->_current_win]);
   memcpy ( screen->_fb, screen->_undo.fb,
            screen->_width*screen->_height*sizeof(uint32_t) );
+  screen->_low_origin= screen->_undo.low_origin;
+  mark_all_dirty ( screen );
   strcpy ( c->text, screen->_undo.cursor.text );
+  memcpy ( c->layout, screen->_undo.cursor.layout,
+           screen->_undo.cursor.Nc*sizeof(ScreenLayoutChar) );
   c->line= screen->_undo.cursor.line;
   c->x= screen->_undo.cursor.x;
   c->width= screen->_undo.cursor.width;
@@ -1321,8 +1883,14 @@ screen_erase_window (
   else
     ww ( "Cannot erase window %d because it does not exist", window );
 
+  // Sense finestra.
+  if ( screen->_mode == SCREEN_DUMB_JSON )
+    g_string_append_printf ( screen->_dumb.buf,
+                             "{\"type\":\"erase_window\",\"window\":%d}\n",
+                             window );
+  if ( screen->_mode != SCREEN_SDL ) return true;
+  
   // Redibuixa
-  screen->_fb_changed= true;
   if ( !redraw_fb ( screen, err ) ) return false;
 
   return true;
@@ -1360,8 +1928,13 @@ screen_split_window (
                  " for upper window", lines );
       return false;
     }
+  normalize_low ( screen );
   screen->_upwin_lines= lines;
-
+  if ( screen->_mode == SCREEN_DUMB_JSON )
+    g_string_append_printf ( screen->_dumb.buf,
+                             "{\"type\":\"split_window\",\"lines\":%d}\n",
+                             lines );
+  
   // Mou cursors si cal
   if ( screen->_cursors[W_UP].line >= screen->_upwin_lines )
     reset_cursor ( screen, W_UP );
@@ -1438,6 +2011,10 @@ screen_set_cursor (
     {
       screen->_cursors[W_UP].x= (x-1)*screen->_char_width;
       screen->_cursors[W_UP].line= y-1;
+      if ( screen->_mode == SCREEN_DUMB_JSON )
+        g_string_append_printf ( screen->_dumb.buf,
+                                 "{\"type\":\"set_cursor\","
+                                 "\"x\":%d,\"y\":%d}\n", x, y );
     }
   
   return true;
@@ -1469,6 +2046,11 @@ screen_check_unicode (
     *input= extra_chars_check ( screen->_extra_chars, ch );
 
   // Output.
+  if ( screen->_mode != SCREEN_SDL )
+    {
+      *output= true;
+      return;
+    }
   c= &(screen->_cursors[screen->_current_win]);
   *output= (TTF_GlyphIsProvided
             ( screen->_fonts->_fonts[c->font][c->style], ch ) != 0);
@@ -1487,102 +2069,36 @@ screen_show_status_line (
                          )
 {
 
-  const char *SCORE= "Score";
-  const char *TURNS= "Turns";
-  
-  int pos,count,remain,text_len;
-  SDL_Color color;
-  SDL_Surface *surface;
-  uint32_t bg_color;
-  SDL_Rect rect;
+  int x;
   
   
   // Genera text
-  // --> Càlcul espai necessari dreta
-  pos= 0;
-  if ( is_score_game )
-    {
-      // Text _ SCORE : _999 TURN : _9999
-      count= strlen ( SCORE ) + strlen ( TURNS ) +
-        4 + // : i espai
-        2 + // espai principi
-        3 + // score
-        4;  // turns
-      remain= screen->_width_chars-count;
-    }
-  else
-    {
-      // Text _ HH:MM
-      count= 1 + 2 + 1 + 2;
-      remain= screen->_width_chars-count;
-    }
-  // --> Còpia text
-  if ( remain >= 3 )
-    {
-      text_len= strlen ( text );
-      if ( text_len <= remain )
-        {
-          for ( ; pos < text_len; ++pos )
-            screen->_status_line[pos]= text[pos];
-          for ( ; pos < remain; ++pos )
-            screen->_status_line[pos]= ' ';
-        }
-      else
-        {
-          for ( ; pos < remain-3; ++pos )
-            screen->_status_line[pos]= text[pos];
-          screen->_status_line[pos++]= '.';
-          screen->_status_line[pos++]= '.';
-          screen->_status_line[pos++]= '.';
-        }
-    }
-  // --> Part dreta
-  if ( count <= screen->_width_chars )
+  format_status_line ( screen, text, is_score_game,
+                       score_hours, turns_minutes );
+
+  // Sense finestra.
+  if ( screen->_mode != SCREEN_SDL )
     {
-      if ( is_score_game )
-        {
-          sprintf ( &(screen->_status_line[pos]),
-                    " %s: %3d %s: %4d",
-                    SCORE, score_hours, TURNS, turns_minutes );
-          pos+= count;
-        }
-      else
+      if ( screen->_mode == SCREEN_DUMB_JSON )
         {
-          sprintf ( &(screen->_status_line[pos]),
-                    " %02d:%02d", score_hours, turns_minutes );
-          pos+= count;
+          g_string_append ( screen->_dumb.buf,
+                            "{\"type\":\"status_line\",\"text\":" );
+          dumb_append_json_string ( screen->_dumb.buf, screen->_status_line );
+          g_string_append ( screen->_dumb.buf, "}\n" );
         }
+      return true;
     }
-  // --> Tanca
-  for ( ; pos < screen->_width_chars; ++pos )
-    screen->_status_line[pos]= ' ';
-  screen->_status_line[pos]= '\0';
-    
-  // Renderitza
-  surface= NULL;
-  true_color_to_sdlcolor ( C_WHITE, &color );
-  surface= TTF_RenderUTF8_Blended
-    ( screen->_fonts->_fonts[F_FPITCH][F_ROMAN], screen->_status_line, color );
-  if ( surface == NULL ) goto error_render_sdl;
-  bg_color= true_color_to_u32 ( screen, C_BLACK );
-  rect.x= 0; rect.w= screen->_width;
-  rect.y= 0; rect.h= screen->_line_height;
-  if ( SDL_FillRect ( screen->_render_buf, &rect, (Uint32) bg_color ) != 0 )
-    goto error_render_sdl;
-  if ( SDL_BlitSurface ( surface, NULL, screen->_render_buf, &rect ) != 0 )
-    goto error_render_sdl;
-  draw_render_buf ( screen, 0, -screen->_line_height, screen->_width );
-  SDL_FreeSurface ( surface ); surface= NULL;
+  
+  // Pinta
+  if ( !draw_text ( screen, screen->_status_line,
+                    strlen ( screen->_status_line ), F_FPITCH, F_ROMAN,
+                    C_WHITE, C_BLACK, 0, -1, &x, err ) )
+    return false;
+  fill_line ( screen, x, -1, screen->_width-x, C_BLACK );
 
   // Actualitza
-  screen->_fb_changed= true;
   if ( !redraw_fb ( screen, err ) ) return false;
   
   return true;
-
- error_render_sdl:
-  msgerror ( err, "Failed to render status line: %s", SDL_GetError () );
-  if ( surface != NULL ) SDL_FreeSurface ( surface );
-  return false;
   
 } // end screen_show_status_line
@@ -34,14 +34,41 @@
 #include "conf.h"
 #include "extra_chars.h"
 #include "fonts.h"
+#include "glyphs.h"
 #include "window.h"
 
 // Concideix amb el màxim de SDL
 #define SCREEN_INPUT_TEXT_BUF 32
 
+// Nombre màxim de regions modificades del framebuffer que es
+// recorden. Quan se supera s'ajunten totes en una.
+#define SCREEN_MAX_DIRTY 16
+
+// Tipus de pantalla.
+typedef enum
+  {
+    SCREEN_SDL,       // Finestra SDL
+    SCREEN_DUMB_TEXT, // Sense finestra. Text de la finestra inferior
+                      // per l'eixida estàndard.
+    SCREEN_DUMB_JSON  // Sense finestra. Events JSON (un per línia)
+                      // per l'eixida estàndard.
+  } ScreenMode;
+
+// Disposició d'un caràcter ja mesurat de la línia del cursor.
+typedef struct
+{
+  uint32_t ch;  // Caràcter Unicode.
+  size_t   off; // Posició en bytes en el text.
+  int      x;   // Posició inicial en píxels (relativa a 'x' del cursor,
+                // inclou el kerning).
+  int      end; // Posició final en píxels (relativa a 'x' del cursor).
+  int      ink; // Fins on s'ha pintat la línia (fons i tinta) fins a
+                // aquest caràcter inclòs (relativa a 'x' del cursor).
+} ScreenLayoutChar;
+
 // Desa estat per a renderitzat en cada cursor. En realitat desa
-// informació sobre l'últim tros de de text renderitzat per a poder
-// re-renderitzar si es continuen afegint caràcters a la paraula.
+// informació sobre l'últim tros de de text pintat (mateix estil) per
+// a poder continuar pintant si s'afegeixen caràcters a la línia.
 typedef struct
 {
 
@@ -63,6 +90,7 @@ typedef struct
   size_t    size; // Memòria reserva en text
   size_t    N;    // Nombre de bytes (no inclou '\0')
   size_t    Nc;   // Nombre de caràcters UTF-8 (no inclou '\0')
+  ScreenLayoutChar *layout; // Un per caràcter. Té 'size' elements.
 
   // Text pendent
   char     *text_remain; // Inclou '\0'. Buffer auxiliar
@@ -98,8 +126,18 @@ typedef struct
   uint32_t *_fb_draw;
   bool      _reverse_color;
 
+  // Regions de '_fb' modificades des de l'última actualització de la
+  // finestra.
+  struct
+  {
+    SDL_Rect rects[SCREEN_MAX_DIRTY];
+    int      N;
+  } _dirty;
+
   // Finestres i altres.
   int          _upwin_lines;
+  int          _low_origin; // Línia física on comença la finestra
+                            // inferior (buffer circular de línies).
   int          _current_win;
   int          _current_font;  // Efectiva, no la seleccionada. Sols afecta LOW.
   int          _current_style; // Efectiva, no la seleccionada
@@ -112,6 +150,7 @@ typedef struct
   {
     ScreenCursor  cursor;
     uint32_t     *fb;
+    int           low_origin;
   } _undo;
   
   // Tokenitzer text
@@ -124,15 +163,37 @@ typedef struct
   } _split;
 
   // Altres
-  SDL_Surface *_render_buf;
+  Glyphs      *_glyphs;
   Uint32       _last_redraw_t; // ticks SDL (en millisegons) des de
                                // l'últim repintat amb print.
-  bool         _fb_changed;
   char        *_status_line; // Buffer per a renderitzar el status
                              // line.
   int          _more_counter; // Quan aplega al valor de línies-1 de
                               // la finestra inferior para d'imprimir
                               // i mostra un missatge MORE.
+
+  // Mode sense finestra.
+  ScreenMode _mode;
+  struct
+  {
+    GString *buf;       // Eixida pendent d'escriure.
+    gssize   mark;      // Posició en 'buf' de la marca de undo (-1
+                        // si no n'hi ha).
+    bool     line_read; // S'ha llegit una línia completa des de
+                        // l'última marca.
+  } _dumb;
+
+  // Entrada des de fitxer.
+  struct
+  {
+    FILE   *f;        // NULL indica que es llig dels events SDL.
+    bool    close;    // Cal tancar 'f'.
+    bool    finished; // No queda res per llegir.
+    char   *line;     // Última línia llegida.
+    size_t  size;
+    char   *p;        // Següent caràcter pendent de 'line' (NULL si
+                      // no queda res).
+  } _input;
 } Screen;
 
 void
@@ -141,15 +202,19 @@ screen_free (
              );
 
 // NOTA!!! La versió ha de ser 1,2,3,4,5,7 o 8. No genera un error.
+// Si 'input_fn' no és NULL l'entrada es llig d'eixe fitxer (una
+// ordre per línia), "-" indica l'entrada estàndard. En els modes
+// sense finestra no s'utilitza SDL i si 'input_fn' és NULL es llig
+// de l'entrada estàndard.
 Screen *
 screen_new (
-            Conf            *conf,
-            const int        version,
-            const char      *title,
-            const uint8_t   *icon, // Pot ser NULL
-            const size_t     icon_size,
-            const gboolean   verbose,
-            char           **err
+            Conf              *conf,
+            const int          version,
+            const char        *title,
+            const ScreenMode   mode,
+            const char        *input_fn, // Pot ser NULL
+            const gboolean     verbose,
+            char             **err
             );
 
 bool
@@ -165,6 +230,14 @@ screen_set_style (
                   const uint16_t  style
                   );
 
+// Fixa la icona de la finestra. En els modes sense finestra no fa
+// res.
+void
+screen_set_icon (
+                 Screen      *screen,
+                 SDL_Surface *icon
+                 );
+
 // 0 - IN: No modifica OUT: Font no disponible
 // 1 - Normal font
 // 2 - Picture font
@@ -197,6 +270,16 @@ screen_read_char (
                   char    **err
                   );
 
+// Espera fins que hi haja un event pendent o passen 'usecs'
+// microsegons (-1 vol dir sense límit, altres negatius com 0). Si hi ha canvis en la
+// pantalla pendents de mostrar no espera més del necessari per a
+// mostrar-los. Quan l'entrada es llig d'un fitxer no espera.
+void
+screen_wait_input (
+                   Screen       *screen,
+                   const gint64  usecs
+                   );
+
 // Indica la posició a la que torna undo. ATENCIÓ!!! Perquè funcione
 // no es pot canviar ni el cursor, ni la font, ni l'estil, etc.
 void
@@ -271,5 +354,7 @@ screen_show_status_line (
   (extra_chars_add ( (SCREEN)->_extra_chars, (UNICODE), (ZCODE), (ERR) ))
 #define screen_GET_LINES(SCREEN) ((SCREEN)->_lines)
 #define screen_GET_WIDTH_CHARS(SCREEN) ((SCREEN)->_width_chars)
+// Cert quan l'entrada es llig d'un fitxer i ja s'ha acabat.
+#define screen_INPUT_FINISHED(SCREEN) ((SCREEN)->_input.finished)
 
 #endif // __FRONTEND__SCREEN_H__
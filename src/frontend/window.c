@@ -132,7 +132,6 @@ init_sdl (
           const int     fbwidth,
           const int     fbheight,
           const char   *title,
-          SDL_Surface  *icon,
           char        **err
           )
 {
@@ -176,9 +175,6 @@ init_sdl (
         }
     }
 
-  // Fixa la icona
-  if ( icon != NULL ) SDL_SetWindowIcon ( win->_win, icon );
-  
   // Amaga el cursor.
   win->_cursor_enabled= false;
   SDL_ShowCursor ( 0 );
@@ -316,7 +312,6 @@ window_new (
             const int     fb_width,
             const int     fb_height,
             const char   *title, // Pot ser NULL
-            SDL_Surface  *icon,
             char        **err
             )
 {
@@ -332,7 +327,7 @@ window_new (
   
   // Inicialitza
   if ( !init_sdl ( ret, window_width, window_height,
-                   fb_width, fb_height, title, icon, err ) )
+                   fb_width, fb_height, title, err ) )
     goto error;
   update_coords ( ret );
   
@@ -466,36 +461,36 @@ window_set_title (
 } // end window_set_title
 
 
+void
+window_set_icon (
+                 Window      *win,
+                 SDL_Surface *icon
+                 )
+{
+  SDL_SetWindowIcon ( win->_win, icon );
+} // end window_set_icon
+
+
 bool
-window_update (
-               Window          *win,
-               const uint32_t  *fb,
-               char           **err
-               )
+window_update_rect (
+                    Window          *win,
+                    const SDL_Rect  *rect,
+                    const uint32_t  *pixels,
+                    const int        pitch,
+                    char           **err
+                    )
 {
-  
-  int r,c,i,pitch;
-  uint8_t *buffer;
-  
-  
-  if ( SDL_LockTexture ( win->_fb, NULL, (void **) &buffer, &pitch ) != 0 )
+
+  if ( SDL_UpdateTexture ( win->_fb, rect, pixels, pitch ) != 0 )
     {
       msgerror ( err, "Failed to update window frame buffer: %s",
                  SDL_GetError () );
       return false;
     }
-  for ( r= i= 0; r < win->_fbheight; ++r )
-    {
-      for ( c= 0; c < win->_fbwidth; ++c, ++i )
-        ((uint32_t *) buffer)[c]= fb[i];
-      buffer+= pitch;
-    }
-  SDL_UnlockTexture ( win->_fb );
-  draw ( win );
   
   return true;
   
-} // end window_update
+} // end window_update_rect
 
 
 void
@@ -56,7 +56,7 @@ window_free (
 
 // window_width i window_height són les dimensions de la finestra,
 // fbwidth i fbheight són les dimensions del framebuffer, title és el
-// títol. Si icon és NULL no es fica icona.
+// títol.
 Window *
 window_new (
             const int     window_width,
@@ -64,7 +64,6 @@ window_new (
             const int     fb_width,
             const int     fb_height,
             const char   *title,
-            SDL_Surface  *icon,
             char        **err
             );
 
@@ -99,12 +98,24 @@ window_set_title (
                   const char *title
                   );
 
+// La icona es copia, 'icon' es pot alliberar després.
+void
+window_set_icon (
+                 Window      *win,
+                 SDL_Surface *icon
+                 );
+
+// Copia en la regió 'rect' del framebuffer de la finestra els píxels
+// indicats ('pitch' en bytes). No es mostra fins cridar a
+// window_redraw.
 bool
-window_update (
-               Window          *win,
-               const uint32_t  *fb,
-               char           **err
-               );
+window_update_rect (
+                    Window          *win,
+                    const SDL_Rect  *rect,
+                    const uint32_t  *pixels,
+                    const int        pitch,
+                    char           **err
+                    );
 
 void
 window_redraw (
@@ -23,13 +23,25 @@
  */
 
 
+#define _GNU_SOURCE // copy_file_range
+
+#include <errno.h>
+#include <fcntl.h>
 #include <glib.h>
+#include <inttypes.h>
 #include <locale.h>
 #include <libintl.h>
 #include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <unistd.h>
 #include <SDL.h>
+#ifdef __linux__
+#include <sys/sendfile.h>
+#endif
 
 #include "core/interpreter.h"
 #include "core/story_file.h"
@@ -57,7 +69,10 @@
 struct args
 {
 
-  const gchar *zcode_fn;
+  const gchar  *zcode_fn;
+  gchar       **zcode_fns; // Tots els fitxers (mode benchmark i
+                           // portades)
+  int           N;
   
 };
 
@@ -70,6 +85,14 @@ struct opts
   gchar    *conf_fn;
   gchar    *transcript_fn;
   gchar    *cover_fn;
+  gchar    *covers_dir;
+  gchar    *engine;
+  gboolean  fusion;
+  gint      bench;
+  gchar    *dumb;
+  gchar    *input_fn;
+  gchar    *replay_fn;
+  gchar    *profile_fn;
   
 };
 
@@ -95,7 +118,15 @@ usage (
       FALSE,  // debug
       NULL,   // conf_fn
       NULL,   // transcript_fn
-      NULL    // cover_fn
+      NULL,   // cover_fn
+      NULL,   // covers_dir
+      NULL,   // engine
+      TRUE,   // fusion
+      0,      // bench
+      NULL,   // dumb
+      NULL,   // input_fn
+      NULL,   // replay_fn
+      NULL    // profile_fn
     };
 
   static GOptionEntry entries[]=
@@ -115,6 +146,47 @@ usage (
         " provided file. When this option is selected the story file"
         " is not executed. If no frontispiece image is present in the"
         " story file the application fails." },
+      { "covers", 0, 0, G_OPTION_ARG_STRING, &vals.covers_dir,
+        "Extract in parallel the frontispiece image (cover) of every"
+        " story file provided into the directory DIR. Directories are"
+        " scanned for story files. Each cover is named after its story"
+        " file with the image extension, and story files without cover"
+        " are skipped",
+        "DIR" },
+      { "engine", 'E', 0, G_OPTION_ARG_STRING, &vals.engine,
+        "Select the execution engine: 'threaded' (default) or 'switch'",
+        "ENGINE" },
+      { "no-fusion", 0, G_OPTION_FLAG_REVERSE, G_OPTION_ARG_NONE,
+        &vals.fusion,
+        "Do not fuse common instruction sequences into superinstructions"
+        " (threaded engine)" },
+      { "bench", 'B', 0, G_OPTION_ARG_INT, &vals.bench,
+        "Run each story file N times with every execution engine until"
+        " it asks for user input, and print the elapsed time. Several"
+        " story files can be provided",
+        "N" },
+      { "dumb", 0, 0, G_OPTION_ARG_STRING, &vals.dumb,
+        "Run without window, fonts nor SDL. The text is written to the"
+        " standard output as plain 'text' (lower window only) or as"
+        " 'json' events (one per line), and the input is read from the"
+        " standard input or the file specified with --input",
+        "FORMAT" },
+      { "input", 'I', 0, G_OPTION_ARG_STRING, &vals.input_fn,
+        "Read the input from the specified file (one command per line)"
+        " instead of the keyboard. Use '-' for the standard input",
+        "FILE" },
+      { "replay", 'R', 0, G_OPTION_ARG_STRING, &vals.replay_fn,
+        "Read the input from the specified file (one command per line)"
+        " without waiting, and at the end print the elapsed time, the"
+        " number of executed instructions and how many times each"
+        " opcode has been executed",
+        "FILE" },
+      { "profile", 'P', 0, G_OPTION_ARG_STRING, &vals.profile_fn,
+        "Profile the execution and at exit write the report (opcodes,"
+        " routines, call graph and screen time) in the specified file,"
+        " and the call stacks in collapsed format (flamegraph) in"
+        " FILE.folded",
+        "FILE" },
       { NULL }
     };
   
@@ -135,13 +207,16 @@ usage (
   *opts= vals;
   
   // Comprova arguments.
-  if ( *argc-1 != NUM_ARGS )
+  if ( *argc-1 != NUM_ARGS &&
+       !((vals.bench > 0 || vals.covers_dir != NULL) && *argc-1 > NUM_ARGS) )
     {
       fprintf ( stderr, "%s\n",
                 g_option_context_get_help ( context, TRUE, NULL ) );
       exit ( EXIT_FAILURE );
     }
   args->zcode_fn= (*argv)[1];
+  args->zcode_fns= &((*argv)[1]);
+  args->N= *argc-1;
   
   // Allibera
   g_option_context_free ( context );
@@ -155,6 +230,12 @@ free_opts (
            )
 {
 
+  g_free ( opts->profile_fn );
+  g_free ( opts->replay_fn );
+  g_free ( opts->input_fn );
+  g_free ( opts->dumb );
+  g_free ( opts->engine );
+  g_free ( opts->covers_dir );
   g_free ( opts->cover_fn );
   g_free ( opts->transcript_fn );
   g_free ( opts->conf_fn );
@@ -162,6 +243,304 @@ free_opts (
 } // end free_opts
 
 
+static bool
+parse_engine (
+              const gchar        *name,
+              InterpreterEngine  *engine,
+              char              **err
+              )
+{
+
+  if ( name == NULL || !strcmp ( name, "threaded" ) )
+    *engine= INTP_ENGINE_THREADED;
+  else if ( !strcmp ( name, "switch" ) )
+    *engine= INTP_ENGINE_SWITCH;
+  else
+    {
+      msgerror ( err, "Unknown execution engine '%s'", name );
+      return false;
+    }
+
+  return true;
+  
+} // end parse_engine
+
+
+static bool
+parse_screen_mode (
+                   const gchar  *name,
+                   ScreenMode   *mode,
+                   char        **err
+                   )
+{
+
+  if ( name == NULL )
+    *mode= SCREEN_SDL;
+  else if ( !strcmp ( name, "text" ) )
+    *mode= SCREEN_DUMB_TEXT;
+  else if ( !strcmp ( name, "json" ) )
+    *mode= SCREEN_DUMB_JSON;
+  else
+    {
+      msgerror ( err, "Unknown output format '%s'", name );
+      return false;
+    }
+
+  return true;
+  
+} // end parse_screen_mode
+
+
+// Executa cada fitxer 'iters' vegades amb cada motor d'execució fins
+// que es demana una entrada i mostra el temps per eixida estàndard.
+static bool
+run_bench (
+           const struct args  *args,
+           Conf               *conf,
+           const ScreenMode    screen_mode,
+           const int           iters,
+           char              **err
+           )
+{
+
+  static const struct
+  {
+    InterpreterEngine  engine;
+    bool               fusion;
+    const char        *name;
+  } ENGINES[]=
+      {
+        { INTP_ENGINE_SWITCH, false, "switch" },
+        { INTP_ENGINE_THREADED, false, "threaded" },
+        { INTP_ENGINE_THREADED, true, "fused" }
+      };
+  static const int NUM_ENGINES= sizeof(ENGINES)/sizeof(ENGINES[0]);
+  
+  Interpreter *intp;
+  int f,e,i;
+  uint64_t icount,total;
+  gint64 t0,time_us;
+  double secs;
+  
+  
+  for ( f= 0; f < args->N; ++f )
+    {
+      printf ( "%s\n", args->zcode_fns[f] );
+      for ( e= 0; e < NUM_ENGINES; ++e )
+        {
+          total= 0;
+          time_us= 0;
+          for ( i= 0; i < iters; ++i )
+            {
+              intp= interpreter_new_from_file_name ( args->zcode_fns[f], conf,
+                                                     NULL, screen_mode, NULL,
+                                                     false, NULL, err );
+              if ( intp == NULL ) return false;
+              interpreter_set_engine ( intp, ENGINES[e].engine );
+              interpreter_set_fusion ( intp, ENGINES[e].fusion );
+              t0= g_get_monotonic_time ();
+              if ( !interpreter_bench ( intp, &icount, err ) )
+                {
+                  interpreter_free ( intp );
+                  return false;
+                }
+              time_us+= g_get_monotonic_time () - t0;
+              total+= icount;
+              if ( ENGINES[e].fusion && i == iters-1 )
+                interpreter_print_fusion_stats ( intp, stdout );
+              interpreter_free ( intp );
+            }
+          secs= time_us/1000000.0;
+          printf ( "  %-8s %12" PRIu64 " instructions %10.3f s"
+                   " %12.0f inst/s\n",
+                   ENGINES[e].name, total, secs,
+                   secs > 0 ? total/secs : 0.0 );
+        }
+    }
+  
+  return true;
+  
+} // end run_bench
+
+
+// Executa la història llegint l'entrada de 'replay_fn' i mostra per
+// l'eixida d'errors el temps, les instruccions executades i les
+// execucions de cada opcode.
+static bool
+run_replay (
+            const struct args  *args,
+            const struct opts  *opts,
+            Conf               *conf,
+            const ScreenMode    screen_mode,
+            InterpreterEngine   engine,
+            char              **err
+            )
+{
+
+  Interpreter *intp;
+  gint64 t0,time_us;
+  double secs;
+  
+
+  intp= interpreter_new_from_file_name ( args->zcode_fn, conf,
+                                         opts->transcript_fn,
+                                         screen_mode, opts->replay_fn,
+                                         opts->verbose, NULL, err );
+  if ( intp == NULL ) return false;
+  interpreter_set_engine ( intp, engine );
+  interpreter_set_fusion ( intp, opts->fusion );
+  interpreter_enable_opcode_stats ( intp );
+  if ( opts->profile_fn != NULL ) interpreter_enable_profiler ( intp );
+  t0= g_get_monotonic_time ();
+  if ( !interpreter_run ( intp, err ) )
+    {
+      interpreter_free ( intp );
+      return false;
+    }
+  time_us= g_get_monotonic_time () - t0;
+  if ( opts->profile_fn != NULL &&
+       !interpreter_write_profile ( intp, opts->profile_fn, err ) )
+    {
+      interpreter_free ( intp );
+      return false;
+    }
+  secs= time_us/1000000.0;
+  fprintf ( stderr, "Wall time:    %.3f s\n", secs );
+  fprintf ( stderr, "Instructions: %" PRIu64 "\n",
+            interpreter_GET_ICOUNT ( intp ) );
+  fprintf ( stderr, "Inst/s:       %.0f\n",
+            secs > 0 ? interpreter_GET_ICOUNT ( intp )/secs : 0.0 );
+  fprintf ( stderr, "Opcodes:\n" );
+  interpreter_print_opcode_stats ( intp, stderr );
+  interpreter_free ( intp );
+  
+  return true;
+  
+} // end run_replay
+
+
+// Copia 'size' bytes del fitxer 'in' ('in_fn') a partir de 'offset'
+// en el fitxer 'out_fn'. Si és possible la còpia la fa el nucli,
+// sense passar per l'espai d'usuari. Si falla esborra 'out_fn'.
+static bool
+copy_file_data (
+                const int     in,
+                const gchar  *in_fn,
+                const long    offset,
+                const size_t  size,
+                const gchar  *out_fn,
+                char        **err
+                )
+{
+
+  int out;
+  off_t off;
+  size_t remain;
+  ssize_t n;
+  char buf[BUFSIZ];
+  
+  
+  out= open ( out_fn, O_WRONLY|O_CREAT|O_TRUNC, 0644 );
+  if ( out == -1 ) { error_create_file ( err, out_fn ); return false; }
+  off= (off_t) offset;
+  remain= size;
+#ifdef __linux__
+  // --> copy_file_range (mateix sistema de fitxers)
+  while ( remain > 0 &&
+          (n= copy_file_range ( in, &off, out, NULL, remain, 0 )) > 0 )
+    remain-= (size_t) n;
+  // --> sendfile
+  while ( remain > 0 && (n= sendfile ( out, in, &off, remain )) > 0 )
+    remain-= (size_t) n;
+#endif
+  // --> read/write
+  if ( remain > 0 && lseek ( in, off, SEEK_SET ) == (off_t) -1 )
+    goto error_read;
+  while ( remain > 0 )
+    {
+      n= read ( in, buf, remain > sizeof(buf) ? sizeof(buf) : remain );
+      if ( n <= 0 )
+        {
+          if ( n == 0 ) errno= 0; // Fitxer truncat.
+          goto error_read;
+        }
+      if ( write ( out, buf, (size_t) n ) != n ) goto error_write;
+      remain-= (size_t) n;
+    }
+  if ( close ( out ) != 0 )
+    {
+      error_write_file ( err, out_fn );
+      unlink ( out_fn );
+      return false;
+    }
+  
+  return true;
+
+ error_read:
+  error_read_file ( err, in_fn );
+  goto error;
+ error_write:
+  error_write_file ( err, out_fn );
+ error:
+  close ( out );
+  unlink ( out_fn );
+  return false;
+  
+} // end copy_file_data
+
+
+// Torna 1 si s'ha extret, 0 si no té portada i -1 en cas d'error. Si
+// 'cover_fn' és NULL el nom és 'base' més l'extensió del tipus de
+// la portada.
+static int
+extract_cover_to (
+                  const gchar  *sf_fn,
+                  const gchar  *cover_fn,
+                  const gchar  *base,
+                  char        **err
+                  )
+{
+
+  StoryFileResourceType type;
+  long offset;
+  size_t size;
+  int in,ret;
+  gchar *out_fn;
+  const char *ext;
+  
+  
+  // Localitza.
+  if ( !story_file_find_cover ( sf_fn, &offset, &size, &type, err ) )
+    return -1;
+  if ( offset == -1 ) return 0;
+
+  // Nom del fitxer.
+  if ( cover_fn != NULL ) out_fn= g_strdup ( cover_fn );
+  else
+    {
+      if ( type == STORY_FILE_RESOURCE_PICTURE_PNG )       ext= ".png";
+      else if ( type == STORY_FILE_RESOURCE_PICTURE_JPEG ) ext= ".jpg";
+      else                                                 ext= ".rect";
+      out_fn= g_strconcat ( base, ext, NULL );
+    }
+
+  // Copia.
+  in= open ( sf_fn, O_RDONLY );
+  if ( in == -1 )
+    {
+      error_open_file ( err, sf_fn );
+      g_free ( out_fn );
+      return -1;
+    }
+  ret= copy_file_data ( in, sf_fn, offset, size, out_fn, err ) ? 1 : -1;
+  close ( in );
+  g_free ( out_fn );
+  
+  return ret;
+  
+} // end extract_cover_to
+
+
 // Torna cert si s'ha pogut extraure.
 static bool
 extract_cover (
@@ -170,67 +549,169 @@ extract_cover (
                )
 {
 
-  const size_t BLOCK_SIZE= 1024;
-  
   char *err;
-  StoryFile *sf;
-  uint8_t *data,*p;
-  size_t size,remain,writeb;
-  bool exist_cover;
-  FILE *f;
+  int ret;
   
+
+  err= NULL;
+  ret= extract_cover_to ( sf_fn, cover_fn, NULL, &err );
+  if ( ret == -1 )
+    {
+      fprintf ( stderr, "[EE] %s\n", err  );
+      g_free ( err );
+    }
   
-  // Prepara.
+  return ret == 1;
+  
+} // end extract_cover
+
+
+struct covers
+{
+  gint extracted;
+  gint errors;
+};
+
+
+struct covers_job
+{
+  gchar *sf_fn;
+  gchar *base;  // Ruta de l'eixida sense extensió.
+};
+
+
+static void
+extract_covers_job (
+                    gpointer data,
+                    gpointer user_data
+                    )
+{
+
+  struct covers_job *job;
+  struct covers *c;
+  char *err;
+  int ret;
+  
+
+  job= (struct covers_job *) data;
+  c= (struct covers *) user_data;
   err= NULL;
-  sf= NULL;
-  data= NULL;
-  f= NULL;
-  exist_cover= true;
-
-  // Extrau imatge.
-  sf= story_file_new_from_file_name ( sf_fn, &err );
-  if ( sf == NULL ) goto error;
-  if ( !story_file_get_frontispiece ( sf, &data, &size, &err ) )
-    goto error;
-  exist_cover= data!=NULL;
-
-  // Escriu en fitxer.
-  if ( exist_cover )
+  ret= extract_cover_to ( job->sf_fn, NULL, job->base, &err );
+  if ( ret == 1 ) g_atomic_int_inc ( &(c->extracted) );
+  else if ( ret == -1 )
     {
-      f= fopen ( cover_fn, "wb" );
-      if ( f == NULL )
-        {
-          msgerror ( &err, "Failed to create '%s'", cover_fn );
-          goto error;
-        }
-      remain= size;
-      p= data;
-      while ( remain > 0 )
-        {
-          writeb= remain > BLOCK_SIZE ? BLOCK_SIZE : remain;
-          if ( fwrite ( p, writeb, 1, f ) != 1 )
-            goto error;
-          p+= writeb;
-          remain-= writeb;
-        }
-      fclose ( f );
+      fprintf ( stderr, "[EE] %s\n", err  );
+      g_free ( err );
+      g_atomic_int_inc ( &(c->errors) );
     }
+  g_free ( job->sf_fn );
+  g_free ( job->base );
+  g_free ( job );
   
-  // Allibera memòria.
-  g_free ( data );
-  story_file_free ( sf );
+} // end extract_covers_job
+
+
+// Encua l'extracció de 'sf_fn' (se'n fa càrrec). El nom de l'eixida
+// és el nom del fitxer sense extensió. Si ja l'utilitza un altre
+// fitxer ('used') s'afegeix un sufix numèric.
+static void
+push_covers_job (
+                 GThreadPool *pool,
+                 GHashTable  *used,
+                 const gchar *dir,
+                 gchar       *sf_fn
+                 )
+{
+
+  struct covers_job *job;
+  gchar *base,*dot,*name;
+  int n;
   
-  return exist_cover;
+
+  base= g_path_get_basename ( sf_fn );
+  dot= strrchr ( base, '.' );
+  if ( dot != NULL && dot != base ) *dot= '\0';
+  name= g_strdup ( base );
+  for ( n= 2; g_hash_table_contains ( used, name ); ++n )
+    {
+      g_free ( name );
+      name= g_strdup_printf ( "%s-%d", base, n );
+    }
+  g_hash_table_add ( used, name );
+  g_free ( base );
+  job= g_new ( struct covers_job, 1 );
+  job->sf_fn= sf_fn;
+  job->base= g_build_filename ( dir, name, NULL );
+  g_thread_pool_push ( pool, job, NULL );
   
- error:
-  if ( f != NULL ) fclose ( f );
-  g_free ( data );
-  if ( sf != NULL ) story_file_free ( sf );
-  fprintf ( stderr, "[EE] %s\n", err  );
-  g_free ( err );
-  return false;
+} // end push_covers_job
+
+
+// Extrau les portades de tots els fitxers (i dels fitxers regulars
+// dels directoris) en 'dir' utilitzant un fil per processador. Torna
+// cert si no hi ha hagut cap error.
+static bool
+extract_covers (
+                const struct args *args,
+                const gchar       *dir,
+                const gboolean     verbose
+                )
+{
+
+  struct covers c;
+  GThreadPool *pool;
+  GHashTable *used;
+  GDir *d;
+  const gchar *name;
+  gchar *fn;
+  int n;
   
-} // end extract_cover
+
+  // Prepara.
+  if ( g_mkdir_with_parents ( dir, 0755 ) == -1 )
+    {
+      fprintf ( stderr, "[EE] Failed to create directory '%s': %s\n",
+                dir, strerror ( errno ) );
+      return false;
+    }
+  c.extracted= 0;
+  c.errors= 0;
+  pool= g_thread_pool_new ( extract_covers_job, &c,
+                            (gint) g_get_num_processors (), TRUE, NULL );
+  used= g_hash_table_new_full ( g_str_hash, g_str_equal, g_free, NULL );
+
+  // Encua.
+  for ( n= 0; n < args->N; ++n )
+    if ( g_file_test ( args->zcode_fns[n], G_FILE_TEST_IS_DIR ) )
+      {
+        d= g_dir_open ( args->zcode_fns[n], 0, NULL );
+        if ( d == NULL )
+          {
+            fprintf ( stderr, "[EE] Failed to open directory '%s'\n",
+                      args->zcode_fns[n] );
+            g_atomic_int_inc ( &(c.errors) );
+            continue;
+          }
+        while ( (name= g_dir_read_name ( d )) != NULL )
+          {
+            fn= g_build_filename ( args->zcode_fns[n], name, NULL );
+            if ( g_file_test ( fn, G_FILE_TEST_IS_REGULAR ) )
+              push_covers_job ( pool, used, dir, fn );
+            else g_free ( fn );
+          }
+        g_dir_close ( d );
+      }
+    else push_covers_job ( pool, used, dir, g_strdup ( args->zcode_fns[n] ) );
+
+  // Espera.
+  g_thread_pool_free ( pool, FALSE, TRUE );
+  g_hash_table_destroy ( used );
+  if ( verbose )
+    ii ( "Covers extracted: %d (errors: %d)", c.extracted, c.errors );
+  
+  return c.errors == 0;
+  
+} // end extract_covers
 
 
 
@@ -245,6 +726,8 @@ int main ( int argc, char *argv[] )
   struct args args;
   struct opts opts;
   Interpreter *intp;
+  InterpreterEngine engine;
+  ScreenMode screen_mode;
   Conf *conf;
   char *err;
   bool ok;
@@ -268,16 +751,35 @@ int main ( int argc, char *argv[] )
       free_opts ( &opts );
       return ok ? EXIT_SUCCESS : EXIT_FAILURE;
     }
+  if ( opts.covers_dir != NULL )
+    {
+      ok= extract_covers ( &args, opts.covers_dir, opts.verbose );
+      free_opts ( &opts );
+      return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+    }
+  if ( !parse_engine ( opts.engine, &engine, &err ) ) goto error;
+  if ( !parse_screen_mode ( opts.dumb, &screen_mode, &err ) ) goto error;
   conf= conf_new ( opts.verbose, opts.conf_fn, &err );
   if ( conf == NULL ) goto error;
-  if ( SDL_Init ( SDL_INIT_VIDEO|SDL_INIT_EVENTS ) != 0 )
+  if ( (screen_mode == SCREEN_SDL || opts.debug) &&
+       SDL_Init ( SDL_INIT_VIDEO|SDL_INIT_EVENTS ) != 0 )
     {
       msgerror ( &err, "Failed to initialize SDL: %s", SDL_GetError () );
       goto error;
     }
   
   // Executa.
-  if ( opts.debug )
+  if ( opts.bench > 0 )
+    {
+      if ( !run_bench ( &args, conf, screen_mode, opts.bench, &err ) )
+        goto error;
+    }
+  else if ( opts.replay_fn != NULL )
+    {
+      if ( !run_replay ( &args, &opts, conf, screen_mode, engine, &err ) )
+        goto error;
+    }
+  else if ( opts.debug )
     {
       if ( !debugger_run ( args.zcode_fn, conf, opts.verbose, &err ) )
         goto error;
@@ -286,9 +788,18 @@ int main ( int argc, char *argv[] )
     {
       intp= interpreter_new_from_file_name ( args.zcode_fn, conf,
                                              opts.transcript_fn,
+                                             screen_mode, opts.input_fn,
                                              opts.verbose, NULL, &err );
       if ( intp == NULL ) goto error;
+      interpreter_set_engine ( intp, engine );
+      interpreter_set_fusion ( intp, opts.fusion );
+      if ( opts.profile_fn != NULL ) interpreter_enable_profiler ( intp );
       if ( !interpreter_run ( intp, &err ) ) goto error;
+      if ( opts.profile_fn != NULL &&
+           !interpreter_write_profile ( intp, opts.profile_fn, &err ) )
+        goto error;
+      if ( opts.verbose && opts.fusion && engine == INTP_ENGINE_THREADED )
+        interpreter_print_fusion_stats ( intp, stderr );
       interpreter_free ( intp ); intp= NULL;
     }
   